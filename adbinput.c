@@ -0,0 +1,544 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file adbinput.c
+/// @author Harry Austen
+/// @brief Implementation of the Android input command front end
+
+// System includes
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local includes
+#include "adbinput.h"
+#include "program.h"
+#include "uinput.h"
+
+/// Maximum number of words in a command
+#define ADBINPUT_MAX_WORDS 32
+
+/// @brief An Android keycode and the key it is sent as
+struct adbinput_key {
+    /// Android keycode
+    int android;
+    /// Android name, without the KEYCODE_ prefix
+    char name[14];
+    /// Linux keycode
+    uint16_t code;
+};
+
+/// Android keycodes the device has a key for
+static const struct adbinput_key ADBINPUT_KEYS[] = {
+    {   3, "HOME", KEY_HOMEPAGE },
+    {   4, "BACK", KEY_BACK },
+    {   7, "0", KEY_0 },
+    {   8, "1", KEY_1 },
+    {   9, "2", KEY_2 },
+    {  10, "3", KEY_3 },
+    {  11, "4", KEY_4 },
+    {  12, "5", KEY_5 },
+    {  13, "6", KEY_6 },
+    {  14, "7", KEY_7 },
+    {  15, "8", KEY_8 },
+    {  16, "9", KEY_9 },
+    {  19, "DPAD_UP", KEY_UP },
+    {  20, "DPAD_DOWN", KEY_DOWN },
+    {  21, "DPAD_LEFT", KEY_LEFT },
+    {  22, "DPAD_RIGHT", KEY_RIGHT },
+    {  23, "DPAD_CENTER", KEY_ENTER },
+    {  24, "VOLUME_UP", KEY_VOLUMEUP },
+    {  25, "VOLUME_DOWN", KEY_VOLUMEDOWN },
+    {  26, "POWER", KEY_POWER },
+    {  29, "A", KEY_A },
+    {  30, "B", KEY_B },
+    {  31, "C", KEY_C },
+    {  32, "D", KEY_D },
+    {  33, "E", KEY_E },
+    {  34, "F", KEY_F },
+    {  35, "G", KEY_G },
+    {  36, "H", KEY_H },
+    {  37, "I", KEY_I },
+    {  38, "J", KEY_J },
+    {  39, "K", KEY_K },
+    {  40, "L", KEY_L },
+    {  41, "M", KEY_M },
+    {  42, "N", KEY_N },
+    {  43, "O", KEY_O },
+    {  44, "P", KEY_P },
+    {  45, "Q", KEY_Q },
+    {  46, "R", KEY_R },
+    {  47, "S", KEY_S },
+    {  48, "T", KEY_T },
+    {  49, "U", KEY_U },
+    {  50, "V", KEY_V },
+    {  51, "W", KEY_W },
+    {  52, "X", KEY_X },
+    {  53, "Y", KEY_Y },
+    {  54, "Z", KEY_Z },
+    {  55, "COMMA", KEY_COMMA },
+    {  56, "PERIOD", KEY_DOT },
+    {  57, "ALT_LEFT", KEY_LEFTALT },
+    {  58, "ALT_RIGHT", KEY_RIGHTALT },
+    {  59, "SHIFT_LEFT", KEY_LEFTSHIFT },
+    {  60, "SHIFT_RIGHT", KEY_RIGHTSHIFT },
+    {  61, "TAB", KEY_TAB },
+    {  62, "SPACE", KEY_SPACE },
+    {  66, "ENTER", KEY_ENTER },
+    {  67, "DEL", KEY_BACKSPACE },
+    {  68, "GRAVE", KEY_GRAVE },
+    {  69, "MINUS", KEY_MINUS },
+    {  70, "EQUALS", KEY_EQUAL },
+    {  71, "LEFT_BRACKET", KEY_LEFTBRACE },
+    {  72, "RIGHT_BRACKET", KEY_RIGHTBRACE },
+    {  73, "BACKSLASH", KEY_BACKSLASH },
+    {  74, "SEMICOLON", KEY_SEMICOLON },
+    {  75, "APOSTROPHE", KEY_APOSTROPHE },
+    {  76, "SLASH", KEY_SLASH },
+    {  82, "MENU", KEY_MENU },
+    {  92, "PAGE_UP", KEY_PAGEUP },
+    {  93, "PAGE_DOWN", KEY_PAGEDOWN },
+    { 111, "ESCAPE", KEY_ESC },
+    { 112, "FORWARD_DEL", KEY_DELETE },
+    { 113, "CTRL_LEFT", KEY_LEFTCTRL },
+    { 114, "CTRL_RIGHT", KEY_RIGHTCTRL },
+    { 115, "CAPS_LOCK", KEY_CAPSLOCK },
+    { 116, "SCROLL_LOCK", KEY_SCROLLLOCK },
+    { 117, "META_LEFT", KEY_LEFTMETA },
+    { 118, "META_RIGHT", KEY_RIGHTMETA },
+    { 120, "SYSRQ", KEY_SYSRQ },
+    { 121, "BREAK", KEY_PAUSE },
+    { 122, "MOVE_HOME", KEY_HOME },
+    { 123, "MOVE_END", KEY_END },
+    { 124, "INSERT", KEY_INSERT },
+    { 131, "F1", KEY_F1 },
+    { 132, "F2", KEY_F2 },
+    { 133, "F3", KEY_F3 },
+    { 134, "F4", KEY_F4 },
+    { 135, "F5", KEY_F5 },
+    { 136, "F6", KEY_F6 },
+    { 137, "F7", KEY_F7 },
+    { 138, "F8", KEY_F8 },
+    { 139, "F9", KEY_F9 },
+    { 140, "F10", KEY_F10 },
+    { 141, "F11", KEY_F11 },
+    { 142, "F12", KEY_F12 },
+    { 143, "NUM_LOCK", KEY_NUMLOCK },
+};
+
+/// Number of Android keycodes the device has a key for
+#define NUM_ADBINPUT_KEYS (sizeof(ADBINPUT_KEYS) / sizeof(*ADBINPUT_KEYS))
+
+/// Input sources of the Android syntax, all sent to the same device
+static const char ADBINPUT_SOURCES[][16] = {
+    "dpad", "gamepad", "joystick", "keyboard", "mouse", "rotaryencoder",
+    "stylus", "touchnavigation", "touchpad", "touchscreen", "trackball"
+};
+
+/// Usage string
+static const char adbinput_usage[] =
+    "Usage: input [<source>] <command> [<arg>...]\n"
+    "       input [--socket <path>]\n"
+    "    tap <x> <y>\n"
+    "    swipe <x1> <y1> <x2> <y2> [duration(ms)]\n"
+    "    draganddrop <x1> <y1> <x2> <y2> [duration(ms)]\n"
+    "    text <string>            (%s types a space)\n"
+    "    keyevent [--longpress] <key code number or name> ...\n"
+    "Without a command, commands are read from stdin, or from connections to the\n"
+    "socket at path, one per line and optionally starting with input. Each line is\n"
+    "answered with OK or ERROR once done\n";
+
+/// Parse an integer argument
+/// @param str The argument
+/// @param [out] value The integer
+/// @return 0 on success, 1 if str isn't an integer
+static int adbinput_int(const char * str, int32_t * value) {
+    char * end = NULL;
+    long l = strtol(str, &end, 10);
+    if (end == str || *end != '\0') {
+        fprintf(stderr, "input: invalid number %s\n", str);
+        return 1;
+    }
+    *value = (int32_t)l;
+    return 0;
+}
+
+/// Sleep until an absolute CLOCK_MONOTONIC time
+/// @param deadline The time to wake up at
+static void adbinput_sleep_until(const struct timespec * deadline) {
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR) {
+    }
+}
+
+/// Add milliseconds to a time
+/// @param [in,out] ts The time
+/// @param ms Milliseconds to add
+static void adbinput_add_ms(struct timespec * ts, uint32_t ms) {
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_nsec -= 1000000000;
+        ts->tv_sec++;
+    }
+}
+
+/// Compile a program and send it
+/// @param prog The compiled program (freed)
+/// @param err Whether compiling failed
+/// @return 0 on success, 1 if error(s)
+static int adbinput_send(struct program * prog, int err) {
+    err = err || uinput_send_frames(prog->events, prog->count);
+    program_free(prog);
+    return err;
+}
+
+/// Touch down at one point, move to another over a duration and lift
+/// @param from Start position
+/// @param to End position
+/// @param duration_ms Time taken to move
+/// @return 0 on success, 1 if error(s)
+static int adbinput_swipe(const int32_t from[2], const int32_t to[2], uint32_t duration_ms) {
+    struct program prog;
+    program_init(&prog);
+    int err = program_add(&prog, EV_ABS, ABS_X, from[0])
+        || program_add(&prog, EV_ABS, ABS_Y, from[1])
+        || program_add(&prog, EV_KEY, BTN_TOUCH, 1)
+        || program_sync(&prog);
+    if (adbinput_send(&prog, err)) {
+        return 1;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    uint32_t steps = duration_ms / ADBINPUT_SWIPE_STEP_MS;
+    steps = steps ? steps : 1;
+    for (uint32_t i = 1; i <= steps; ++i) {
+        adbinput_add_ms(&deadline, duration_ms / steps);
+        adbinput_sleep_until(&deadline);
+
+        struct input_event frame[2];
+        memset(frame, 0, sizeof(frame));
+        for (int axis = 0; axis != 2; ++axis) {
+            frame[axis].type = EV_ABS;
+            frame[axis].code = axis ? ABS_Y : ABS_X;
+            frame[axis].value = from[axis] + (int32_t)((int64_t)(to[axis] - from[axis]) * i / steps);
+        }
+        if (uinput_send_frame(frame, 2)) {
+            return 1;
+        }
+    }
+
+    program_init(&prog);
+    err = program_add(&prog, EV_KEY, BTN_TOUCH, 0) || program_sync(&prog);
+    return adbinput_send(&prog, err);
+}
+
+/// Press and release Android keys one after the other
+/// @param argc Number of keys
+/// @param argv The keys, by Android keycode number or name (with or without KEYCODE_)
+/// @param longpress Whether to hold each key for ADBINPUT_LONGPRESS_MS
+/// @return 0 on success, 1 if error(s)
+static int adbinput_keyevent(int argc, char ** argv, int longpress) {
+    uint16_t codes[ADBINPUT_MAX_WORDS];
+
+    // Resolve every key first, so an unknown one doesn't leave half of them sent
+    for (int i = 0; i != argc; ++i) {
+        const char * name = argv[i];
+        char * end = NULL;
+        long android = strtol(name, &end, 10);
+        int numeric = end != name && *end == '\0';
+        if (!strncmp(name, "KEYCODE_", 8)) {
+            name += 8;
+        }
+
+        size_t k = 0;
+        while (k != NUM_ADBINPUT_KEYS
+                && (numeric ? ADBINPUT_KEYS[k].android != android : strcmp(ADBINPUT_KEYS[k].name, name))) {
+            k++;
+        }
+        if (k == NUM_ADBINPUT_KEYS) {
+            fprintf(stderr, "input: unsupported key %s\n", argv[i]);
+            return 1;
+        }
+        codes[i] = ADBINPUT_KEYS[k].code;
+    }
+
+    for (int i = 0; i != argc; ++i) {
+        struct program prog;
+        program_init(&prog);
+        int err = program_add(&prog, EV_KEY, codes[i], 1) || program_sync(&prog);
+        if (longpress) {
+            err = adbinput_send(&prog, err);
+            struct timespec hold = { ADBINPUT_LONGPRESS_MS / 1000, (ADBINPUT_LONGPRESS_MS % 1000) * 1000000L };
+            while (!err && nanosleep(&hold, &hold) && errno == EINTR) {
+            }
+            program_init(&prog);
+        }
+        err = err || program_add(&prog, EV_KEY, codes[i], 0) || program_sync(&prog);
+        if (adbinput_send(&prog, err)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/// Type text, with %s standing for a space as in Android's input text
+/// @param text The text (modified)
+/// @return 0 on success, 1 if error(s)
+static int adbinput_text(char * text) {
+    static const struct program_type_options opts = { 1, 0 };
+
+    // Drop one pair of quotes around the whole text
+    size_t len = strlen(text);
+    if (len >= 2 && (text[0] == '"' || text[0] == '\'') && text[len - 1] == text[0]) {
+        text[len - 1] = '\0';
+        text++;
+    }
+
+    char * out = text;
+    for (const char * in = text; *in; ++in) {
+        if (in[0] == '%' && in[1] == 's') {
+            *out++ = ' ';
+            in++;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+
+    struct program prog;
+    program_init(&prog);
+    return adbinput_send(&prog, program_compile_text(&prog, text, &opts));
+}
+
+/// Run a command whose text argument, if any, is already a single word
+/// @param argc Number of words
+/// @param argv The words
+/// @return 0 on success, 1 if error(s)
+static int adbinput_run(int argc, char ** argv) {
+    // Commands from the command line aren't limited by adbinput_line()
+    if (argc > ADBINPUT_MAX_WORDS) {
+        fprintf(stderr, "input: too many words\n");
+        return 1;
+    }
+
+    // The source makes no difference to a single device
+    for (size_t i = 0; argc && i != sizeof(ADBINPUT_SOURCES) / sizeof(*ADBINPUT_SOURCES); ++i) {
+        if (!strcmp(argv[0], ADBINPUT_SOURCES[i])) {
+            argc--;
+            argv++;
+            break;
+        }
+    }
+    if (!argc) {
+        fprintf(stderr, "input: missing command\n");
+        return 1;
+    }
+
+    const char * cmd = argv[0];
+    int32_t args[5];
+    if (!strcmp(cmd, "tap") && argc == 3) {
+        if (adbinput_int(argv[1], &args[0]) || adbinput_int(argv[2], &args[1])) {
+            return 1;
+        }
+        struct program prog;
+        program_init(&prog);
+        return adbinput_send(&prog, program_compile_tap(&prog, args[0], args[1]));
+    }
+    if ((!strcmp(cmd, "swipe") || !strcmp(cmd, "draganddrop")) && (argc == 5 || argc == 6)) {
+        args[4] = ADBINPUT_SWIPE_MS;
+        for (int i = 1; i != argc; ++i) {
+            if (adbinput_int(argv[i], &args[i - 1])) {
+                return 1;
+            }
+        }
+        return adbinput_swipe(args, args + 2, args[4] > 0 ? (uint32_t)args[4] : 0);
+    }
+    if (!strcmp(cmd, "text") && argc == 2) {
+        return adbinput_text(argv[1]);
+    }
+    if (!strcmp(cmd, "keyevent") && argc >= 2) {
+        int longpress = !strcmp(argv[1], "--longpress");
+        if (argc - 1 - longpress > 0) {
+            return adbinput_keyevent(argc - 1 - longpress, argv + 1 + longpress, longpress);
+        }
+    }
+
+    fprintf(stderr, "input: invalid command: %s\n", cmd);
+    return 1;
+}
+
+int adbinput_command(int argc, char ** argv) {
+    // Let text span several words, as it would after shell splitting
+    int first = argc && strcmp(argv[0], "text") ? 1 : 0;
+    if (argc > first + 2 && !strcmp(argv[first], "text")) {
+        size_t len = 0;
+        for (int i = first + 1; i != argc; ++i) {
+            len += strlen(argv[i]) + 1;
+        }
+        char * text = malloc(len);
+        if (!text) {
+            return 1;
+        }
+        text[0] = '\0';
+        for (int i = first + 1; i != argc; ++i) {
+            strcat(text, argv[i]);
+            if (i + 1 != argc) {
+                strcat(text, " ");
+            }
+        }
+        char * words[3] = { argv[0], argv[1], NULL };
+        words[first + 1] = text;
+        int ret = adbinput_run(first + 2, words);
+        free(text);
+        return ret;
+    }
+    return adbinput_run(argc, argv);
+}
+
+/// Run a single command line
+/// @param line The line (modified)
+/// @return 0 on success, 1 if error(s)
+static int adbinput_line(char * line) {
+    char * words[ADBINPUT_MAX_WORDS];
+    int argc = 0;
+    char * save = NULL;
+
+    for (char * word = strtok_r(line, " \t", &save); word; word = strtok_r(NULL, " \t", &save)) {
+        // Lines may start with the command name, as typed to adb shell
+        if (!argc && !strcmp(word, "input")) {
+            continue;
+        }
+        if (argc == ADBINPUT_MAX_WORDS) {
+            fprintf(stderr, "input: too many words\n");
+            return 1;
+        }
+        words[argc++] = word;
+
+        // Text runs to the end of the line, spaces and all
+        if (!strcmp(word, "text") && save && *save) {
+            if (argc == ADBINPUT_MAX_WORDS) {
+                fprintf(stderr, "input: too many words\n");
+                return 1;
+            }
+            words[argc++] = save;
+            break;
+        }
+    }
+    return adbinput_run(argc, words);
+}
+
+int adbinput_serve(FILE * in, FILE * out) {
+    char * line = NULL;
+    size_t size = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &size, in)) != -1) {
+        while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (!len || line[0] == '#') {
+            continue;
+        }
+
+        // Only answer once the events have reached the device
+        int err = adbinput_line(line) || uinput_sync();
+        if (fputs(err ? "ERROR\n" : "OK\n", out) == EOF || fflush(out)) {
+            break;
+        }
+    }
+
+    free(line);
+    return ferror(in) ? 1 : 0;
+}
+
+int adbinput_listen(const char * path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "input: socket path %s too long\n", path);
+        return 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        fprintf(stderr, "input: failed to create socket: %s\n", strerror(errno));
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 4)) {
+        fprintf(stderr, "input: failed to listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+    chmod(path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+
+    // A client leaving before its answer must not end the server
+    signal(SIGPIPE, SIG_IGN);
+
+    for (;;) {
+        int client = accept(fd, NULL, NULL);
+        if (client == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "input: failed to accept: %s\n", strerror(errno));
+            break;
+        }
+
+        FILE * in = fdopen(client, "r");
+        int client_out = dup(client);
+        FILE * out = client_out == -1 ? NULL : fdopen(client_out, "w");
+        if (in && out) {
+            adbinput_serve(in, out);
+        }
+        if (out) {
+            fclose(out);
+        } else if (client_out != -1) {
+            close(client_out);
+        }
+        if (in) {
+            fclose(in);
+        } else {
+            close(client);
+        }
+    }
+
+    close(fd);
+    return 1;
+}
+
+int adbinput_main(int argc, char ** argv) {
+    if (argc == 1 && !strcmp(argv[0], "--help")) {
+        fprintf(stderr, "%s", adbinput_usage);
+        return 1;
+    }
+    if (argc == 2 && !strcmp(argv[0], "--socket")) {
+        return adbinput_listen(argv[1]);
+    }
+    if (argc) {
+        if (adbinput_command(argc, argv)) {
+            fprintf(stderr, "%s", adbinput_usage);
+            return 1;
+        }
+        return 0;
+    }
+    return adbinput_serve(stdin, stdout);
+}
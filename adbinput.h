@@ -0,0 +1,63 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file adbinput.h
+/// @author Harry Austen
+/// @brief Front end speaking the Android input command syntax
+/// @details Commands are "[<source>] tap <x> <y>", "swipe <x1> <y1> <x2> <y2> [<ms>]",
+/// "draganddrop" (the same as swipe), "text <string>" and "keyevent [--longpress] <key>...",
+/// where keys are Android keycodes by number or KEYCODE_ name. The source is accepted
+/// and ignored: the device is a touchscreen with a keyboard
+
+#ifndef __ADBINPUT_H__
+#define __ADBINPUT_H__
+
+// System includes
+#include <stdio.h>
+
+/// Default swipe duration in milliseconds, as Android's
+#define ADBINPUT_SWIPE_MS 300
+
+/// Milliseconds between the touch reports of a swipe
+#define ADBINPUT_SWIPE_STEP_MS 5
+
+/// Milliseconds a key is held for keyevent --longpress
+#define ADBINPUT_LONGPRESS_MS 500
+
+/// @brief Run a single command
+/// @param argc Number of words
+/// @param argv The words, starting with the optional source or the command
+/// @return 0 on success, 1 if error(s)
+int adbinput_command(int argc, char ** argv);
+
+/// @brief Run commands one per line until the end of the input
+/// @details Each command, optionally preceded by "input", is answered with a line
+/// "OK" once its events have reached the device, or "ERROR" if it failed
+/// @param in Stream of commands
+/// @param out Stream for the answers
+/// @return 0 at the end of the input, 1 if error(s)
+int adbinput_serve(FILE * in, FILE * out);
+
+/// @brief Serve connections to a Unix socket, one after another, see adbinput_serve()
+/// @param path Path of the socket
+/// @return 1 if error(s), doesn't return otherwise
+int adbinput_listen(const char * path);
+
+/// @brief Entry point of the input command
+/// @details With a command, runs it. With --socket <path>, serves the socket.
+/// Otherwise serves stdin
+/// @param argc Number of arguments after "input"
+/// @param argv The arguments after "input"
+/// @return 0 on success, 1 if error(s)
+int adbinput_main(int argc, char ** argv);
+
+#endif // __ADBINPUT_H__
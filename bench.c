@@ -0,0 +1,449 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file bench.c
+/// @author Harry Austen
+/// @brief Microbenchmarks of the text and key translation paths, run by make bench-micro.
+/// Events are written to the null device, so the figures include one write per frame
+/// but no pacing or device. Last, a gamepad is streamed to the null device at its rate,
+/// to check that the intervals between snapshots hold steady
+
+// System includes
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local includes
+#include "gamepad.h"
+#include "program.h"
+#include "translate.h"
+#include "uinput.h"
+#include "ydotool.h"
+
+/// Minimum time each benchmark runs for, in nanoseconds
+#define BENCH_MIN_NS 200000000
+
+/// Size of the small corpora in bytes
+#define BENCH_CORPUS 4096
+
+/// Default size of the large file corpus in KiB
+#define BENCH_LARGE_KIB 64
+
+/// Number of gamepad snapshots, two seconds' worth at the default rate
+#define BENCH_SNAPSHOTS (2 * GAMEPAD_RATE)
+
+/// Prose corpus seed
+static const char * PROSE =
+    "It was the best of times, it was the worst of times; it was the age of wisdom, "
+    "it was the age of foolishness. \"Really?\" she asked - and (after 3 or 4 minutes) "
+    "nobody answered.\n";
+
+/// Source code corpus seed
+static const char * SOURCE =
+    "int main(int argc, char ** argv) {\n"
+    "\tfor (int i = 0; i != argc; ++i) {\n"
+    "\t\tprintf(\"%d: %s\\n\", i, argv[i]);\n"
+    "\t}\n"
+    "\treturn x[0] + y->z * 2 - ~mask | (flags & 0x1f) ^ !ok;\n"
+    "}\n";
+
+/// Uppercase corpus seed
+static const char * UPPERCASE =
+    "WARNING: THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG AGAIN. ";
+
+/// Chords typical of the key command
+static const char * CHORDS[] = {
+    "CTRL+ALT+F1",
+    "ALT+F4",
+    "CTRL+SHIFT+t",
+    "SUPER+s",
+    "CTRL+c",
+    "SHIFT+1",
+    "ENTER",
+    "a"
+};
+
+/// Number of chords
+#define NUM_CHORDS (sizeof(CHORDS) / sizeof(*CHORDS))
+
+/// @brief What a benchmark runs over
+struct bench_input {
+    /// Text corpus
+    char * text;
+    /// Number of characters in text
+    size_t len;
+    /// Path of a file holding text
+    const char * path;
+    /// text split into arguments
+    char ** argv;
+    /// Number of arguments
+    int argc;
+    /// Keycodes of text, written by the translation benchmarks
+    uint16_t * codes;
+    /// Shift flags of text, written by the translation benchmarks
+    uint8_t * shifted;
+};
+
+/// Get the current CLOCK_MONOTONIC time
+/// @return Nanoseconds
+static int64_t bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/// Run a benchmark repeatedly for at least BENCH_MIN_NS and print the time per unit
+/// @param name Name of the benchmark
+/// @param unit What the work is counted in
+/// @param units Units of work per run
+/// @param fn The benchmark
+/// @param input What the benchmark runs over
+/// @return 0 on success, 1 if the benchmark failed
+static int bench_run(const char * name, const char * unit, size_t units,
+        int (*fn)(const struct bench_input *), const struct bench_input * input) {
+    // Warm up caches and allocations first
+    if (fn(input)) {
+        fprintf(stderr, "%s: failed\n", name);
+        return 1;
+    }
+
+    uint64_t runs = 0;
+    int64_t start = bench_now();
+    int64_t elapsed = 0;
+    while (elapsed < BENCH_MIN_NS) {
+        if (fn(input)) {
+            fprintf(stderr, "%s: failed\n", name);
+            return 1;
+        }
+        runs++;
+        elapsed = bench_now() - start;
+    }
+
+    printf("%-28s %10.1f ns/%s  (%" PRIu64 " runs)\n", name, (double)elapsed / (double)(runs * units), unit, runs);
+    return 0;
+}
+
+/// Look up every character of the corpus
+/// @param input The corpus
+/// @return 0 on success, 1 if error(s)
+static int bench_keychar(const struct bench_input * input) {
+    for (size_t i = 0; i != input->len; ++i) {
+        uint16_t keycode;
+        uint8_t shifted;
+        if (uinput_keychar_to_keycode(input->text[i], &keycode, &shifted)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/// Translate the corpus a byte at a time through the lookup table
+/// @param input The corpus
+/// @return 0 on success, 1 if error(s)
+static int bench_translate_scalar(const struct bench_input * input) {
+    return translate_text_scalar(input->text, input->len, input->codes, input->shifted) != input->len;
+}
+
+/// Translate the corpus with the vector pass, as typing does
+/// @param input The corpus
+/// @return 0 on success, 1 if error(s)
+static int bench_translate(const struct bench_input * input) {
+    return translate_text(input->text, input->len, input->codes, input->shifted);
+}
+
+/// Look up every key of every chord
+/// @param input Unused
+/// @return 0 on success, 1 if error(s)
+static int bench_keystring(const struct bench_input * input) {
+    (void)input;
+    for (size_t i = 0; i != NUM_CHORDS; ++i) {
+        char chord[32];
+        strcpy(chord, CHORDS[i]);
+        for (char * key = strtok(chord, "+"); key; key = strtok(NULL, "+")) {
+            uint16_t keycode;
+            uint8_t shifted;
+            if (uinput_keystring_to_keycode(key, &keycode, &shifted)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/// Enter every chord
+/// @param input Unused
+/// @return 0 on success, 1 if error(s)
+static int bench_chords(const struct bench_input * input) {
+    (void)input;
+    for (size_t i = 0; i != NUM_CHORDS; ++i) {
+        if (key_enter_keys(CHORDS[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/// Compile the corpus without sending it
+/// @param input The corpus
+/// @return 0 on success, 1 if error(s)
+static int bench_compile(const struct bench_input * input) {
+    static const struct program_type_options opts = { 1, 0 };
+    struct program prog;
+    program_init(&prog);
+    int ret = program_compile_text(&prog, input->text, &opts);
+    program_free(&prog);
+    return ret;
+}
+
+/// Type the corpus as command line arguments
+/// @param input The corpus
+/// @return 0 on success, 1 if error(s)
+static int bench_type_args(const struct bench_input * input) {
+    static const struct type_options opts = { { 1, 0 }, false };
+    return type_args(input->argc, input->argv, &opts);
+}
+
+/// Type the corpus file from stdin
+/// @param input The corpus
+/// @return 0 on success, 1 if error(s)
+static int bench_type_stdin(const struct bench_input * input) {
+    static const struct type_options opts = { { 1, 0 }, false };
+    if (!freopen(input->path, "r", stdin)) {
+        return 1;
+    }
+    return type_stdin(&opts);
+}
+
+/// Type the corpus file with type --file
+/// @param input The corpus
+/// @return 0 on success, 1 if error(s)
+static int bench_type_file(const struct bench_input * input) {
+    static const struct type_options opts = { { 1, 0 }, false };
+    // type_file() frees the path it's given
+    char * path = strdup(input->path);
+    return !path || type_file(path, &opts);
+}
+
+/// Gamepad the snapshots are written to
+static struct gamepad GAMEPAD;
+
+/// Snapshots of sticks going round, triggers ramping and buttons toggling now and then
+static struct gamepad_snapshot SNAPSHOTS[BENCH_SNAPSHOTS];
+
+/// Fill SNAPSHOTS for the default profile
+static void bench_snapshots() {
+    for (size_t i = 0; i != BENCH_SNAPSHOTS; ++i) {
+        double angle = 2.0 * M_PI * (double)i / 500.0;
+        struct gamepad_snapshot * snapshot = &SNAPSHOTS[i];
+        memset(snapshot, 0, sizeof(*snapshot));
+        snapshot->abs[0] = (int32_t)lround(32767.0 * cos(angle));
+        snapshot->abs[1] = (int32_t)lround(32767.0 * sin(angle));
+        snapshot->abs[2] = (int32_t)lround(16000.0 * cos(angle / 3.0));
+        snapshot->abs[3] = (int32_t)lround(16000.0 * sin(angle / 3.0));
+        snapshot->abs[4] = (int32_t)(i / 4 % 256);
+        snapshot->abs[5] = (int32_t)(255 - i / 4 % 256);
+        snapshot->abs[6] = (int32_t)(i / 250 % 3) - 1;
+        snapshot->buttons = (uint32_t)(i / 100 % 2048);
+    }
+}
+
+/// Write every snapshot to the gamepad as fast as possible
+/// @param input Unused
+/// @return 0 on success, 1 if error(s)
+static int bench_gamepad_emit(const struct bench_input * input) {
+    (void)input;
+    for (size_t i = 0; i != BENCH_SNAPSHOTS; ++i) {
+        if (gamepad_emit(&GAMEPAD, &SNAPSHOTS[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/// Compare two int64_t values for qsort()
+/// @param a First value
+/// @param b Second value
+/// @return <0, 0 or >0 as a is less than, equal to or greater than b
+static int bench_compare(const void * a, const void * b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/// Push every snapshot to the gamepad at its rate and print the intervals between them
+/// @param rate Snapshots per second
+/// @return 0 on success, 1 if error(s)
+static int bench_gamepad_rate(uint32_t rate) {
+    static int64_t intervals[BENCH_SNAPSHOTS - 1];
+    gamepad_set_rate(&GAMEPAD, rate);
+    uint64_t late = GAMEPAD.stats.late;
+
+    int64_t start = 0;
+    int64_t previous = 0;
+    for (size_t i = 0; i != BENCH_SNAPSHOTS; ++i) {
+        if (gamepad_push(&GAMEPAD, &SNAPSHOTS[i])) {
+            fprintf(stderr, "gamepad_push: failed\n");
+            return 1;
+        }
+        int64_t now = bench_now();
+        if (i) {
+            intervals[i - 1] = now - previous;
+        } else {
+            start = now;
+        }
+        previous = now;
+    }
+    gamepad_set_rate(&GAMEPAD, 0);
+
+    const size_t count = BENCH_SNAPSHOTS - 1;
+    qsort(intervals, count, sizeof(*intervals), bench_compare);
+    char name[32];
+    snprintf(name, sizeof(name), "  gamepad_push (%u Hz)", rate);
+    printf("%-28s %10.1f Hz  interval p1 %.1f, p50 %.1f, p99 %.1f, max %.1f us, %" PRIu64 " late\n", name,
+        (double)count * 1e9 / (double)(previous - start),
+        (double)intervals[count / 100] / 1000.0, (double)intervals[count / 2] / 1000.0,
+        (double)intervals[count * 99 / 100] / 1000.0, (double)intervals[count - 1] / 1000.0,
+        GAMEPAD.stats.late - late);
+    return 0;
+}
+
+/// Build a corpus by repeating a seed
+/// @param [out] input The corpus
+/// @param seed Text to repeat
+/// @param len Length of the corpus
+/// @return 0 on success, 1 if error(s)
+static int bench_corpus(struct bench_input * input, const char * seed, size_t len) {
+    size_t seed_len = strlen(seed);
+    memset(input, 0, sizeof(*input));
+    input->text = malloc(len + 1);
+    if (!input->text) {
+        return 1;
+    }
+    for (size_t i = 0; i != len; ++i) {
+        input->text[i] = seed[i % seed_len];
+    }
+    input->text[len] = '\0';
+    input->len = len;
+    input->codes = malloc(sizeof(*input->codes) * len);
+    input->shifted = malloc(len);
+    if (!input->codes || !input->shifted) {
+        return 1;
+    }
+
+    // Split into arguments of up to 16 characters, as a shell would pass words
+    input->argc = (int)((len + 15) / 16);
+    input->argv = malloc(sizeof(char *) * (size_t)input->argc);
+    char * args = malloc(len + (size_t)input->argc);
+    if (!input->argv || !args) {
+        return 1;
+    }
+    for (int i = 0; i != input->argc; ++i) {
+        size_t n = len - (size_t)i * 16 < 16 ? len - (size_t)i * 16 : 16;
+        input->argv[i] = args + (size_t)i * 17;
+        memcpy(input->argv[i], input->text + (size_t)i * 16, n);
+        input->argv[i][n] = '\0';
+    }
+    return 0;
+}
+
+/// Free a corpus
+/// @param input The corpus
+static void bench_corpus_free(struct bench_input * input) {
+    if (input->argv) {
+        free(input->argv[0]);
+    }
+    free(input->argv);
+    free(input->text);
+    free(input->codes);
+    free(input->shifted);
+}
+
+/// Main entrypoint to the benchmark harness
+/// @param argc Number of input arguments
+/// @param argv Array of input arguments: optionally the size of the large file corpus in KiB
+/// @return 0 on success, 1 if error(s)
+int main(int argc, char ** argv) {
+    size_t large = (argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_LARGE_KIB) * 1024;
+    if (!large || uinput_create_null()) {
+        fprintf(stderr, "Usage: bench [<large file KiB>]\n");
+        return 1;
+    }
+
+    struct {
+        const char * name;
+        const char * seed;
+        size_t len;
+    } corpora[] = {
+        { "prose", PROSE, BENCH_CORPUS },
+        { "source", SOURCE, BENCH_CORPUS },
+        { "uppercase", UPPERCASE, BENCH_CORPUS },
+        { "large", PROSE, large }
+    };
+
+    char simd_name[32];
+    snprintf(simd_name, sizeof(simd_name), "  translate_text (%s)", translate_simd_name());
+
+    int ret = 0;
+    for (size_t i = 0; i != sizeof(corpora) / sizeof(*corpora); ++i) {
+        struct bench_input input;
+        if (bench_corpus(&input, corpora[i].seed, corpora[i].len)) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        printf("%s: %zu chars\n", corpora[i].name, input.len);
+
+        ret |= bench_run("  keychar_to_keycode", "char", input.len, bench_keychar, &input);
+        ret |= bench_run("  translate_text_scalar", "byte", input.len, bench_translate_scalar, &input);
+        ret |= bench_run(simd_name, "byte", input.len, bench_translate, &input);
+        ret |= bench_run("  program_compile_text", "char", input.len, bench_compile, &input);
+        ret |= bench_run("  type_args", "char", input.len, bench_type_args, &input);
+
+        // The readers only make sense on whole files
+        if (i == sizeof(corpora) / sizeof(*corpora) - 1) {
+            char path[] = "/tmp/ydotool-bench-XXXXXX";
+            int fd = mkstemp(path);
+            if (fd == -1 || write(fd, input.text, input.len) != (ssize_t)input.len || close(fd)) {
+                fprintf(stderr, "Failed to write %s\n", path);
+                return 1;
+            }
+            input.path = path;
+            ret |= bench_run("  type_stdin", "char", input.len, bench_type_stdin, &input);
+            ret |= bench_run("  type_file", "char", input.len, bench_type_file, &input);
+            unlink(path);
+        }
+        bench_corpus_free(&input);
+    }
+
+    printf("chords: %zu\n", NUM_CHORDS);
+    ret |= bench_run("  keystring_to_keycode", "chord", NUM_CHORDS, bench_keystring, NULL);
+    ret |= bench_run("  key_enter_keys", "chord", NUM_CHORDS, bench_chords, NULL);
+
+    struct gamepad_profile profile;
+    gamepad_profile_default(&profile);
+    if (gamepad_create(&GAMEPAD, &profile, 1)) {
+        return 1;
+    }
+    bench_snapshots();
+    gamepad_set_rate(&GAMEPAD, 0);
+    printf("gamepad: %u values, %u buttons\n", GAMEPAD.num_abs, GAMEPAD.num_buttons);
+    ret |= bench_run("  gamepad_emit", "snapshot", BENCH_SNAPSHOTS, bench_gamepad_emit, NULL);
+    ret |= bench_gamepad_rate(GAMEPAD_RATE);
+    ret |= bench_gamepad_rate(GAMEPAD_RATE / 4);
+    gamepad_destroy(&GAMEPAD);
+
+    uinput_destroy();
+    return ret;
+}
@@ -0,0 +1,283 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file calibrate.c
+/// @author Harry Austen
+/// @brief Implementation of the closed-loop pacing calibration
+
+// System includes
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local includes
+#include "calibrate.h"
+#include "uinput.h"
+
+/// Keys pressed and released in turn by each trial
+static const uint16_t CALIBRATE_KEYS[] = {
+    KEY_A, KEY_S, KEY_D, KEY_F, KEY_J, KEY_K, KEY_L, KEY_SEMICOLON
+};
+
+/// Number of keys pressed by each trial
+#define NUM_CALIBRATE_KEYS (sizeof(CALIBRATE_KEYS) / sizeof(*CALIBRATE_KEYS))
+
+/// Usage string
+static const char calibrate_usage[] =
+    "Usage: calibrate [--frames <n>] [--trials <n>] [--max <us>] [--output <path>] [--dry-run]\n"
+    "    --help           Show this help\n"
+    "    --frames n       Frames written per trial (default 2000)\n"
+    "    --trials n       Trials each pace has to pass (default 3)\n"
+    "    --max us         Slowest pace tried, in microseconds after each frame (default 2000)\n"
+    "    --output path    Config file to write (default " UINPUT_CONFIG_PATH ", or $" UINPUT_CONFIG_ENV ")\n"
+    "    --dry-run        Only report the pace found\n"
+    "Creates its own device and grabs it, so nothing else receives the keys typed.\n"
+    "Restart ydotoold afterwards for it to pick up the new pace\n";
+
+/// @brief Events read back during a trial
+struct calibrate_reader {
+    /// The grabbed evdev node
+    int fd;
+    /// Number of key events expected
+    uint32_t expected;
+    /// Number of key events read
+    uint32_t count;
+    /// Number of key events that weren't the one expected next
+    uint32_t errors;
+    /// Set if the kernel reported dropping events
+    int dropped;
+    /// Set if reading failed
+    int failed;
+};
+
+/// Get the key event written by a frame of a trial
+/// @param frame Index of the frame
+/// @param [out] code The key
+/// @param [out] value 1 for a press, 0 for a release
+static void calibrate_frame(uint32_t frame, uint16_t * code, int32_t * value) {
+    *code = CALIBRATE_KEYS[(frame / 2) % NUM_CALIBRATE_KEYS];
+    *value = frame % 2 ? 0 : 1;
+}
+
+/// Reader thread: checks key events against the trial's sequence until all arrived or none have for a while
+/// @param arg The reader
+static void * calibrate_read(void * arg) {
+    struct calibrate_reader * reader = arg;
+    struct input_event events[64];
+    struct pollfd pfd = { reader->fd, POLLIN, 0 };
+
+    while (reader->count < reader->expected) {
+        int ready = poll(&pfd, 1, CALIBRATE_SETTLE_MS);
+        if (ready == 0) {
+            break;
+        }
+        ssize_t n = ready < 0 ? -1 : read(reader->fd, events, sizeof(events));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            reader->failed = 1;
+            break;
+        }
+
+        for (size_t i = 0; i != (size_t)n / sizeof(*events); ++i) {
+            const struct input_event * ev = &events[i];
+            if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+                reader->dropped = 1;
+            }
+            // Autorepeat isn't part of the sequence
+            if (ev->type != EV_KEY || ev->value == 2) {
+                continue;
+            }
+            uint16_t code;
+            int32_t value;
+            calibrate_frame(reader->count, &code, &value);
+            reader->errors += ev->code != code || ev->value != value;
+            reader->count++;
+        }
+    }
+    return NULL;
+}
+
+int calibrate_trial(int evdev, uint32_t pace_us, uint32_t frames, double * rate) {
+    struct calibrate_reader reader = { evdev, frames, 0, 0, 0, 0 };
+    pthread_t thread;
+    *rate = 0.0;
+    if (pthread_create(&thread, NULL, calibrate_read, &reader)) {
+        fprintf(stderr, "Error creating thread!\n");
+        return -1;
+    }
+
+    uinput_set_pace(pace_us);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int err = 0;
+    for (uint32_t i = 0; !err && i != frames; ++i) {
+        struct input_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.type = EV_KEY;
+        calibrate_frame(i, &ev.code, &ev.value);
+        err = uinput_send_frame(&ev, 1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_join(thread, NULL);
+
+    double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    *rate = elapsed > 0.0 ? frames / elapsed : 0.0;
+    if (err || reader.failed) {
+        fprintf(stderr, "Trial failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return reader.dropped || reader.errors || reader.count != frames;
+}
+
+/// Run the trials of a pace
+/// @param evdev File descriptor of the device's grabbed evdev node
+/// @param pace_us Microseconds slept after each frame
+/// @param frames Number of frames written per trial
+/// @param trials Number of trials that have to pass
+/// @return 0 if all passed, 1 if one failed, -1 on error
+static int calibrate_pace(int evdev, uint32_t pace_us, uint32_t frames, uint32_t trials) {
+    for (uint32_t i = 0; i != trials; ++i) {
+        double rate;
+        int ret = calibrate_trial(evdev, pace_us, frames, &rate);
+        printf("pace %5uus  %8.0f frames/s  %s\n", pace_us, rate, ret ? "lost" : "ok");
+        if (ret) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+int calibrate_main(int argc, char ** argv) {
+    uint32_t frames = CALIBRATE_FRAMES;
+    uint32_t trials = CALIBRATE_TRIALS;
+    uint32_t max_us = CALIBRATE_MAX_US;
+    const char * output = uinput_config_path();
+    int dry_run = 0;
+
+    enum optlist_t {
+        opt_help,
+        opt_frames,
+        opt_trials,
+        opt_max,
+        opt_output,
+        opt_dry_run,
+    };
+
+    static struct option long_options[] = {
+        {"help",    no_argument,       NULL, opt_help   },
+        {"frames",  required_argument, NULL, opt_frames },
+        {"trials",  required_argument, NULL, opt_trials },
+        {"max",     required_argument, NULL, opt_max    },
+        {"output",  required_argument, NULL, opt_output },
+        {"dry-run", no_argument,       NULL, opt_dry_run},
+        {NULL,      0,                 NULL, 0          }
+    };
+
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case opt_frames:
+                frames = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_trials:
+                trials = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_max:
+                max_us = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_output:
+                output = optarg;
+                break;
+            case opt_dry_run:
+                dry_run = 1;
+                break;
+            default:
+                fprintf(stderr, "%s", calibrate_usage);
+                return 1;
+        }
+    }
+    if (optind != argc || !frames || !trials || !max_us) {
+        fprintf(stderr, "%s", calibrate_usage);
+        return 1;
+    }
+    // Every key pressed is released again
+    frames += frames % 2;
+
+    // A device of our own: through ydotoold there is no evdev node to read back from
+    char node[PATH_MAX];
+    char dev[32];
+    if (uinput_create_device() || uinput_wait_device(1000) || uinput_event_node(node, sizeof(node), dev, sizeof(dev))) {
+        uinput_destroy();
+        return 1;
+    }
+    int evdev = open(node, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (evdev == -1 || ioctl(evdev, EVIOCGRAB, 1)) {
+        fprintf(stderr, "Failed to grab %s: %s\n", node, strerror(errno));
+        if (evdev != -1) {
+            close(evdev);
+        }
+        uinput_destroy();
+        return 1;
+    }
+    printf("Calibrating %s with %u trials of %u frames\n", node, trials, frames);
+
+    // Unpaced if that's safe, otherwise bisect between a failing and a passing pace
+    uint32_t best = 0;
+    int ret = calibrate_pace(evdev, 0, frames, trials);
+    if (ret > 0) {
+        ret = calibrate_pace(evdev, max_us, frames, trials);
+        if (ret > 0) {
+            fprintf(stderr, "Events are lost even %uus apart\n", max_us);
+        }
+        uint32_t lo = 0;
+        uint32_t hi = max_us;
+        while (!ret && hi - lo > 1 && hi - lo > hi / 20) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            ret = calibrate_pace(evdev, mid, frames, trials);
+            if (ret > 0) {
+                lo = mid;
+                ret = 0;
+            } else if (!ret) {
+                hi = mid;
+            }
+        }
+        best = hi;
+    }
+
+    ioctl(evdev, EVIOCGRAB, 0);
+    close(evdev);
+    uinput_destroy();
+    if (ret) {
+        return 1;
+    }
+
+    printf("Safe pace %uus after each frame\n", best);
+    if (dry_run) {
+        return 0;
+    }
+    if (uinput_save_pace(output, best)) {
+        return 1;
+    }
+    printf("Written to %s\n", output);
+    return 0;
+}
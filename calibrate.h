@@ -0,0 +1,53 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file calibrate.h
+/// @author Harry Austen
+/// @brief Closed-loop calibration of the pacing of writes to the device
+/// @details Key presses are written to a fresh virtual device at a given pace and read
+/// back from its evdev node, grabbed so that nothing else receives them. The pace is
+/// searched for the shortest one at which every event arrives, in order, without the
+/// kernel reporting SYN_DROPPED, and saved to the config file read by uinput_get_pace()
+
+#ifndef __CALIBRATE_H__
+#define __CALIBRATE_H__
+
+// System includes
+#include <stdint.h>
+
+/// Default number of frames written per trial
+#define CALIBRATE_FRAMES 2000
+
+/// Default number of trials a pace has to pass
+#define CALIBRATE_TRIALS 3
+
+/// Default slowest pace tried, in microseconds
+#define CALIBRATE_MAX_US 2000
+
+/// Milliseconds without events after which a trial's missing events count as lost
+#define CALIBRATE_SETTLE_MS 500
+
+/// @brief Write frames at a pace and check they all read back in order
+/// @param evdev File descriptor of the device's grabbed evdev node
+/// @param pace_us Microseconds slept after each frame
+/// @param frames Number of frames to write
+/// @param [out] rate Frames per second achieved, 0 if the trial couldn't start
+/// @return 0 if every event came back in order, 1 if any were lost or reordered, -1 on error
+int calibrate_trial(int evdev, uint32_t pace_us, uint32_t frames, double * rate);
+
+/// @brief Entry point of the calibrate command
+/// @param argc Number of arguments after "calibrate"
+/// @param argv The arguments after "calibrate"
+/// @return 0 on success, 1 if error(s)
+int calibrate_main(int argc, char ** argv);
+
+#endif // __CALIBRATE_H__
@@ -0,0 +1,247 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file execbench.c
+/// @author Harry Austen
+/// @brief Startup time benchmark for ydotool. Stands in for ydotoold on its socket,
+/// runs a client command repeatedly and reports the time from exec until its first
+/// event arrives, and until it exits. Control requests are answered with 0
+
+// System includes
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local includes
+#include "ydotoold.h"
+
+/// Milliseconds to wait for a client to connect
+#define EXECBENCH_TIMEOUT_MS 5000
+
+/// Default number of runs
+#define EXECBENCH_RUNS 200
+
+extern char ** environ;
+
+/// Usage string
+static const char execbench_usage[] =
+    "Usage: execbench [--runs <n>] <command> [<arg>...]\n"
+    "    --help           Show this help\n"
+    "    --runs n         Number of runs, after one warm-up run (default 200)\n"
+    "Stop ydotoold first: execbench listens on " YDOTOOLD_SOCKET_PATH " in its place\n";
+
+/// Get the current CLOCK_MONOTONIC time
+/// @return Nanoseconds
+static int64_t execbench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/// Compare two nanosecond values for qsort
+/// @param a First value
+/// @param b Second value
+/// @return <0, 0 or >0 as a is less than, equal to or greater than b
+static int execbench_compare(const void * a, const void * b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/// Print the distribution of a set of nanosecond values
+/// @param name What the values are
+/// @param values The values, sorted in place
+/// @param count Number of values
+static void execbench_distribution(const char * name, int64_t * values, size_t count) {
+    qsort(values, count, sizeof(*values), execbench_compare);
+    printf("%-12s min %8.1fus  p50 %8.1fus  p99 %8.1fus  max %8.1fus\n", name,
+        (double)values[0] / 1000.0,
+        (double)values[count / 2] / 1000.0,
+        (double)values[count * 99 / 100] / 1000.0,
+        (double)values[count - 1] / 1000.0);
+}
+
+/// Listen on the daemon's socket
+/// @return The listening socket, -1 on error
+static int execbench_listen() {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, YDOTOOLD_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "ydotoold is running on %s, stop it first\n", YDOTOOLD_SOCKET_PATH);
+        close(fd);
+        return -1;
+    }
+    unlink(YDOTOOLD_SOCKET_PATH);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 4)) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", YDOTOOLD_SOCKET_PATH, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/// Read a client's records until it disconnects, answering control requests
+/// @param fd The client connection
+/// @param [out] first Time the first record arrived, 0 if none did
+/// @return 0 on success, 1 if error(s)
+static int execbench_drain(int fd, int64_t * first) {
+    *first = 0;
+    for (;;) {
+        struct input_event ie;
+        ssize_t n = recv(fd, &ie, sizeof(ie), MSG_WAITALL);
+        if (n == 0) {
+            return 0;
+        }
+        if (n != sizeof(ie)) {
+            return 1;
+        }
+        if (!*first) {
+            *first = execbench_now();
+        }
+        if (ie.type != YDOTOOLD_CTL) {
+            continue;
+        }
+
+        // Skip the payload and answer
+        char payload[YDOTOOLD_MAX_PAYLOAD];
+        if (ie.value < 0 || ie.value > YDOTOOLD_MAX_PAYLOAD
+                || (ie.value && recv(fd, payload, (size_t)ie.value, MSG_WAITALL) != ie.value)) {
+            return 1;
+        }
+        ie.value = 0;
+        if (send(fd, &ie, sizeof(ie), MSG_NOSIGNAL) != sizeof(ie)) {
+            return 1;
+        }
+    }
+}
+
+/// Run the command once
+/// @param listen_fd The listening socket
+/// @param argv The command
+/// @param [out] first_ns Time from exec until the first event arrived
+/// @param [out] exit_ns Time from exec until the command exited
+/// @return 0 on success, 1 if error(s)
+static int execbench_run(int listen_fd, char ** argv, int64_t * first_ns, int64_t * exit_ns) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    pid_t pid;
+    int64_t start = execbench_now();
+    int err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err) {
+        fprintf(stderr, "Failed to run %s: %s\n", argv[0], strerror(err));
+        return 1;
+    }
+
+    int64_t first = 0;
+    struct pollfd pfd = { listen_fd, POLLIN, 0 };
+    int client = poll(&pfd, 1, EXECBENCH_TIMEOUT_MS) == 1 ? accept(listen_fd, NULL, NULL) : -1;
+    if (client != -1) {
+        err = execbench_drain(client, &first);
+        close(client);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    *exit_ns = execbench_now() - start;
+    *first_ns = first - start;
+
+    if (client == -1 || err || !first) {
+        fprintf(stderr, "%s sent no events\n", argv[0]);
+        return 1;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "%s failed\n", argv[0]);
+        return 1;
+    }
+    return 0;
+}
+
+/// Main entrypoint to the startup benchmark
+/// @param argc Number of input arguments
+/// @param argv Array of input arguments
+/// @return 0 on success, 1 if error(s)
+int main(int argc, char ** argv) {
+    uint32_t runs = EXECBENCH_RUNS;
+
+    enum optlist_t {
+        opt_help,
+        opt_runs,
+    };
+
+    static struct option long_options[] = {
+        {"help", no_argument,       NULL, opt_help},
+        {"runs", required_argument, NULL, opt_runs},
+        {NULL,   0,                 NULL, 0       }
+    };
+
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "+h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case opt_runs:
+                runs = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "%s", execbench_usage);
+                return 1;
+        }
+    }
+    if (optind == argc || !runs) {
+        fprintf(stderr, "%s", execbench_usage);
+        return 1;
+    }
+
+    int fd = execbench_listen();
+    int64_t * first = calloc(runs, sizeof(*first));
+    int64_t * exited = calloc(runs, sizeof(*exited));
+    if (fd == -1 || !first || !exited) {
+        return 1;
+    }
+
+    // The first run warms the page cache
+    int ret = execbench_run(fd, argv + optind, first, exited);
+    for (uint32_t i = 0; !ret && i != runs; ++i) {
+        ret = execbench_run(fd, argv + optind, &first[i], &exited[i]);
+    }
+
+    close(fd);
+    unlink(YDOTOOLD_SOCKET_PATH);
+    if (!ret) {
+        printf("%s: %u runs\n", argv[optind], runs);
+        execbench_distribution("first event", first, runs);
+        execbench_distribution("exit", exited, runs);
+    }
+    free(first);
+    free(exited);
+    return ret;
+}
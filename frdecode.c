@@ -0,0 +1,162 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file frdecode.c
+/// @author Harry Austen
+/// @brief Decoder for ydotoold flight recorder dumps. Prints each frame's
+/// journey through the daemon and where the latency went
+
+// System includes
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Local includes
+#include "recorder.h"
+
+/// Number of latency stages reported
+#define NUM_STAGES 4
+
+/// Names of the latency stages
+static const char * STAGE_NAMES[NUM_STAGES] = {
+    "socket",
+    "queue",
+    "write",
+    "total"
+};
+
+/// Usage string
+static const char * frdecode_usage =
+    "Usage: frdecode [-q] <dump>\n"
+    "    -q    Only print the summary, not every record\n";
+
+/// Compare two latencies for qsort
+/// @param a First latency
+/// @param b Second latency
+/// @return <0, 0 or >0 as a is less than, equal to or greater than b
+static int frdecode_compare(const void * a, const void * b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/// Print the distribution of one latency stage
+/// @param name Name of the stage
+/// @param values The latencies in nanoseconds, sorted in place
+/// @param count Number of latencies
+static void frdecode_summary(const char * name, int64_t * values, size_t count) {
+    if (!count) {
+        printf("%-8s no samples\n", name);
+        return;
+    }
+    qsort(values, count, sizeof(*values), frdecode_compare);
+    printf("%-8s n=%-6zu p50=%9.1fus p99=%9.1fus max=%9.1fus\n", name, count,
+        (double)values[count / 2] / 1000.0,
+        (double)values[count * 99 / 100] / 1000.0,
+        (double)values[count - 1] / 1000.0);
+}
+
+/// Main entrypoint to the flight recorder decoder
+/// @param argc Number of input arguments
+/// @param argv Array of input arguments
+/// @return 0 on success, 1 if error(s)
+int main(int argc, char ** argv) {
+    int quiet = argc == 3 && !strcmp(argv[1], "-q");
+    if (argc != 2 + quiet) {
+        fprintf(stderr, "%s", frdecode_usage);
+        return 1;
+    }
+
+    FILE * file = fopen(argv[1 + quiet], "rb");
+    if (!file) {
+        perror(argv[1 + quiet]);
+        return 1;
+    }
+
+    struct recorder_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != RECORDER_MAGIC
+            || header.version != RECORDER_VERSION || header.record_size != sizeof(struct recorder_record)) {
+        fprintf(stderr, "%s: not a flight recorder dump\n", argv[1 + quiet]);
+        fclose(file);
+        return 1;
+    }
+
+    int64_t * stages[NUM_STAGES];
+    size_t counts[NUM_STAGES] = { 0 };
+    for (int i = 0; i != NUM_STAGES; ++i) {
+        stages[i] = malloc(sizeof(int64_t) * (header.count ? header.count : 1));
+        if (!stages[i]) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+
+    printf("%" PRIu64 " records, %u in dump\n", header.total, header.count);
+    if (!quiet) {
+        printf("%10s %6s %4s %5s %12s %10s %10s %10s\n",
+            "seq", "client", "evs", "flags", "recv(ms)", "socket(us)", "queue(us)", "write(us)");
+    }
+
+    // Records overwritten while the ring was dumped are out of sequence, skip them
+    struct recorder_record rec;
+    uint64_t last = 0;
+    size_t skipped = 0;
+    int64_t origin = 0;
+    // The stage arrays hold header.count records; anything after them isn't part of the dump
+    for (uint32_t i = 0; i != header.count && fread(&rec, sizeof(rec), 1, file) == 1; ++i) {
+        if (!rec.seq || rec.seq <= last) {
+            skipped++;
+            continue;
+        }
+        last = rec.seq;
+        if (!origin) {
+            origin = rec.t_recv;
+        }
+
+        int64_t socket = rec.t_send ? rec.t_recv - rec.t_send : -1;
+        int64_t queue = rec.t_dequeue - rec.t_recv;
+        int64_t write = rec.t_written - rec.t_dequeue;
+        if (socket >= 0) {
+            stages[0][counts[0]++] = socket;
+            stages[3][counts[3]++] = rec.t_written - rec.t_send;
+        }
+        stages[1][counts[1]++] = queue;
+        stages[2][counts[2]++] = write;
+
+        if (!quiet) {
+            char flags[4] = {
+                rec.flags & RECORDER_FLAG_MACRO ? 'm' : '-',
+                rec.flags & RECORDER_FLAG_DROPPED ? 'd' : '-',
+                rec.flags & RECORDER_FLAG_COALESCED ? 'c' : '-',
+                '\0'
+            };
+            printf("%10" PRIu64 " %6u %4u %5s %12.3f ", rec.seq, rec.client, rec.events, flags, (double)(rec.t_recv - origin) / 1e6);
+            if (socket >= 0) {
+                printf("%10.1f ", (double)socket / 1000.0);
+            } else {
+                printf("%10s ", "-");
+            }
+            printf("%10.1f %10.1f\n", (double)queue / 1000.0, (double)write / 1000.0);
+        }
+    }
+    fclose(file);
+
+    if (skipped) {
+        printf("%zu records skipped (overwritten during the dump)\n", skipped);
+    }
+    for (int i = 0; i != NUM_STAGES; ++i) {
+        frdecode_summary(STAGE_NAMES[i], stages[i], counts[i]);
+        free(stages[i]);
+    }
+    return 0;
+}
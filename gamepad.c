@@ -0,0 +1,562 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file gamepad.c
+/// @author Harry Austen
+/// @brief Implementation of emulating a gamepad or joystick
+
+// System includes
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+// Local includes
+#include "gamepad.h"
+
+/// Nanoseconds per second
+#define NSEC_PER_SEC 1000000000L
+
+/// Longest number in a text snapshot
+#define GAMEPAD_NUMBER 32
+
+/// Usage string of the gamepad command
+static const char gamepad_usage[] =
+    "Usage: gamepad [--axes <list>] [--hats <n>] [--buttons <list>] [--name <name>] [--rate <hz>] [--delay <ms>] [--binary] [--null]\n"
+    "    --help          Show this help\n"
+    "    --axes list     Axes, each x, y, z, rx, ry, rz, throttle, rudder, wheel, gas or brake,\n"
+    "                    optionally with :min:max (default x,y,rx,ry,z:0:255,rz:0:255,\n"
+    "                    otherwise -32768 to 32767)\n"
+    "    --hats n        Hat switches, 0 to 4 (default 1)\n"
+    "    --buttons list  Buttons, each a, b, c, x, y, z, tl, tr, tl2, tr2, select, start, mode,\n"
+    "                    thumbl or thumbr (default a,b,x,y,tl,tr,select,start,mode,thumbl,thumbr)\n"
+    "    --name name     Name of the device (default ydotool virtual gamepad)\n"
+    "    --rate hz       Snapshots per second, up to 1000 (default 1000)\n"
+    "    --delay ms      Delay time after creating the device, before the first snapshot (default 100ms)\n"
+    "    --binary        Read struct gamepad_snapshot records (see gamepad.h) instead of text\n"
+    "    --null          Discard the events instead of creating a device, to measure the rate\n"
+    "Reads snapshots from stdin, one per line: the value of each axis, then x and y (-1, 0 or 1)\n"
+    "of each hat, then the buttons down as a bit mask (e.g. 0x3 for the first two). Values left\n"
+    "out keep their last ones. Each snapshot is written as one frame of what changed\n";
+
+/// Names of the axes, indexed by event code
+static const char * const AXIS_NAMES[GAMEPAD_MAX_AXES] = {
+    "x", "y", "z", "rx", "ry", "rz", "throttle", "rudder", "wheel", "gas", "brake"
+};
+
+/// Names of the buttons, indexed by event code from BTN_GAMEPAD
+static const char * const BUTTON_NAMES[GAMEPAD_MAX_BUTTONS] = {
+    "a", "b", "c", "x", "y", "z", "tl", "tr", "tl2", "tr2", "select", "start", "mode", "thumbl", "thumbr"
+};
+
+void gamepad_profile_default(struct gamepad_profile * profile) {
+    memset(profile, 0, sizeof(*profile));
+    snprintf(profile->name, sizeof(profile->name), "ydotool virtual gamepad");
+    gamepad_parse_axes("x,y,rx,ry,z:0:255,rz:0:255", profile);
+    profile->hats = 1;
+    gamepad_parse_buttons("a,b,x,y,tl,tr,select,start,mode,thumbl,thumbr", profile);
+}
+
+/// Find a name in a list of names
+/// @param name Start of the name
+/// @param len Length of the name
+/// @param names The list
+/// @param count Number of names in the list
+/// @return Index of the name, or -1 if not found
+static int gamepad_find(const char * name, size_t len, const char * const * names, int count) {
+    for (int i = 0; i != count; ++i) {
+        if (strlen(names[i]) == len && !strncmp(name, names[i], len)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int gamepad_parse_axes(const char * list, struct gamepad_profile * profile) {
+    uint32_t count = 0;
+    const char * p = list;
+    while (*p) {
+        size_t len = strcspn(p, ":,");
+        int code = gamepad_find(p, len, AXIS_NAMES, GAMEPAD_MAX_AXES);
+        if (code < 0 || count == GAMEPAD_MAX_AXES) {
+            fprintf(stderr, "Unknown axis or too many axes: %.*s\n", (int)len, p);
+            return 1;
+        }
+        for (uint32_t i = 0; i != count; ++i) {
+            if (profile->axes[i].code == code) {
+                fprintf(stderr, "Axis %s given twice\n", AXIS_NAMES[code]);
+                return 1;
+            }
+        }
+
+        struct gamepad_axis axis = { (uint16_t)code, GAMEPAD_AXIS_MIN, GAMEPAD_AXIS_MAX };
+        p += len;
+        if (*p == ':') {
+            char * end;
+            long min = strtol(p + 1, &end, 10);
+            long max = end != p + 1 && *end == ':' ? strtol(end + 1, &end, 10) : 0;
+            if (*end != ',' && *end) {
+                fprintf(stderr, "Invalid range of axis %s\n", AXIS_NAMES[code]);
+                return 1;
+            }
+            if (min < INT32_MIN || max > INT32_MAX || min >= max) {
+                fprintf(stderr, "Range of axis %s is empty or too large\n", AXIS_NAMES[code]);
+                return 1;
+            }
+            axis.min = (int32_t)min;
+            axis.max = (int32_t)max;
+            p = end;
+        }
+        profile->axes[count++] = axis;
+        if (*p == ',') {
+            ++p;
+        }
+    }
+    profile->num_axes = count;
+    return 0;
+}
+
+int gamepad_parse_buttons(const char * list, struct gamepad_profile * profile) {
+    uint32_t count = 0;
+    const char * p = list;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        int index = gamepad_find(p, len, BUTTON_NAMES, GAMEPAD_MAX_BUTTONS);
+        if (index < 0) {
+            fprintf(stderr, "Unknown button: %.*s\n", (int)len, p);
+            return 1;
+        }
+        uint16_t code = (uint16_t)(BTN_GAMEPAD + index);
+        for (uint32_t i = 0; i != count; ++i) {
+            if (profile->buttons[i] == code) {
+                fprintf(stderr, "Button %s given twice\n", BUTTON_NAMES[index]);
+                return 1;
+            }
+        }
+        profile->buttons[count++] = code;
+        p += len;
+        if (*p == ',') {
+            ++p;
+        }
+    }
+    profile->num_buttons = count;
+    return 0;
+}
+
+int gamepad_init(struct gamepad * gamepad, const struct gamepad_profile * profile) {
+    if (profile->num_axes > GAMEPAD_MAX_AXES || profile->hats > GAMEPAD_MAX_HATS || profile->num_buttons > GAMEPAD_MAX_BUTTONS) {
+        fprintf(stderr, "Gamepad profile has too many axes, hats or buttons\n");
+        return 1;
+    }
+    if (!profile->num_axes && !profile->hats) {
+        fprintf(stderr, "Gamepad profile needs an axis or hat\n");
+        return 1;
+    }
+
+    memset(gamepad, 0, sizeof(*gamepad));
+    gamepad->fd = -1;
+    for (uint32_t i = 0; i != profile->num_axes; ++i) {
+        gamepad->codes[gamepad->num_abs] = profile->axes[i].code;
+        gamepad->min[gamepad->num_abs] = profile->axes[i].min;
+        gamepad->max[gamepad->num_abs++] = profile->axes[i].max;
+    }
+    for (uint32_t i = 0; i != 2 * profile->hats; ++i) {
+        gamepad->codes[gamepad->num_abs] = (uint16_t)(ABS_HAT0X + i);
+        gamepad->min[gamepad->num_abs] = -1;
+        gamepad->max[gamepad->num_abs++] = 1;
+    }
+    gamepad->num_buttons = profile->num_buttons;
+    memcpy(gamepad->buttons, profile->buttons, sizeof(gamepad->buttons));
+    gamepad_set_rate(gamepad, GAMEPAD_RATE);
+    return 0;
+}
+
+int gamepad_create(struct gamepad * gamepad, const struct gamepad_profile * profile, int null) {
+    if (gamepad_init(gamepad, profile)) {
+        return 1;
+    }
+
+    if (null) {
+        if ((gamepad->fd = open("/dev/null", O_WRONLY | O_CLOEXEC)) == -1) {
+            fprintf(stderr, "Failed to open /dev/null: %s\n", strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
+    if ((gamepad->fd = open("/dev/uinput", O_WRONLY | O_CLOEXEC)) == -1) {
+        fprintf(stderr, "Failed to open /dev/uinput: %s\n"
+            "Try running as root\n", strerror(errno));
+        return 1;
+    }
+
+    // Set up the same way as the shared device, through struct uinput_user_dev. No
+    // fuzz or flat: the values are exact, and any dead zone is up to the application
+    struct uinput_user_dev dev;
+    memset(&dev, 0, sizeof(dev));
+    snprintf(dev.name, UINPUT_MAX_NAME_SIZE, "%s", profile->name);
+    dev.id.bustype = BUS_USB;
+    dev.id.vendor = 0x1;
+    dev.id.product = 0x2;
+    dev.id.version = 1;
+
+    int err = ioctl(gamepad->fd, UI_SET_EVBIT, EV_ABS) < 0;
+    for (uint32_t i = 0; i != gamepad->num_abs; ++i) {
+        err |= ioctl(gamepad->fd, UI_SET_ABSBIT, gamepad->codes[i]) < 0;
+        dev.absmin[gamepad->codes[i]] = gamepad->min[i];
+        dev.absmax[gamepad->codes[i]] = gamepad->max[i];
+    }
+    if (gamepad->num_buttons) {
+        err |= ioctl(gamepad->fd, UI_SET_EVBIT, EV_KEY) < 0;
+    }
+    for (uint32_t i = 0; i != gamepad->num_buttons; ++i) {
+        err |= ioctl(gamepad->fd, UI_SET_KEYBIT, gamepad->buttons[i]) < 0;
+    }
+    if (err || write(gamepad->fd, &dev, sizeof(dev)) != (ssize_t)sizeof(dev) || ioctl(gamepad->fd, UI_DEV_CREATE) < 0) {
+        fprintf(stderr, "Failed to create gamepad device: %s\n", strerror(errno));
+        close(gamepad->fd);
+        gamepad->fd = -1;
+        return 1;
+    }
+
+    // Values start at 0 on the device, as they do in last
+    return 0;
+}
+
+int gamepad_destroy(struct gamepad * gamepad) {
+    if (gamepad->fd == -1) {
+        return 0;
+    }
+    // Fails harmlessly on /dev/null
+    ioctl(gamepad->fd, UI_DEV_DESTROY);
+    int err = close(gamepad->fd);
+    gamepad->fd = -1;
+    return err != 0;
+}
+
+void gamepad_set_rate(struct gamepad * gamepad, uint32_t rate) {
+    if (rate > GAMEPAD_MAX_RATE) {
+        rate = GAMEPAD_MAX_RATE;
+    }
+    gamepad->period_ns = rate ? NSEC_PER_SEC / rate : 0;
+    gamepad->started = 0;
+    if (rate) {
+        // The default 50us of timer slack would be 5% of a period at 1 kHz
+        prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+    }
+}
+
+size_t gamepad_frame(struct gamepad * gamepad, const struct gamepad_snapshot * snapshot, struct input_event * frame) {
+    size_t count = 0;
+    for (uint32_t i = 0; i != gamepad->num_abs; ++i) {
+        int32_t value = snapshot->abs[i];
+        value = value < gamepad->min[i] ? gamepad->min[i] : value > gamepad->max[i] ? gamepad->max[i] : value;
+        if (value != gamepad->last.abs[i]) {
+            memset(&frame[count], 0, sizeof(*frame));
+            frame[count].type = EV_ABS;
+            frame[count].code = gamepad->codes[i];
+            frame[count++].value = value;
+            gamepad->last.abs[i] = value;
+        }
+    }
+
+    uint32_t changed = (snapshot->buttons ^ gamepad->last.buttons) & ((1u << gamepad->num_buttons) - 1);
+    for (; changed; changed &= changed - 1) {
+        int i = __builtin_ctz(changed);
+        memset(&frame[count], 0, sizeof(*frame));
+        frame[count].type = EV_KEY;
+        frame[count].code = gamepad->buttons[i];
+        frame[count++].value = (snapshot->buttons >> i) & 1;
+    }
+    gamepad->last.buttons ^= (snapshot->buttons ^ gamepad->last.buttons) & ((1u << gamepad->num_buttons) - 1);
+
+    if (!count) {
+        return 0;
+    }
+    memset(&frame[count], 0, sizeof(*frame));
+    frame[count].type = EV_SYN;
+    frame[count++].code = SYN_REPORT;
+    return count;
+}
+
+int gamepad_emit(struct gamepad * gamepad, const struct gamepad_snapshot * snapshot) {
+    struct input_event frame[GAMEPAD_FRAME_EVENTS];
+    size_t count = gamepad_frame(gamepad, snapshot, frame);
+    gamepad->stats.snapshots++;
+    if (!count) {
+        return 0;
+    }
+
+    ssize_t n;
+    while ((n = write(gamepad->fd, frame, count * sizeof(*frame))) < 0 && errno == EINTR) {
+    }
+    if (n != (ssize_t)(count * sizeof(*frame))) {
+        fprintf(stderr, "Failed to write to gamepad: %s\n", n < 0 ? strerror(errno) : "short write");
+        return 1;
+    }
+    gamepad->stats.frames++;
+    gamepad->stats.events += count;
+    return 0;
+}
+
+int gamepad_push(struct gamepad * gamepad, const struct gamepad_snapshot * snapshot) {
+    if (!gamepad->period_ns) {
+        return gamepad_emit(gamepad, snapshot);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (gamepad->started) {
+        gamepad->next.tv_nsec += gamepad->period_ns;
+        if (gamepad->next.tv_nsec >= NSEC_PER_SEC) {
+            gamepad->next.tv_nsec -= NSEC_PER_SEC;
+            gamepad->next.tv_sec++;
+        }
+        int64_t behind = (int64_t)(now.tv_sec - gamepad->next.tv_sec) * NSEC_PER_SEC + (now.tv_nsec - gamepad->next.tv_nsec);
+        if (behind > gamepad->period_ns) {
+            gamepad->stats.late++;
+            gamepad->next = now;
+        } else if (behind < 0) {
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &gamepad->next, NULL) == EINTR) {
+            }
+        }
+    } else {
+        gamepad->started = 1;
+        gamepad->next = now;
+    }
+    return gamepad_emit(gamepad, snapshot);
+}
+
+/// Copy the next number of a line out of it, null terminated
+/// @param [in,out] p Current position, moved past the number
+/// @param end End of the line
+/// @param [out] number The number
+/// @return 1 if there is a number, 0 at the end of the line, -1 if it is too long
+static int gamepad_next_number(const char ** p, const char * end, char number[GAMEPAD_NUMBER]) {
+    const char * s = *p;
+    while (s != end && (*s == ' ' || *s == '\t' || *s == '\r')) {
+        ++s;
+    }
+    const char * start = s;
+    while (s != end && *s != ' ' && *s != '\t' && *s != '\r') {
+        ++s;
+    }
+    *p = s;
+    if (s == start) {
+        return 0;
+    }
+    if ((size_t)(s - start) >= GAMEPAD_NUMBER) {
+        return -1;
+    }
+    memcpy(number, start, (size_t)(s - start));
+    number[s - start] = '\0';
+    return 1;
+}
+
+int gamepad_parse_line(const struct gamepad * gamepad, const char * line, size_t len, struct gamepad_snapshot * snapshot) {
+    const char * end = line + len;
+    struct gamepad_snapshot parsed = *snapshot;
+    char number[GAMEPAD_NUMBER];
+    int found;
+    uint32_t field = 0;
+    while ((found = gamepad_next_number(&line, end, number)) > 0) {
+        char * stop;
+        errno = 0;
+        if (field < gamepad->num_abs) {
+            long value = strtol(number, &stop, 10);
+            if (*stop || errno || value < INT32_MIN || value > INT32_MAX) {
+                return 1;
+            }
+            parsed.abs[field] = (int32_t)value;
+        } else if (field == gamepad->num_abs) {
+            unsigned long buttons = strtoul(number, &stop, 0);
+            if (*stop || errno || number[0] == '-' || buttons >> gamepad->num_buttons) {
+                return 1;
+            }
+            parsed.buttons = (uint32_t)buttons;
+        } else {
+            return 1;
+        }
+        ++field;
+    }
+    if (found < 0) {
+        return 1;
+    }
+    *snapshot = parsed;
+    return 0;
+}
+
+int gamepad_stream(int fd, struct gamepad * gamepad, int binary) {
+    char buf[GAMEPAD_BUFFER];
+    size_t len = 0;
+    size_t line = 0;
+    struct gamepad_snapshot snapshot = gamepad->last;
+
+    for (;;) {
+        ssize_t n = read(fd, buf + len, sizeof(buf) - len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to read snapshots: %s\n", strerror(errno));
+            return 1;
+        }
+        len += (size_t)n;
+
+        size_t pos = 0;
+        if (binary) {
+            // Records are copied out, as the buffer doesn't keep them aligned
+            for (; len - pos >= sizeof(snapshot); pos += sizeof(snapshot)) {
+                memcpy(&snapshot, buf + pos, sizeof(snapshot));
+                if (gamepad_push(gamepad, &snapshot)) {
+                    return 1;
+                }
+            }
+        } else {
+            while (pos != len) {
+                const char * nl = memchr(buf + pos, '\n', len - pos);
+                if (!nl && n) {
+                    break;
+                }
+                size_t end = nl ? (size_t)(nl - buf) : len;
+                ++line;
+                if (gamepad_parse_line(gamepad, buf + pos, end - pos, &snapshot)) {
+                    fprintf(stderr, "Invalid snapshot on line %zu: %.*s\n", line, (int)(end - pos), buf + pos);
+                    return 1;
+                }
+                if (gamepad_push(gamepad, &snapshot)) {
+                    return 1;
+                }
+                pos = nl ? end + 1 : len;
+            }
+        }
+
+        if (!pos && len == sizeof(buf)) {
+            fprintf(stderr, "Snapshot line %zu is too long\n", line + 1);
+            return 1;
+        }
+        memmove(buf, buf + pos, len - pos);
+        len -= pos;
+        if (!n) {
+            break;
+        }
+    }
+
+    if (binary && len) {
+        fprintf(stderr, "Snapshots end with a partial record\n");
+        return 1;
+    }
+    return 0;
+}
+
+int gamepad_main(int argc, char ** argv) {
+    struct gamepad_profile profile;
+    gamepad_profile_default(&profile);
+    uint32_t rate = GAMEPAD_RATE;
+    uint32_t delay_ms = 100;
+    int binary = 0;
+    int null = 0;
+
+    enum optlist_t {
+        opt_help,
+        opt_axes,
+        opt_hats,
+        opt_buttons,
+        opt_name,
+        opt_rate,
+        opt_delay,
+        opt_binary,
+        opt_null,
+    };
+
+    static struct option long_options[] = {
+        {"help",    no_argument,       NULL, opt_help   },
+        {"axes",    required_argument, NULL, opt_axes   },
+        {"hats",    required_argument, NULL, opt_hats   },
+        {"buttons", required_argument, NULL, opt_buttons},
+        {"name",    required_argument, NULL, opt_name   },
+        {"rate",    required_argument, NULL, opt_rate   },
+        {"delay",   required_argument, NULL, opt_delay  },
+        {"binary",  no_argument,       NULL, opt_binary },
+        {"null",    no_argument,       NULL, opt_null   },
+        {NULL,      0,                 NULL, 0          }
+    };
+
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case opt_axes:
+                if (gamepad_parse_axes(optarg, &profile)) {
+                    return 1;
+                }
+                break;
+            case opt_hats:
+                profile.hats = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_buttons:
+                if (gamepad_parse_buttons(optarg, &profile)) {
+                    return 1;
+                }
+                break;
+            case opt_name:
+                snprintf(profile.name, sizeof(profile.name), "%s", optarg);
+                break;
+            case opt_rate:
+                rate = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_delay:
+                delay_ms = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_binary:
+                binary = 1;
+                break;
+            case opt_null:
+                null = 1;
+                break;
+            default:
+                fprintf(stderr, "%s", gamepad_usage);
+                return 1;
+        }
+    }
+    if (argc != optind || !rate || rate > GAMEPAD_MAX_RATE || profile.hats > GAMEPAD_MAX_HATS) {
+        fprintf(stderr, "%s", gamepad_usage);
+        return 1;
+    }
+
+    struct gamepad gamepad;
+    if (gamepad_create(&gamepad, &profile, null)) {
+        return 1;
+    }
+    // Give udev and applications time to pick the device up
+    if (!null) {
+        usleep(delay_ms * 1000);
+    }
+    gamepad_set_rate(&gamepad, rate);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = gamepad_stream(STDIN_FILENO, &gamepad, binary);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    const struct gamepad_stats * stats = &gamepad.stats;
+    fprintf(stderr, "%" PRIu64 " snapshots in %.3f s (%.1f/s), %" PRIu64 " frames, %" PRIu64 " events, %" PRIu64 " late\n",
+        stats->snapshots, seconds, seconds > 0.0 ? (double)stats->snapshots / seconds : 0.0,
+        stats->frames, stats->events, stats->late);
+    return ret + gamepad_destroy(&gamepad);
+}
@@ -0,0 +1,227 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file gamepad.h
+/// @author Harry Austen
+/// @brief Interface for emulating a gamepad or joystick
+/// @details The gamepad is a virtual device of its own, separate from the one ydotool
+/// and ydotoold share, so that it is classified as a joystick. Its profile sets which
+/// absolute axes (and their ranges), hat switches and BTN_GAMEPAD buttons it has
+///
+/// It is driven by snapshots of all its axes, hats and buttons, pushed at a fixed rate
+/// of up to GAMEPAD_MAX_RATE per second. Each snapshot is written as one frame holding
+/// only what changed since the last, so a snapshot changing nothing writes nothing
+
+#ifndef __GAMEPAD_H__
+#define __GAMEPAD_H__
+
+// System includes
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <linux/uinput.h>
+
+/// Maximum number of axes, ABS_X to ABS_BRAKE
+#define GAMEPAD_MAX_AXES 11
+
+/// Maximum number of hat switches, ABS_HAT0X/Y to ABS_HAT3X/Y
+#define GAMEPAD_MAX_HATS 4
+
+/// Maximum number of absolute values in a snapshot, the axes then two per hat
+#define GAMEPAD_MAX_ABS (GAMEPAD_MAX_AXES + 2 * GAMEPAD_MAX_HATS)
+
+/// Maximum number of buttons, BTN_A to BTN_THUMBR
+#define GAMEPAD_MAX_BUTTONS 15
+
+/// Maximum number of events in a frame, including the SYN_REPORT
+#define GAMEPAD_FRAME_EVENTS (GAMEPAD_MAX_ABS + GAMEPAD_MAX_BUTTONS + 1)
+
+/// Default range of an axis
+#define GAMEPAD_AXIS_MIN (-32768)
+
+/// Default range of an axis
+#define GAMEPAD_AXIS_MAX 32767
+
+/// Default snapshots per second
+#define GAMEPAD_RATE 1000
+
+/// Maximum snapshots per second
+#define GAMEPAD_MAX_RATE 1000
+
+/// Size of the buffer snapshots are read into
+#define GAMEPAD_BUFFER 65536
+
+/// @brief An absolute axis of the gamepad
+struct gamepad_axis {
+    /// ABS_X to ABS_BRAKE
+    uint16_t code;
+    /// Smallest value
+    int32_t min;
+    /// Largest value
+    int32_t max;
+};
+
+/// @brief What the gamepad has
+struct gamepad_profile {
+    /// Name of the device
+    char name[UINPUT_MAX_NAME_SIZE];
+    /// The axes, in the order of their values in a snapshot
+    struct gamepad_axis axes[GAMEPAD_MAX_AXES];
+    /// Number of axes
+    uint32_t num_axes;
+    /// Number of hat switches, their values following the axes' in a snapshot
+    uint32_t hats;
+    /// BTN_A to BTN_THUMBR, in the order of their bits in a snapshot
+    uint16_t buttons[GAMEPAD_MAX_BUTTONS];
+    /// Number of buttons
+    uint32_t num_buttons;
+};
+
+/// @brief Binary snapshot record, in native byte order
+struct gamepad_snapshot {
+    /// Values of the axes, then x and y (-1, 0 or 1) of each hat, clamped to their ranges
+    int32_t abs[GAMEPAD_MAX_ABS];
+    /// Bit i set while button i of the profile is down
+    uint32_t buttons;
+};
+
+/// @brief Counters of snapshots pushed to the gamepad
+struct gamepad_stats {
+    /// Number of snapshots pushed
+    uint64_t snapshots;
+    /// Number of frames written, one for each snapshot that changed anything
+    uint64_t frames;
+    /// Number of events written
+    uint64_t events;
+    /// Number of snapshots pushed more than a period after they were due, which restarted the schedule
+    uint64_t late;
+};
+
+/// @brief A virtual gamepad
+struct gamepad {
+    /// File descriptor of the device, -1 if none
+    int fd;
+    /// Number of absolute values
+    uint32_t num_abs;
+    /// Event code of each absolute value
+    uint16_t codes[GAMEPAD_MAX_ABS];
+    /// Smallest of each absolute value
+    int32_t min[GAMEPAD_MAX_ABS];
+    /// Largest of each absolute value
+    int32_t max[GAMEPAD_MAX_ABS];
+    /// Number of buttons
+    uint32_t num_buttons;
+    /// Event code of each button
+    uint16_t buttons[GAMEPAD_MAX_BUTTONS];
+    /// Last values written
+    struct gamepad_snapshot last;
+    /// Nanoseconds between snapshots, 0 not to pace them
+    int64_t period_ns;
+    /// When the next snapshot is due, once one has been pushed
+    struct timespec next;
+    /// Set once a snapshot has been pushed
+    int started;
+    /// Counters
+    struct gamepad_stats stats;
+};
+
+/// @brief Get the default profile, laid out like common game controllers
+/// @details Sticks on ABS_X/Y and ABS_RX/RY, triggers on ABS_Z and ABS_RZ (0 to 255),
+/// one hat for the D-pad and buttons a, b, x, y, tl, tr, select, start, mode, thumbl, thumbr
+/// @param [out] profile The profile
+void gamepad_profile_default(struct gamepad_profile * profile);
+
+/// @brief Set the axes of a profile from a list
+/// @param list Comma separated axes, each x, y, z, rx, ry, rz, throttle, rudder,
+/// wheel, gas or brake, optionally followed by :min:max
+/// @param [in,out] profile The profile
+/// @return 0 on success, 1 if the list is malformed
+int gamepad_parse_axes(const char * list, struct gamepad_profile * profile);
+
+/// @brief Set the buttons of a profile from a list
+/// @param list Comma separated buttons, each a, b, c, x, y, z, tl, tr, tl2, tr2,
+/// select, start, mode, thumbl or thumbr
+/// @param [in,out] profile The profile
+/// @return 0 on success, 1 if the list is malformed
+int gamepad_parse_buttons(const char * list, struct gamepad_profile * profile);
+
+/// @brief Set up a gamepad for a profile, without a device
+/// @param [out] gamepad The gamepad
+/// @param profile The profile
+/// @return 0 on success, 1 if the profile is invalid
+int gamepad_init(struct gamepad * gamepad, const struct gamepad_profile * profile);
+
+/// @brief Set up a gamepad for a profile and create its virtual device
+/// @param [out] gamepad The gamepad
+/// @param profile The profile
+/// @param null 1 to discard all events instead, as uinput_create_null() does
+/// @return 0 on success, 1 if error(s)
+int gamepad_create(struct gamepad * gamepad, const struct gamepad_profile * profile, int null);
+
+/// @brief Destroy the gamepad's device
+/// @param gamepad The gamepad
+/// @return 0 on success, 1 if error(s)
+int gamepad_destroy(struct gamepad * gamepad);
+
+/// @brief Set how many snapshots are pushed per second
+/// @param gamepad The gamepad
+/// @param rate Snapshots per second, up to GAMEPAD_MAX_RATE, 0 not to pace them
+void gamepad_set_rate(struct gamepad * gamepad, uint32_t rate);
+
+/// @brief Build the frame for a snapshot and take it as the last values written
+/// @param gamepad The gamepad
+/// @param snapshot The snapshot
+/// @param [out] frame Room for GAMEPAD_FRAME_EVENTS events
+/// @return Number of events in the frame, including the SYN_REPORT, 0 if nothing changed
+size_t gamepad_frame(struct gamepad * gamepad, const struct gamepad_snapshot * snapshot, struct input_event * frame);
+
+/// @brief Write a snapshot right away, as one frame of what changed
+/// @param gamepad The gamepad
+/// @param snapshot The snapshot
+/// @return 0 on success, 1 if error(s)
+int gamepad_emit(struct gamepad * gamepad, const struct gamepad_snapshot * snapshot);
+
+/// @brief Write a snapshot once it is due, a period after the last one
+/// @details Snapshots due on a fixed schedule, so the rate doesn't drift with the time
+/// taken to write them. A snapshot pushed more than a period late is written right
+/// away and the schedule restarts from it, rather than bunching up the ones after it
+/// @param gamepad The gamepad
+/// @param snapshot The snapshot
+/// @return 0 on success, 1 if error(s)
+int gamepad_push(struct gamepad * gamepad, const struct gamepad_snapshot * snapshot);
+
+/// @brief Parse a text snapshot
+/// @details The line holds the values in snapshot order, then the buttons as a number
+/// (e.g. 0x5 for buttons 0 and 2). Values left out keep those of the snapshot
+/// @param gamepad The gamepad
+/// @param line The line, without its newline
+/// @param len Length of the line
+/// @param [in,out] snapshot The snapshot, left as it was if the line is malformed
+/// @return 0 on success, 1 if malformed
+int gamepad_parse_line(const struct gamepad * gamepad, const char * line, size_t len, struct gamepad_snapshot * snapshot);
+
+/// @brief Push snapshots read from a file descriptor until its end
+/// @details Snapshots are read as they are pushed, so a faster writer is held back
+/// to the rate through its pipe
+/// @param fd The file descriptor, e.g. stdin
+/// @param gamepad The gamepad
+/// @param binary 1 if the snapshots are struct gamepad_snapshot records, 0 if text
+/// @return 0 on success, 1 if error(s)
+int gamepad_stream(int fd, struct gamepad * gamepad, int binary);
+
+/// @brief Run the gamepad command, ydotool gamepad ...
+/// @param argc Number of arguments, from the command's name
+/// @param argv Arguments, from the command's name
+/// @return 0 on success, 1 if error(s)
+int gamepad_main(int argc, char ** argv);
+
+#endif // __GAMEPAD_H__
@@ -0,0 +1,496 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file loadgen.c
+/// @author Harry Austen
+/// @brief Load generator for ydotoold. Opens a number of client connections at
+/// once, floods or paces frames through each and reports throughput, latency
+/// and fairness. Run it against ydotoold --null to measure without /dev/uinput
+
+// System includes
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <linux/input.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local includes
+#include "recorder.h"
+#include "ydotoold.h"
+
+/// Maximum number of events per frame, including the SYN_REPORT
+#define LOADGEN_MAX_EVENTS YDOTOOLD_FRAME_EVENTS
+
+/// @brief Load profile, shared by all clients
+struct loadgen_profile {
+    /// Number of client connections
+    uint32_t clients;
+    /// Number of frames each client sends
+    uint32_t frames;
+    /// Events per frame, including the SYN_REPORT
+    uint32_t events;
+    /// Frames per second per client, 0 to send as fast as the daemon takes them
+    uint32_t rate;
+    /// Frames sent between each latency measurement
+    uint32_t batch;
+    /// Stamp frames with their scheduled time and measure emission jitter from the flight recorder
+    int jitter;
+};
+
+/// @brief State and results of one client connection
+struct loadgen_client {
+    /// Thread running the client
+    pthread_t thread;
+    /// Time taken to connect, in nanoseconds
+    int64_t connect_ns;
+    /// Time from the first frame to the last frame written, in nanoseconds
+    int64_t elapsed_ns;
+    /// Latency of each batch, from sending its last frame until all of it was written
+    int64_t * latencies;
+    /// Number of latencies
+    uint32_t count;
+    /// Scheduled time of each frame, when measuring jitter
+    int64_t * scheduled;
+    /// How late the client woke up to send each frame, when measuring jitter
+    int64_t * wakeups;
+    /// Set if the client failed
+    int failed;
+};
+
+/// The load profile
+static struct loadgen_profile PROFILE = { 10, 1000, 2, 0, 1, 0 };
+
+/// Flight recorder dump of the daemon, read when measuring jitter
+static const char * RECORDER_PATH = YDOTOOLD_RECORDER_PATH;
+
+/// Released once every client is connected, so they all start together
+static pthread_barrier_t START;
+
+/// Usage string
+static const char * loadgen_usage =
+    "Usage: loadgen [--clients <n>] [--frames <n>] [--events <n>] [--rate <hz>] [--batch <n>]\n"
+    "               [--jitter [--recorder <path>]]\n"
+    "    --help           Show this help\n"
+    "    --clients n      Number of concurrent connections (default 10)\n"
+    "    --frames n       Frames sent by each connection (default 1000)\n"
+    "    --events n       Events per frame, including the SYN_REPORT (default 2)\n"
+    "    --rate hz        Frames per second per connection, 0 floods (default 0)\n"
+    "    --batch n        Frames sent between latency measurements (default 1)\n"
+    "    --jitter         Stamp paced frames with their scheduled time, then report how late they\n"
+    "                     reached the device from the daemon's flight recorder\n"
+    "    --recorder path  Where the daemon dumps its flight recorder (default " YDOTOOLD_RECORDER_PATH ")\n";
+
+/// Get the current CLOCK_MONOTONIC time
+/// @return Nanoseconds
+static int64_t loadgen_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/// Write a whole buffer to a socket
+/// @param fd The socket
+/// @param buf The buffer
+/// @param len Number of bytes in buf
+/// @return 0 on success, 1 if error(s)
+static int loadgen_send(int fd, const void * buf, size_t len) {
+    const char * p = buf;
+    while (len) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/// Send a control request and wait for its answer
+/// @param fd The socket
+/// @param request The request (enum ydotoold_ctl)
+/// @param [out] reply Buffer for data sent with the answer, or NULL
+/// @param reply_len Size of reply
+/// @return The result returned by the daemon, or -EIO if the connection failed
+static int32_t loadgen_request(int fd, uint16_t request, void * reply, size_t reply_len) {
+    struct input_event ie;
+    memset(&ie, 0, sizeof(ie));
+    ie.type = YDOTOOLD_CTL;
+    ie.code = request;
+    if (loadgen_send(fd, &ie, sizeof(ie)) || recv(fd, &ie, sizeof(ie), MSG_WAITALL) != sizeof(ie)) {
+        return -EIO;
+    }
+    if (reply && ie.value > 0) {
+        size_t len = (size_t)ie.value < reply_len ? (size_t)ie.value : reply_len;
+        if (recv(fd, reply, len, MSG_WAITALL) != (ssize_t)len) {
+            return -EIO;
+        }
+    }
+    return ie.value;
+}
+
+/// Connect to the daemon socket
+/// @return The socket, or -1 if error(s)
+static int loadgen_connect() {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, YDOTOOLD_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/// Client thread: sends the profile's frames over its own connection
+/// @param arg The client
+static void * loadgen_client_run(void * arg) {
+    struct loadgen_client * client = arg;
+    struct input_event frame[LOADGEN_MAX_EVENTS];
+
+    int64_t start = loadgen_now();
+    int fd = loadgen_connect();
+    client->connect_ns = loadgen_now() - start;
+    client->failed = fd == -1;
+    pthread_barrier_wait(&START);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    // Small pointer motions, alternating direction so the pointer stays put
+    memset(frame, 0, sizeof(frame));
+    for (uint32_t i = 0; i + 1 < PROFILE.events; ++i) {
+        frame[i].type = EV_REL;
+        frame[i].code = i % 2 ? REL_Y : REL_X;
+    }
+    frame[PROFILE.events - 1].type = EV_SYN;
+    frame[PROFILE.events - 1].code = SYN_REPORT;
+
+    int64_t period = PROFILE.rate ? 1000000000 / PROFILE.rate : 0;
+    start = loadgen_now();
+    int64_t sent = 0;
+    for (uint32_t n = 0; n != PROFILE.frames; ++n) {
+        if (period) {
+            int64_t deadline = start + period * n;
+            struct timespec ts = { (time_t)(deadline / 1000000000), (long)(deadline % 1000000000) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+
+        int64_t now = loadgen_now();
+        for (uint32_t i = 0; i + 1 < PROFILE.events; ++i) {
+            frame[i].value = n % 2 ? -1 : 1;
+        }
+        // Stamp the send time for the daemon's flight recorder, see ydotoold.h,
+        // or when measuring jitter the time the frame was due
+        int64_t stamp = now;
+        if (PROFILE.jitter) {
+            stamp = start + period * n;
+            client->scheduled[n] = stamp;
+            client->wakeups[n] = now - stamp;
+        }
+        frame[PROFILE.events - 1].input_event_sec = stamp / 1000000000;
+        frame[PROFILE.events - 1].input_event_usec = stamp % 1000000000;
+        if (loadgen_send(fd, frame, sizeof(*frame) * PROFILE.events)) {
+            client->failed = 1;
+            break;
+        }
+        sent = now;
+
+        if ((n + 1) % PROFILE.batch == 0 || n + 1 == PROFILE.frames) {
+            if (loadgen_request(fd, YDOTOOLD_CTL_SYNC, NULL, 0)) {
+                client->failed = 1;
+                break;
+            }
+            client->latencies[client->count++] = loadgen_now() - sent;
+        }
+    }
+    client->elapsed_ns = loadgen_now() - start;
+
+    close(fd);
+    return NULL;
+}
+
+/// Compare two nanosecond values for qsort
+/// @param a First value
+/// @param b Second value
+/// @return <0, 0 or >0 as a is less than, equal to or greater than b
+static int loadgen_compare(const void * a, const void * b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/// Compare two doubles for qsort
+/// @param a First value
+/// @param b Second value
+/// @return <0, 0 or >0 as a is less than, equal to or greater than b
+static int loadgen_compare_double(const void * a, const void * b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/// Print the distribution of a set of nanosecond values
+/// @param name What the values are
+/// @param values The values, sorted in place
+/// @param count Number of values
+static void loadgen_distribution(const char * name, int64_t * values, size_t count) {
+    if (!count) {
+        printf("%-10s no samples\n", name);
+        return;
+    }
+    qsort(values, count, sizeof(*values), loadgen_compare);
+    printf("%-10s p50 %9.1fus  p99 %9.1fus  p99.9 %9.1fus  max %9.1fus\n", name,
+        (double)values[count / 2] / 1000.0,
+        (double)values[count * 99 / 100] / 1000.0,
+        (double)values[count * 999 / 1000] / 1000.0,
+        (double)values[count - 1] / 1000.0);
+}
+
+/// Report how late frames reached the device compared to when they were scheduled
+/// @details Frames are found in the flight recorder by their stamp, so the dump must
+/// still hold them: at most RECORDER_RECORDS frames are measured
+/// @param scheduled Scheduled time of every frame sent, sorted in place
+/// @param count Number of frames sent
+/// @return 0 on success, 1 if error(s)
+static int loadgen_jitter(int64_t * scheduled, size_t count) {
+    int fd = loadgen_connect();
+    int32_t result = fd == -1 ? -EIO : loadgen_request(fd, YDOTOOLD_CTL_RECORDER_DUMP, NULL, 0);
+    if (fd != -1) {
+        close(fd);
+    }
+    if (result < 0) {
+        fprintf(stderr, "Failed to dump the flight recorder: %s\n", strerror(-result));
+        return 1;
+    }
+
+    FILE * file = fopen(RECORDER_PATH, "rb");
+    struct recorder_header header;
+    if (!file || fread(&header, sizeof(header), 1, file) != 1 || header.magic != RECORDER_MAGIC
+            || header.record_size != sizeof(struct recorder_record)) {
+        fprintf(stderr, "Failed to read the flight recorder from %s\n", RECORDER_PATH);
+        if (file) {
+            fclose(file);
+        }
+        return 1;
+    }
+
+    int64_t * emission = malloc(sizeof(int64_t) * (header.count ? header.count : 1));
+    if (!emission) {
+        fclose(file);
+        return 1;
+    }
+    qsort(scheduled, count, sizeof(*scheduled), loadgen_compare);
+    size_t found = 0;
+    struct recorder_record record;
+    // emission holds header.count records; anything after them isn't part of the dump
+    for (uint32_t i = 0; i != header.count && fread(&record, sizeof(record), 1, file) == 1; ++i) {
+        if (record.t_send && bsearch(&record.t_send, scheduled, count, sizeof(*scheduled), loadgen_compare)) {
+            emission[found++] = record.t_written - record.t_send;
+        }
+    }
+    fclose(file);
+
+    printf("jitter     %zu of %zu frames found in the flight recorder\n", found, count);
+    loadgen_distribution("emission", emission, found);
+    free(emission);
+    return 0;
+}
+
+/// Get the daemon's counters
+/// @param [out] stats The counters
+/// @return 0 on success, 1 if error(s)
+static int loadgen_stats(struct ydotoold_stats * stats) {
+    memset(stats, 0, sizeof(*stats));
+    int fd = loadgen_connect();
+    if (fd == -1) {
+        return 1;
+    }
+    int32_t result = loadgen_request(fd, YDOTOOLD_CTL_STATS, stats, sizeof(*stats));
+    close(fd);
+    return result < 0;
+}
+
+/// Main entrypoint to the load generator
+/// @param argc Number of input arguments
+/// @param argv Array of input arguments
+/// @return 0 on success, 1 if error(s)
+int main(int argc, char ** argv) {
+    enum optlist_t {
+        opt_help,
+        opt_clients,
+        opt_frames,
+        opt_events,
+        opt_rate,
+        opt_batch,
+        opt_jitter,
+        opt_recorder,
+    };
+
+    static struct option long_options[] = {
+        {"help",    no_argument,       NULL, opt_help   },
+        {"clients", required_argument, NULL, opt_clients},
+        {"frames",  required_argument, NULL, opt_frames },
+        {"events",  required_argument, NULL, opt_events },
+        {"rate",    required_argument, NULL, opt_rate   },
+        {"batch",   required_argument, NULL, opt_batch  },
+        {"jitter",  no_argument,       NULL, opt_jitter },
+        {"recorder", required_argument, NULL, opt_recorder},
+        {NULL,      0,                 NULL, 0          }
+    };
+
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case opt_clients:
+                PROFILE.clients = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_frames:
+                PROFILE.frames = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_events:
+                PROFILE.events = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_rate:
+                PROFILE.rate = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_batch:
+                PROFILE.batch = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_jitter:
+                PROFILE.jitter = 1;
+                break;
+            case opt_recorder:
+                RECORDER_PATH = optarg;
+                break;
+            default:
+                fprintf(stderr, "%s", loadgen_usage);
+                return 1;
+        }
+    }
+    if (optind != argc || !PROFILE.clients || PROFILE.clients > YDOTOOLD_MAX_CLIENTS || !PROFILE.frames
+            || PROFILE.events < 1 || PROFILE.events > LOADGEN_MAX_EVENTS || !PROFILE.batch
+            || (PROFILE.jitter && !PROFILE.rate)) {
+        fprintf(stderr, "%s", loadgen_usage);
+        return 1;
+    }
+
+    struct ydotoold_stats before;
+    if (loadgen_stats(&before)) {
+        fprintf(stderr, "Failed to reach ydotoold on %s\n", YDOTOOLD_SOCKET_PATH);
+        return 1;
+    }
+
+    uint32_t batches = (PROFILE.frames + PROFILE.batch - 1) / PROFILE.batch;
+    struct loadgen_client * clients = calloc(PROFILE.clients, sizeof(*clients));
+    int64_t * latencies = malloc(sizeof(int64_t) * PROFILE.clients * batches);
+    int64_t * connects = malloc(sizeof(int64_t) * PROFILE.clients);
+    double * rates = malloc(sizeof(double) * PROFILE.clients);
+    size_t frames_total = (size_t)PROFILE.clients * PROFILE.frames;
+    int64_t * scheduled = PROFILE.jitter ? malloc(sizeof(int64_t) * frames_total) : NULL;
+    int64_t * wakeups = PROFILE.jitter ? malloc(sizeof(int64_t) * frames_total) : NULL;
+    if (!clients || !latencies || !connects || !rates || (PROFILE.jitter && (!scheduled || !wakeups))) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    pthread_barrier_init(&START, NULL, PROFILE.clients + 1);
+    for (uint32_t i = 0; i != PROFILE.clients; ++i) {
+        clients[i].latencies = latencies + (size_t)i * batches;
+        if (PROFILE.jitter) {
+            clients[i].scheduled = scheduled + (size_t)i * PROFILE.frames;
+            clients[i].wakeups = wakeups + (size_t)i * PROFILE.frames;
+        }
+        if (pthread_create(&clients[i].thread, NULL, loadgen_client_run, &clients[i])) {
+            fprintf(stderr, "Error creating thread!\n");
+            return 1;
+        }
+    }
+    pthread_barrier_wait(&START);
+    int64_t start = loadgen_now();
+    for (uint32_t i = 0; i != PROFILE.clients; ++i) {
+        pthread_join(clients[i].thread, NULL);
+    }
+    int64_t elapsed = loadgen_now() - start;
+    pthread_barrier_destroy(&START);
+
+    struct ydotoold_stats after;
+    loadgen_stats(&after);
+
+    // Gather per-client results; Jain's index is 1 when every client got the same throughput
+    size_t count = 0;
+    uint32_t failed = 0;
+    double sum = 0.0;
+    double squares = 0.0;
+    for (uint32_t i = 0; i != PROFILE.clients; ++i) {
+        struct loadgen_client * client = &clients[i];
+        connects[i] = client->connect_ns;
+        failed += (uint32_t)client->failed;
+        rates[i] = client->elapsed_ns ? (double)PROFILE.frames * 1e9 / (double)client->elapsed_ns : 0.0;
+        sum += rates[i];
+        squares += rates[i] * rates[i];
+        memmove(latencies + count, client->latencies, sizeof(int64_t) * client->count);
+        count += client->count;
+    }
+    qsort(rates, PROFILE.clients, sizeof(*rates), loadgen_compare_double);
+
+    uint64_t frames = (uint64_t)PROFILE.clients * PROFILE.frames;
+    printf("%u clients x %u frames of %u events, %s\n", PROFILE.clients, PROFILE.frames, PROFILE.events,
+        PROFILE.rate ? "paced" : "flooding");
+    if (PROFILE.rate) {
+        printf("rate       %u frames/s per client\n", PROFILE.rate);
+    }
+    if (failed) {
+        printf("failed     %u clients\n", failed);
+    }
+    printf("aggregate  %.0f frames/s, %.0f events/s over %.3fs\n",
+        (double)frames * 1e9 / (double)elapsed, (double)(frames * PROFILE.events) * 1e9 / (double)elapsed,
+        (double)elapsed / 1e9);
+    printf("per-client min %.0f  p50 %.0f  max %.0f frames/s, fairness %.4f\n",
+        rates[0], rates[PROFILE.clients / 2], rates[PROFILE.clients - 1],
+        squares > 0.0 ? sum * sum / ((double)PROFILE.clients * squares) : 0.0);
+    loadgen_distribution("connect", connects, PROFILE.clients);
+    loadgen_distribution("latency", latencies, count);
+    printf("daemon     %" PRIu64 " frames, %" PRIu64 " queue full, %" PRIu64 " stalls, %" PRIu64 " drops, %" PRIu64 " coalesced\n",
+        after.frames - before.frames, after.queue_full - before.queue_full,
+        after.stalls - before.stalls, after.drops - before.drops,
+        after.coalesced - before.coalesced);
+    if (PROFILE.jitter && !failed) {
+        loadgen_distribution("wakeup", wakeups, frames_total);
+        failed += (uint32_t)loadgen_jitter(scheduled, frames_total);
+    }
+
+    free(wakeups);
+    free(scheduled);
+    free(rates);
+    free(connects);
+    free(latencies);
+    free(clients);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,437 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file log.c
+/// @author Harry Austen
+/// @brief Implementation of logging through a lock-free ring
+
+// System includes
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Local includes
+#include "log.h"
+
+/// @brief Kind of a copied argument
+enum log_arg_kind {
+    /// Signed integer, as long long
+    LOG_ARG_INT,
+    /// Unsigned integer, as unsigned long long
+    LOG_ARG_UINT,
+    /// Floating point, as double
+    LOG_ARG_DOUBLE,
+    /// Pointer, printed by %p
+    LOG_ARG_POINTER,
+    /// Offset of a copied string in the message's strings
+    LOG_ARG_STRING,
+};
+
+/// @brief A copied argument
+struct log_arg {
+    /// enum log_arg_kind
+    uint8_t kind;
+    union {
+        /// LOG_ARG_INT
+        long long i;
+        /// LOG_ARG_UINT
+        unsigned long long u;
+        /// LOG_ARG_DOUBLE
+        double d;
+        /// LOG_ARG_POINTER
+        const void * p;
+        /// LOG_ARG_STRING
+        size_t offset;
+    };
+};
+
+/// @brief A message waiting to be written
+struct log_message {
+    /// enum log_level
+    uint8_t level;
+    /// Number of arguments copied
+    uint8_t count;
+    /// Set if the format has more than could be copied, which is then written as is
+    uint8_t truncated;
+    /// Format of the message
+    const char * fmt;
+    /// The arguments
+    struct log_arg args[LOG_MAX_ARGS];
+    /// Copies of the string arguments
+    char strings[LOG_STRINGS];
+};
+
+/// @brief A slot of the ring
+/// @details Bounded multi-producer queue after Vyukov: a slot is free for the message at
+/// position pos when its seq is pos, and holds that message once seq is pos + 1. seq is
+/// kept relative to the slot's index, so the zero-initialised ring starts out free
+struct log_slot {
+    /// Sequence number of the slot, less its index
+    size_t seq;
+    /// The message
+    struct log_message message;
+};
+
+/// The ring
+static struct log_slot RING[LOG_RING];
+
+/// Position of the next message logged
+static size_t HEAD = 0;
+
+/// Position of the next message written, only moved under FLUSH_LOCK
+static size_t TAIL = 0;
+
+/// Number of messages dropped because the ring was full
+static uint64_t DROPPED = 0;
+
+/// Level of the messages logged (enum log_level)
+static int LEVEL = LOG_LEVEL_WARN;
+
+/// Set once messages are written at exit
+static int AT_EXIT = 0;
+
+/// Serialises writing messages out
+static pthread_mutex_t FLUSH_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+/// Stream for info and debug messages, NULL for stdout
+static FILE * OUT = NULL;
+
+/// Stream for errors and warnings, NULL for stderr
+static FILE * ERR = NULL;
+
+/// Names of the levels
+static const char * const LEVEL_NAMES[] = { "error", "warn", "info", "debug" };
+
+/// @brief A conversion specification of a format
+struct log_spec {
+    /// Start of the specification, at its %
+    const char * start;
+    /// Just past the flags, width and precision
+    const char * modifier;
+    /// Just past the specification
+    const char * end;
+    /// The conversion character
+    char conversion;
+    /// The length modifier: 0 for none, 'H' for h or hh, 'q' for ll, or its character
+    char length;
+};
+
+/// Find the next conversion specification in a format
+/// @param fmt Where to look from
+/// @param [out] spec The specification
+/// @return 1 if one was found, 0 at the end of the format
+static int log_next_spec(const char * fmt, struct log_spec * spec) {
+    for (const char * p = strchr(fmt, '%'); p; p = strchr(p, '%')) {
+        if (p[1] == '%') {
+            p += 2;
+            continue;
+        }
+
+        spec->start = p++;
+        p += strspn(p, "-+ #0'");
+        p += strspn(p, "0123456789");
+        if (*p == '.') {
+            p++;
+            p += strspn(p, "0123456789");
+        }
+        spec->modifier = p;
+        spec->length = 0;
+        if (*p == 'h') {
+            spec->length = 'H';
+            p += 1 + (p[1] == 'h');
+        } else if (*p == 'l') {
+            spec->length = p[1] == 'l' ? 'q' : 'l';
+            p += 1 + (p[1] == 'l');
+        } else if (*p == 'z' || *p == 'j' || *p == 't' || *p == 'L') {
+            spec->length = *p++;
+        }
+        spec->conversion = *p;
+        spec->end = *p ? p + 1 : p;
+        return 1;
+    }
+    return 0;
+}
+
+/// Copy an argument of a conversion into a message
+/// @param message The message
+/// @param spec The conversion
+/// @param ap The arguments, positioned at this one
+/// @param [in,out] used Bytes of the message's strings used so far
+/// @return 0 on success, 1 if the conversion isn't supported
+static int log_copy_arg(struct log_message * message, const struct log_spec * spec, va_list * ap, size_t * used) {
+    struct log_arg * arg = &message->args[message->count];
+    switch (spec->conversion) {
+        case 'd':
+        case 'i':
+        case 'c':
+            arg->kind = LOG_ARG_INT;
+            switch (spec->length) {
+                case 'l': arg->i = va_arg(*ap, long); break;
+                case 'q': arg->i = va_arg(*ap, long long); break;
+                case 'z': arg->i = va_arg(*ap, ssize_t); break;
+                case 'j': arg->i = va_arg(*ap, intmax_t); break;
+                case 't': arg->i = va_arg(*ap, ptrdiff_t); break;
+                case 'L': return 1;
+                default: arg->i = va_arg(*ap, int); break;
+            }
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            arg->kind = LOG_ARG_UINT;
+            switch (spec->length) {
+                case 'l': arg->u = va_arg(*ap, unsigned long); break;
+                case 'q': arg->u = va_arg(*ap, unsigned long long); break;
+                case 'z': arg->u = va_arg(*ap, size_t); break;
+                case 'j': arg->u = va_arg(*ap, uintmax_t); break;
+                case 't': arg->u = (unsigned long long)va_arg(*ap, ptrdiff_t); break;
+                case 'L': return 1;
+                default: arg->u = va_arg(*ap, unsigned); break;
+            }
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+            if (spec->length == 'L') {
+                return 1;
+            }
+            arg->kind = LOG_ARG_DOUBLE;
+            arg->d = va_arg(*ap, double);
+            break;
+        case 'p':
+            arg->kind = LOG_ARG_POINTER;
+            arg->p = va_arg(*ap, const void *);
+            break;
+        case 's': {
+            const char * s = va_arg(*ap, const char *);
+            s = s ? s : "(null)";
+            size_t len = strnlen(s, LOG_STRINGS - 1 - *used);
+            arg->kind = LOG_ARG_STRING;
+            arg->offset = *used;
+            memcpy(message->strings + *used, s, len);
+            message->strings[*used + len] = '\0';
+            *used += len + (*used + len + 1 < LOG_STRINGS);
+            break;
+        }
+        default:
+            return 1;
+    }
+    message->count++;
+    return 0;
+}
+
+/// Write a message out
+/// @param message The message
+static void log_print(const struct log_message * message) {
+    FILE * f = message->level <= LOG_LEVEL_WARN ? (ERR ? ERR : stderr) : (OUT ? OUT : stdout);
+    const char * p = message->fmt;
+    struct log_spec spec;
+    for (uint8_t i = 0; i != message->count && log_next_spec(p, &spec); ++i) {
+        // The text up to the conversion, turning %% into %
+        for (; p != spec.start; ++p) {
+            fputc(*p, f);
+            p += p[0] == '%' && p[1] == '%';
+        }
+
+        // The conversion itself, with its argument widened as it was copied
+        char conv[32];
+        size_t prefix = (size_t)(spec.modifier - spec.start);
+        if (prefix > sizeof(conv) - 4) {
+            prefix = sizeof(conv) - 4;
+        }
+        memcpy(conv, spec.start, prefix);
+        const struct log_arg * arg = &message->args[i];
+        size_t n = prefix;
+        if (arg->kind == LOG_ARG_INT || arg->kind == LOG_ARG_UINT) {
+            if (spec.conversion != 'c') {
+                conv[n++] = 'l';
+                conv[n++] = 'l';
+            }
+        }
+        conv[n++] = spec.conversion;
+        conv[n] = '\0';
+
+        switch (arg->kind) {
+            case LOG_ARG_INT:
+                fprintf(f, conv, spec.conversion == 'c' ? (int)arg->i : arg->i);
+                break;
+            case LOG_ARG_UINT:
+                fprintf(f, conv, arg->u);
+                break;
+            case LOG_ARG_DOUBLE:
+                fprintf(f, conv, arg->d);
+                break;
+            case LOG_ARG_POINTER:
+                fprintf(f, conv, arg->p);
+                break;
+            case LOG_ARG_STRING:
+                fprintf(f, conv, message->strings + arg->offset);
+                break;
+        }
+        p = spec.end;
+    }
+
+    // What is left, as is if arguments couldn't be copied
+    for (; *p; ++p) {
+        fputc(*p, f);
+        p += !message->truncated && p[0] == '%' && p[1] == '%';
+    }
+}
+
+void log_write(enum log_level level, const char * fmt, ...) {
+    if ((int)level > __atomic_load_n(&LEVEL, __ATOMIC_RELAXED)) {
+        return;
+    }
+    if (!__atomic_load_n(&AT_EXIT, __ATOMIC_RELAXED) && !__atomic_exchange_n(&AT_EXIT, 1, __ATOMIC_RELAXED)) {
+        atexit(log_flush);
+    }
+
+    // Claim the slot at the head, unless the writer hasn't freed it yet
+    size_t pos = __atomic_load_n(&HEAD, __ATOMIC_RELAXED);
+    struct log_slot * slot;
+    for (;;) {
+        slot = &RING[pos % LOG_RING];
+        size_t base = pos - pos % LOG_RING;
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == base) {
+            if (__atomic_compare_exchange_n(&HEAD, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (seq + LOG_RING == base + 1) {
+            __atomic_fetch_add(&DROPPED, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&HEAD, __ATOMIC_RELAXED);
+        }
+    }
+
+    struct log_message * message = &slot->message;
+    message->level = (uint8_t)level;
+    message->count = 0;
+    message->truncated = 0;
+    message->fmt = fmt;
+
+    va_list ap;
+    va_start(ap, fmt);
+    size_t used = 0;
+    struct log_spec spec;
+    for (const char * p = fmt; log_next_spec(p, &spec); p = spec.end) {
+        if (message->count == LOG_MAX_ARGS || log_copy_arg(message, &spec, &ap, &used)) {
+            message->truncated = 1;
+            break;
+        }
+    }
+    va_end(ap);
+
+    __atomic_store_n(&slot->seq, pos - pos % LOG_RING + 1, __ATOMIC_RELEASE);
+}
+
+void log_flush() {
+    pthread_mutex_lock(&FLUSH_LOCK);
+    int written = 0;
+    for (;;) {
+        struct log_slot * slot = &RING[TAIL % LOG_RING];
+        size_t base = TAIL - TAIL % LOG_RING;
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != base + 1) {
+            break;
+        }
+        log_print(&slot->message);
+        __atomic_store_n(&slot->seq, base + LOG_RING, __ATOMIC_RELEASE);
+        TAIL++;
+        written = 1;
+    }
+
+    uint64_t dropped = __atomic_exchange_n(&DROPPED, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        fprintf(ERR ? ERR : stderr, "%" PRIu64 " log messages dropped\n", dropped);
+        written = 1;
+    }
+    if (written) {
+        fflush(OUT ? OUT : stdout);
+        fflush(ERR ? ERR : stderr);
+    }
+    pthread_mutex_unlock(&FLUSH_LOCK);
+}
+
+/// Background thread writing out messages
+/// @param arg Unused
+static void * log_drain(void * arg) {
+    (void)arg;
+    const struct timespec interval = { 0, LOG_DRAIN_MS * 1000000L };
+    for (;;) {
+        log_flush();
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+int log_parse_level(const char * name, enum log_level * level) {
+    for (size_t i = 0; i != sizeof(LEVEL_NAMES) / sizeof(*LEVEL_NAMES); ++i) {
+        if (!strcmp(name, LEVEL_NAMES[i]) || (name[0] == (char)('0' + i) && !name[1])) {
+            *level = (enum log_level)i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+const char * log_level_name(enum log_level level) {
+    return LEVEL_NAMES[level <= LOG_LEVEL_DEBUG ? level : LOG_LEVEL_DEBUG];
+}
+
+int log_init(enum log_level level, int thread) {
+    const char * env = getenv(LOG_LEVEL_ENV);
+    if (env && log_parse_level(env, &level)) {
+        fprintf(stderr, "Unknown log level %s=%s\n", LOG_LEVEL_ENV, env);
+    }
+    log_set_level(level);
+
+    if (!__atomic_exchange_n(&AT_EXIT, 1, __ATOMIC_RELAXED)) {
+        atexit(log_flush);
+    }
+    if (!thread) {
+        return 0;
+    }
+
+    pthread_t drain;
+    int err = pthread_create(&drain, NULL, log_drain, NULL);
+    if (err || pthread_detach(drain)) {
+        fprintf(stderr, "Error creating log thread: %s\n", strerror(err));
+        return 1;
+    }
+    return 0;
+}
+
+void log_set_level(enum log_level level) {
+    __atomic_store_n(&LEVEL, (int)level, __ATOMIC_RELAXED);
+}
+
+enum log_level log_get_level() {
+    return (enum log_level)__atomic_load_n(&LEVEL, __ATOMIC_RELAXED);
+}
+
+void log_set_output(FILE * out, FILE * err) {
+    pthread_mutex_lock(&FLUSH_LOCK);
+    OUT = out;
+    ERR = err;
+    pthread_mutex_unlock(&FLUSH_LOCK);
+}
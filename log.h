@@ -0,0 +1,107 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file log.h
+/// @author Harry Austen
+/// @brief Interface for logging without waiting on the console
+/// @details A message is not formatted where it is logged: its format string and
+/// arguments are copied into a slot of a lock-free ring, and formatted and written
+/// out later, by a background thread or when the ring is flushed. Logging never
+/// blocks; if the ring is full the message is dropped and counted. Formats must be
+/// string literals (or otherwise outlive the message), and may not use * for a width
+/// or precision. Strings are copied, up to LOG_STRINGS bytes per message
+
+#ifndef __LOG_H__
+#define __LOG_H__
+
+// System includes
+#include <stdio.h>
+
+/// Number of messages the ring holds
+#define LOG_RING 256
+
+/// Maximum number of arguments of a message
+#define LOG_MAX_ARGS 8
+
+/// Bytes per message for copies of its string arguments, including their null terminators
+#define LOG_STRINGS 192
+
+/// Milliseconds the background thread sleeps between writing out messages
+#define LOG_DRAIN_MS 20
+
+/// Environment variable setting the level: error, warn, info or debug
+#define LOG_LEVEL_ENV "YDOTOOL_LOG"
+
+/// @brief How much a message matters; only those at or below the level are logged
+enum log_level {
+    /// Something failed
+    LOG_LEVEL_ERROR,
+    /// Something is off, but work goes on
+    LOG_LEVEL_WARN,
+    /// What is being done
+    LOG_LEVEL_INFO,
+    /// Details for tracking down problems
+    LOG_LEVEL_DEBUG,
+};
+
+/// @brief Set the level from LOG_LEVEL_ENV, or a default, and have messages written at exit
+/// @param level Level if LOG_LEVEL_ENV isn't set
+/// @param thread Set to also write messages out from a background thread as they come
+/// @return 0 on success, 1 if error(s)
+int log_init(enum log_level level, int thread);
+
+/// @brief Parse the name of a level
+/// @param name error, warn, info or debug, or the number of one of them
+/// @param [out] level The level
+/// @return 0 on success, 1 if the name is unknown
+int log_parse_level(const char * name, enum log_level * level);
+
+/// @brief Get the name of a level
+/// @param level The level
+/// @return error, warn, info or debug
+const char * log_level_name(enum log_level level);
+
+/// @brief Change the level, at any time and from any thread
+/// @param level The level
+void log_set_level(enum log_level level);
+
+/// @brief Get the level
+/// @return The level
+enum log_level log_get_level();
+
+/// @brief Change where messages are written, e.g. for testing
+/// @param out Stream for info and debug messages (stdout by default)
+/// @param err Stream for errors and warnings (stderr by default)
+void log_set_output(FILE * out, FILE * err);
+
+/// @brief Log a message, without waiting for it to be written
+/// @param level How much the message matters
+/// @param fmt printf format of the message, ending in a newline if it should
+/// @param ... Arguments of the format
+void log_write(enum log_level level, const char * fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/// @brief Write out all messages logged so far
+void log_flush();
+
+/// Log an error
+#define log_error(...) log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+/// Log a warning
+#define log_warn(...) log_write(LOG_LEVEL_WARN, __VA_ARGS__)
+
+/// Log what is being done
+#define log_info(...) log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+
+/// Log a detail for tracking down problems
+#define log_debug(...) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif // __LOG_H__
@@ -0,0 +1,132 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file pointer.c
+/// @author Harry Austen
+/// @brief Implementation of smooth relative pointer motion and scrolling
+
+// System includes
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+// Local includes
+#include "pointer.h"
+#include "uinput.h"
+
+/// Nanoseconds per second
+#define NSEC_PER_SEC 1000000000L
+
+/// Progress along the path at a given fraction of the duration
+/// @param path Shape of the path
+/// @param t Fraction of the duration elapsed, 0 to 1
+/// @return Fraction of the distance covered, 0 to 1
+static double pointer_progress(enum pointer_path path, double t) {
+    if (path == POINTER_PATH_EASE) {
+        return (1.0 - cos(M_PI * t)) / 2.0;
+    }
+    return t;
+}
+
+/// Append a relative axis event to a frame if it moves at all
+/// @param [in,out] frame The frame being built
+/// @param [in,out] count Number of events in frame
+/// @param code The relative axis
+/// @param value The movement
+static void pointer_frame_add(struct input_event * frame, size_t * count, uint16_t code, int32_t value) {
+    if (!value) {
+        return;
+    }
+    memset(&frame[*count], 0, sizeof(frame[*count]));
+    frame[*count].type = EV_REL;
+    frame[*count].code = code;
+    frame[*count].value = value;
+    (*count)++;
+}
+
+/// Stream a two axis relative motion at a fixed report rate
+/// @param total Total movement along each axis, in device units
+/// @param motion How the movement is spread over time
+/// @param wheel 0 for REL_X/REL_Y, 1 for hi-res wheel units with legacy detents
+/// @return 0 on success, 1 if error(s)
+static int pointer_stream(const double total[2], const struct pointer_motion * motion, int wheel) {
+    static const uint16_t codes[2][2] = {
+        { REL_X, REL_Y },
+        { REL_WHEEL_HI_RES, REL_HWHEEL_HI_RES }
+    };
+    static const uint16_t legacy[2] = { REL_WHEEL, REL_HWHEEL };
+
+    uint32_t rate = motion->rate_hz;
+    if (rate < POINTER_MIN_RATE) {
+        rate = POINTER_MIN_RATE;
+    } else if (rate > POINTER_MAX_RATE) {
+        rate = POINTER_MAX_RATE;
+    }
+
+    // At least one report, even for an instant motion
+    uint64_t reports = (uint64_t)motion->duration_ms * rate / 1000;
+    if (!reports) {
+        reports = 1;
+    }
+    long period = NSEC_PER_SEC / (long)rate;
+
+    int64_t sent[2] = { 0, 0 };
+    int64_t detents[2] = { 0, 0 };
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    for (uint64_t i = 1; i <= reports; ++i) {
+        double progress = pointer_progress(motion->path, (double)i / (double)reports);
+        struct input_event frame[4];
+        size_t count = 0;
+
+        for (int axis = 0; axis != 2; ++axis) {
+            // Whole units still owed along this axis, carrying the remainder
+            int64_t target = i == reports ? llround(total[axis]) : llround(total[axis] * progress);
+            int32_t delta = (int32_t)(target - sent[axis]);
+            sent[axis] = target;
+            pointer_frame_add(frame, &count, codes[wheel][axis], delta);
+
+            if (wheel) {
+                int64_t whole = sent[axis] / POINTER_WHEEL_UNITS;
+                pointer_frame_add(frame, &count, legacy[axis], (int32_t)(whole - detents[axis]));
+                detents[axis] = whole;
+            }
+        }
+
+        if (count && uinput_send_frame(frame, count)) {
+            return 1;
+        }
+
+        if (i != reports) {
+            deadline.tv_nsec += period;
+            if (deadline.tv_nsec >= NSEC_PER_SEC) {
+                deadline.tv_nsec -= NSEC_PER_SEC;
+                deadline.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        }
+    }
+
+    return 0;
+}
+
+int pointer_move(int32_t dx, int32_t dy, const struct pointer_motion * motion) {
+    const double total[2] = { dx, dy };
+    return pointer_stream(total, motion, 0);
+}
+
+int pointer_scroll(double vertical, double horizontal, const struct pointer_motion * motion) {
+    const double total[2] = { vertical * POINTER_WHEEL_UNITS, horizontal * POINTER_WHEEL_UNITS };
+    return pointer_stream(total, motion, 1);
+}
@@ -0,0 +1,66 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file pointer.h
+/// @author Harry Austen
+/// @brief Interface for smooth relative pointer motion and scrolling
+
+#ifndef __POINTER_H__
+#define __POINTER_H__
+
+// System includes
+#include <stdint.h>
+
+/// Lowest supported report rate in Hz
+#define POINTER_MIN_RATE 125
+/// Highest supported report rate in Hz
+#define POINTER_MAX_RATE 1000
+/// Hi-res wheel units per wheel detent
+#define POINTER_WHEEL_UNITS 120
+
+/// @brief Shape of the path followed over the duration of a motion
+enum pointer_path {
+    /// Constant speed
+    POINTER_PATH_LINEAR,
+    /// Accelerate from rest and decelerate to rest
+    POINTER_PATH_EASE,
+};
+
+/// @brief How a motion is spread over time
+struct pointer_motion {
+    /// Duration of the motion in milliseconds (0 for a single report)
+    uint32_t duration_ms;
+    /// Report rate in Hz, clamped to POINTER_MIN_RATE..POINTER_MAX_RATE
+    uint32_t rate_hz;
+    /// Shape of the path
+    enum pointer_path path;
+};
+
+/// @brief Move the pointer by a relative amount, one frame per report
+/// @details Fractional pixels are accumulated, so the reported deltas always
+/// add up to exactly dx and dy
+/// @param dx Horizontal movement in pixels
+/// @param dy Vertical movement in pixels
+/// @param motion How the movement is spread over time
+/// @return 0 on success, 1 if error(s)
+int pointer_move(int32_t dx, int32_t dy, const struct pointer_motion * motion);
+
+/// @brief Scroll the wheels, one frame per report
+/// @details Reports REL_WHEEL_HI_RES/REL_HWHEEL_HI_RES deltas, along with the
+/// REL_WHEEL/REL_HWHEEL detents they add up to for consumers without hi-res support
+/// @param vertical Vertical scroll in detents, positive scrolls up
+/// @param horizontal Horizontal scroll in detents, positive scrolls right
+/// @param motion How the scrolling is spread over time
+/// @return 0 on success, 1 if error(s)
+int pointer_scroll(double vertical, double horizontal, const struct pointer_motion * motion);
+
+#endif // __POINTER_H__
@@ -0,0 +1,452 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file program.c
+/// @author Harry Austen
+/// @brief Implementation of compiling input into ready-to-write event programs
+
+// System includes
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Local includes
+#include "program.h"
+#include "translate.h"
+#include "uinput.h"
+
+/// Events per naive keypress: press, SYN, release, SYN
+#define NAIVE_KEYPRESS_EVENTS 4
+
+/// Events per CapsLock toggle: press, SYN and a release sharing the next frame
+#define CAPSLOCK_TOGGLE_EVENTS 3
+
+void program_init(struct program * prog) {
+    memset(prog, 0, sizeof(*prog));
+}
+
+void program_free(struct program * prog) {
+    free(prog->events);
+    program_init(prog);
+}
+
+int program_add(struct program * prog, uint16_t type, uint16_t code, int32_t value) {
+    if (prog->count == prog->capacity) {
+        size_t capacity = prog->capacity ? prog->capacity * 2 : 64;
+        struct input_event * tmp = realloc(prog->events, sizeof(*tmp) * capacity);
+        if (!tmp) {
+            fprintf(stderr, "Failed to allocate %zu events for program\n", capacity);
+            return 1;
+        }
+        prog->events = tmp;
+        prog->capacity = capacity;
+    }
+
+    struct input_event * ev = &prog->events[prog->count++];
+    memset(ev, 0, sizeof(*ev));
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+    return 0;
+}
+
+int program_sync(struct program * prog) {
+    if (program_add(prog, EV_SYN, SYN_REPORT, 0)) {
+        return 1;
+    }
+    prog->frames++;
+    return 0;
+}
+
+/// Release every held key, oldest first
+/// @param [in,out] prog The program to append to
+/// @param [in,out] held Keycodes currently held down
+/// @param [in,out] num_held Number of keycodes in held
+/// @return 0 on success, 1 if error(s)
+static int program_release_held(struct program * prog, uint16_t * held, size_t * num_held) {
+    for (size_t i = 0; i != *num_held; ++i) {
+        if (program_add(prog, EV_KEY, held[i], 0)) {
+            return 1;
+        }
+    }
+    *num_held = 0;
+    return 0;
+}
+
+/// Mark the spans of text that are cheaper to type with CapsLock on
+/// @details A span starts and ends on an uppercase letter and may contain any
+/// non-letter that shift isn't needed for. Within it shift would be pressed and
+/// released once per uppercase run, whereas CapsLock costs two toggles
+/// @param text The text to be typed
+/// @param shifted Whether each character of text needs shift
+/// @param len Length of text
+/// @param min_run Minimum number of uppercase letters in a span
+/// @param [out] caps Set to 1 for every character typed with CapsLock on
+static void program_plan_capslock(const char * text, const uint8_t * shifted, size_t len, uint32_t min_run, uint8_t * caps) {
+    size_t i = 0;
+    while (i != len) {
+        if (!isupper((unsigned char)text[i])) {
+            ++i;
+            continue;
+        }
+
+        size_t start = i;
+        size_t end = i;
+        uint32_t letters = 0;
+        uint32_t runs = 0;
+        uint8_t shift_down = 0;
+        for (; i != len; ++i) {
+            unsigned char c = (unsigned char)text[i];
+            if (isupper(c)) {
+                runs += !shift_down;
+                shift_down = 1;
+                letters++;
+                end = i + 1;
+            } else if (isalpha(c) || shifted[i]) {
+                break;
+            } else if (c != ' ') {
+                shift_down = 0;
+            }
+        }
+
+        if (letters >= min_run && runs * 2 > 2 * CAPSLOCK_TOGGLE_EVENTS) {
+            memset(caps + start, 1, end - start);
+        }
+        i = end;
+    }
+}
+
+int program_compile_text(struct program * prog, const char * text, const struct program_type_options * opts) {
+    size_t len = strlen(text);
+    uint16_t * codes = malloc(sizeof(*codes) * (len + 1));
+    uint8_t * shifted = calloc(len + 1, 2);
+    if (!codes || !shifted) {
+        free(codes);
+        free(shifted);
+        fprintf(stderr, "Failed to allocate buffers for %zu characters\n", len);
+        return 1;
+    }
+    uint8_t * caps = shifted + len + 1;
+
+    // Translate and validate everything before compiling anything
+    int ret = 0;
+    if (translate_text(text, len, codes, shifted)) {
+        free(codes);
+        free(shifted);
+        return 1;
+    }
+
+    if (opts->capslock_run) {
+        program_plan_capslock(text, shifted, len, opts->capslock_run, caps);
+    }
+
+    uint8_t overlap = opts->overlap;
+    if (overlap > UINPUT_MAX_OVERLAP) {
+        overlap = UINPUT_MAX_OVERLAP;
+    }
+
+    uint16_t held[UINPUT_MAX_OVERLAP];
+    size_t num_held = 0;
+    uint8_t shift_down = 0;
+    uint8_t caps_on = 0;
+
+    for (size_t i = 0; i != len && !ret; ++i) {
+        uint8_t letter = isalpha((unsigned char)text[i]) != 0;
+        uint8_t need_shift = shifted[i] ^ (caps[i] & letter);
+
+        // Shift makes no difference to space, so don't break a run for it
+        if (codes[i] == KEY_SPACE) {
+            need_shift = shift_down;
+        }
+
+        // Toggle CapsLock with nothing else held
+        if (caps[i] != caps_on) {
+            ret |= program_release_held(prog, held, &num_held);
+            if (shift_down) {
+                ret |= program_add(prog, EV_KEY, KEY_LEFTSHIFT, 0);
+                shift_down = 0;
+                need_shift = shifted[i] ^ (caps[i] & letter);
+            }
+            ret |= program_add(prog, EV_KEY, KEY_CAPSLOCK, 1);
+            ret |= program_sync(prog);
+            ret |= program_add(prog, EV_KEY, KEY_CAPSLOCK, 0);
+            caps_on = caps[i];
+        }
+
+        // A shift change or a repeated key can't overlap with held keys
+        int repeated = 0;
+        for (size_t j = 0; j != num_held; ++j) {
+            repeated |= held[j] == codes[i];
+        }
+        if (need_shift != shift_down || repeated) {
+            ret |= program_release_held(prog, held, &num_held);
+        }
+        if (repeated) {
+            // Rolled keys only overlap when they differ, so a key is never released and pressed in one frame
+            ret |= program_sync(prog);
+        }
+        if (need_shift != shift_down) {
+            ret |= program_add(prog, EV_KEY, KEY_LEFTSHIFT, need_shift);
+            shift_down = need_shift;
+        }
+
+        ret |= program_add(prog, EV_KEY, codes[i], 1);
+        if (overlap < 2) {
+            // Strictly sequential: press and release in frames of their own
+            ret |= program_sync(prog);
+            ret |= program_add(prog, EV_KEY, codes[i], 0);
+            ret |= program_sync(prog);
+            continue;
+        }
+
+        // Rolled: release the oldest keys so at most overlap are ever down
+        held[num_held++] = codes[i];
+        while (num_held > (size_t)overlap - 1) {
+            ret |= program_add(prog, EV_KEY, held[0], 0);
+            memmove(held, held + 1, sizeof(*held) * --num_held);
+        }
+        ret |= program_sync(prog);
+    }
+
+    // Leave the keyboard the way we found it
+    size_t before = prog->count;
+    ret |= program_release_held(prog, held, &num_held);
+    if (shift_down) {
+        ret |= program_add(prog, EV_KEY, KEY_LEFTSHIFT, 0);
+    }
+    if (caps_on) {
+        ret |= program_add(prog, EV_KEY, KEY_CAPSLOCK, 1);
+        ret |= program_sync(prog);
+        ret |= program_add(prog, EV_KEY, KEY_CAPSLOCK, 0);
+    }
+    if (prog->count != before) {
+        ret |= program_sync(prog);
+    }
+
+    free(codes);
+    free(shifted);
+    return ret;
+}
+
+/// Parse a key sequence into the keycodes it presses, in order
+/// @details A shifted key brings KEY_LEFTSHIFT in just before it, and keys
+/// already in the sequence aren't repeated
+/// @param chord Keys separated by '+'
+/// @param [out] codes The keycodes, at least UINPUT_MAX_CHORD * 2 of them
+/// @param [out] count Number of keycodes
+/// @return 0 on success, 1 if error(s)
+static int program_parse_chord(const char * chord, uint16_t * codes, size_t * count) {
+    size_t num_keys = 0;
+    *count = 0;
+
+    // Split on '+' without modifying the chord
+    for (const char * start = chord; *start; ) {
+        const char * end = strchr(start, '+');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+        char key[16];
+        uint16_t code = 0;
+        uint8_t shifted = 0;
+
+        if (!len || len >= sizeof(key) || num_keys == UINPUT_MAX_CHORD) {
+            fprintf(stderr, "Invalid key sequence %s\n", chord);
+            return 1;
+        }
+        memcpy(key, start, len);
+        key[len] = '\0';
+
+        if (uinput_keystring_to_keycode(key, &code, &shifted)) {
+            return 1;
+        }
+        num_keys++;
+        start += len + (end != NULL);
+
+        const uint16_t keys[2] = { KEY_LEFTSHIFT, code };
+        for (int k = !shifted; k != 2; ++k) {
+            size_t i = 0;
+            while (i != *count && codes[i] != keys[k]) {
+                i++;
+            }
+            if (i == *count) {
+                codes[(*count)++] = keys[k];
+            }
+        }
+    }
+    return 0;
+}
+
+int program_compile_keys(struct program * prog, const char * chord, int32_t value) {
+    uint16_t codes[UINPUT_MAX_CHORD * 2];
+    size_t count = 0;
+
+    if (program_parse_chord(chord, codes, &count)) {
+        return 1;
+    }
+
+    // Presses in the order given, releases in reverse so modifiers go last
+    for (size_t i = 0; i != count; ++i) {
+        if (program_add(prog, EV_KEY, codes[value ? i : count - 1 - i], value)) {
+            return 1;
+        }
+    }
+    return count ? program_sync(prog) : 0;
+}
+
+int program_compile_chord(struct program * prog, const char * chord) {
+    if (program_compile_keys(prog, chord, 1) || program_compile_keys(prog, chord, 0)) {
+        return 1;
+    }
+    return 0;
+}
+
+int program_compile_click(struct program * prog, uint16_t button) {
+    static const uint16_t buttons[] = { BTN_LEFT, BTN_RIGHT, BTN_MIDDLE };
+
+    if (button < 1 || button > sizeof(buttons) / sizeof(*buttons)) {
+        fprintf(stderr, "Invalid button argument!\n");
+        return 1;
+    }
+
+    if (program_add(prog, EV_KEY, buttons[button - 1], 1)
+            || program_sync(prog)
+            || program_add(prog, EV_KEY, buttons[button - 1], 0)
+            || program_sync(prog)) {
+        return 1;
+    }
+    return 0;
+}
+
+int program_compile_mouse(struct program * prog, int32_t x, int32_t y) {
+    if (program_add(prog, EV_ABS, ABS_X, x)
+            || program_add(prog, EV_ABS, ABS_Y, y)
+            || program_sync(prog)) {
+        return 1;
+    }
+    return 0;
+}
+
+int program_compile_tap(struct program * prog, int32_t x, int32_t y) {
+    if (program_compile_mouse(prog, x, y)
+            || program_add(prog, EV_KEY, BTN_TOUCH, 1)
+            || program_sync(prog)
+            || program_add(prog, EV_KEY, BTN_TOUCH, 0)
+            || program_sync(prog)) {
+        return 1;
+    }
+    return 0;
+}
+
+int program_compile_macro(struct program * prog, int argc, char ** argv) {
+    const struct program_type_options opts = { 1, 0 };
+
+    for (int i = 0; i != argc; ) {
+        // Each step runs up to the next ";" word
+        int n = 1;
+        while (i + n != argc && strcmp(argv[i + n], ";")) {
+            n++;
+        }
+        const char * cmd = argv[i];
+        int nargs = n - 1;
+        char ** args = argv + i + 1;
+
+        int ret = 0;
+        if (!strcmp(cmd, "key") && nargs > 0) {
+            for (int j = 0; j != nargs && !ret; ++j) {
+                ret = program_compile_chord(prog, args[j]);
+            }
+        } else if ((!strcmp(cmd, "keydown") || !strcmp(cmd, "keyup")) && nargs > 0) {
+            for (int j = 0; j != nargs && !ret; ++j) {
+                ret = program_compile_keys(prog, args[j], !strcmp(cmd, "keydown"));
+            }
+        } else if (!strcmp(cmd, "type") && nargs > 0) {
+            for (int j = 0; j != nargs && !ret; ++j) {
+                ret = program_compile_text(prog, args[j], &opts);
+            }
+        } else if (!strcmp(cmd, "click") && nargs == 1) {
+            ret = program_compile_click(prog, (uint16_t)strtoul(args[0], NULL, 10));
+        } else if (!strcmp(cmd, "mouse") && nargs == 2) {
+            ret = program_compile_mouse(prog, (int32_t)strtol(args[0], NULL, 10), (int32_t)strtol(args[1], NULL, 10));
+        } else if (!strcmp(cmd, "tap") && nargs == 2) {
+            ret = program_compile_tap(prog, (int32_t)strtol(args[0], NULL, 10), (int32_t)strtol(args[1], NULL, 10));
+        } else {
+            fprintf(stderr, "Invalid macro step: %s\n", cmd);
+            ret = 1;
+        }
+        if (ret) {
+            return 1;
+        }
+
+        i += n + (i + n != argc);
+    }
+    return 0;
+}
+
+size_t program_naive_text_events(const char * text) {
+    size_t count = 0;
+    for (size_t i = 0; text[i] != '\0'; ++i) {
+        uint16_t keycode = 0;
+        uint8_t shifted = 0;
+        if (!uinput_keychar_to_keycode(text[i], &keycode, &shifted)) {
+            // Shifted keypresses wrap the keypress in a shift press and release
+            count += shifted ? 2 * NAIVE_KEYPRESS_EVENTS : NAIVE_KEYPRESS_EVENTS;
+        }
+    }
+    return count;
+}
+
+/// Find a printable name for a keycode
+/// @param code The keycode
+/// @param [out] buf Buffer to hold the name
+/// @param len Size of buf
+static void program_key_name(uint16_t code, char * buf, size_t len) {
+    for (size_t i = 0; i != NUM_MODIFIER_KEYS; ++i) {
+        if (MODIFIER_KEYS[i].code == code) {
+            snprintf(buf, len, "%s", MODIFIER_KEYS[i].string);
+            return;
+        }
+    }
+    for (size_t i = 0; i != NUM_FUNCTION_KEYS; ++i) {
+        if (FUNCTION_KEYS[i].code == code) {
+            snprintf(buf, len, "%s", FUNCTION_KEYS[i].string);
+            return;
+        }
+    }
+    for (size_t i = 0; i != NUM_NORMAL_KEYS; ++i) {
+        if (NORMAL_KEYS[i].code == code && isgraph((unsigned char)NORMAL_KEYS[i].character)) {
+            snprintf(buf, len, "%c", NORMAL_KEYS[i].character);
+            return;
+        }
+    }
+    snprintf(buf, len, code == KEY_SPACE ? "SPACE" : "%u", code);
+}
+
+void program_dump(FILE * stream, const struct program * prog) {
+    char name[16];
+    int start = 1;
+    for (size_t i = 0; i != prog->count; ++i) {
+        const struct input_event * ev = &prog->events[i];
+        if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+            fprintf(stream, "%sSYN\n", start ? "" : " ");
+            start = 1;
+            continue;
+        }
+        if (ev->type == EV_KEY) {
+            program_key_name(ev->code, name, sizeof(name));
+            fprintf(stream, "%s%c%s", start ? "" : " ", ev->value ? '+' : '-', name);
+        } else {
+            fprintf(stream, "%s%u:%u:%d", start ? "" : " ", ev->type, ev->code, ev->value);
+        }
+        start = 0;
+    }
+    if (!start) {
+        fprintf(stream, "\n");
+    }
+}
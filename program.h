@@ -0,0 +1,130 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file program.h
+/// @author Harry Austen
+/// @brief Interface for compiling input into ready-to-write event programs
+
+#ifndef __PROGRAM_H__
+#define __PROGRAM_H__
+
+// System includes
+#include <stdint.h>
+#include <stdio.h>
+#include <linux/input.h>
+
+/// @brief A sequence of input events, grouped into frames by SYN_REPORT events
+struct program {
+    /// The events, including the SYN_REPORT terminating each frame
+    struct input_event * events;
+    /// Number of events in the program
+    size_t count;
+    /// Number of events allocated
+    size_t capacity;
+    /// Number of frames (SYN_REPORT events) in the program
+    size_t frames;
+};
+
+/// @brief Options controlling how text is compiled into key events
+struct program_type_options {
+    /// Maximum number of keys held down at once (1 for no overlap)
+    uint8_t overlap;
+    /// Minimum number of uppercase letters in a run before CapsLock is used instead of shift (0 to disable)
+    uint32_t capslock_run;
+};
+
+/// @brief Initialise an empty program
+/// @param [out] prog The program
+void program_init(struct program * prog);
+
+/// @brief Free memory held by a program and reset it to empty
+/// @param [in,out] prog The program
+void program_free(struct program * prog);
+
+/// @brief Append a single event to a program
+/// @param [in,out] prog The program
+/// @param type The type of input event
+/// @param code The event code
+/// @param value The event value
+/// @return 0 on success, 1 if error(s)
+int program_add(struct program * prog, uint16_t type, uint16_t code, int32_t value);
+
+/// @brief Terminate the current frame with a SYN_REPORT
+/// @param [in,out] prog The program
+/// @return 0 on success, 1 if error(s)
+int program_sync(struct program * prog);
+
+/// @brief Compile text into a minimal program of key events
+/// @details Shift is held across runs of shifted characters and the modifier
+/// state is tracked over the whole string. Every character is validated before
+/// anything is appended, so unsupported characters are reported up front
+/// @param [in,out] prog The program to append to
+/// @param text Null-terminated string to be typed
+/// @param opts Compilation options
+/// @return 0 on success, 1 if error(s)
+int program_compile_text(struct program * prog, const char * text, const struct program_type_options * opts);
+
+/// @brief Compile pressing or releasing a key sequence such as "CTRL+ALT+F3" as one frame
+/// @details Keys are pressed in the order given and released in reverse order.
+/// Shifted keys press shift just before them, and repeated keys are only sent once
+/// @param [in,out] prog The program to append to
+/// @param chord Keys separated by '+'
+/// @param value 1 to press the keys, 0 to release them
+/// @return 0 on success, 1 if error(s)
+int program_compile_keys(struct program * prog, const char * chord, int32_t value);
+
+/// @brief Compile a key sequence such as "CTRL+ALT+F3" as a press frame then a release frame
+/// @param [in,out] prog The program to append to
+/// @param chord Keys to be pressed together, separated by '+'
+/// @return 0 on success, 1 if error(s)
+int program_compile_chord(struct program * prog, const char * chord);
+
+/// @brief Compile a click of a mouse button
+/// @param [in,out] prog The program to append to
+/// @param button 1=left, 2=right, 3=middle
+/// @return 0 on success, 1 if error(s)
+int program_compile_click(struct program * prog, uint16_t button);
+
+/// @brief Compile an absolute pointer move
+/// @param [in,out] prog The program to append to
+/// @param x Horizontal position
+/// @param y Vertical position
+/// @return 0 on success, 1 if error(s)
+int program_compile_mouse(struct program * prog, int32_t x, int32_t y);
+
+/// @brief Compile a touch tap at a position
+/// @param [in,out] prog The program to append to
+/// @param x Horizontal position
+/// @param y Vertical position
+/// @return 0 on success, 1 if error(s)
+int program_compile_tap(struct program * prog, int32_t x, int32_t y);
+
+/// @brief Compile a macro made up of steps separated by ";" words
+/// @details Each step is one of "key <key sequence>...", "keydown <key sequence>...",
+/// "keyup <key sequence>...", "type <text>...", "click <button>", "mouse <x> <y>" or "tap <x> <y>"
+/// @param [in,out] prog The program to append to
+/// @param argc Number of words
+/// @param argv The words
+/// @return 0 on success, 1 if error(s)
+int program_compile_macro(struct program * prog, int argc, char ** argv);
+
+/// @brief Count the events typing text would take one shifted keypress at a time
+/// @param text Null-terminated string to be typed
+/// @return Number of events including SYN_REPORTs
+size_t program_naive_text_events(const char * text);
+
+/// @brief Print a human readable listing of a program, one frame per line
+/// @param stream Stream to print to
+/// @param prog The program
+void program_dump(FILE * stream, const struct program * prog);
+
+#endif // __PROGRAM_H__
@@ -0,0 +1,117 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file raw.c
+/// @author Harry Austen
+/// @brief Implementation of raw input event passthrough
+
+// System includes
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Local includes
+#include "raw.h"
+#include "uinput.h"
+
+/// Events read but not yet sent, kept off the stack as it's large
+static struct input_event RAW_EVENTS[RAW_BATCH_EVENTS];
+
+ssize_t raw_frames(const struct input_event * events, size_t count, int all) {
+    size_t end = count;
+    while (!all && end && (events[end - 1].type != EV_SYN || events[end - 1].code != SYN_REPORT)) {
+        --end;
+    }
+    for (size_t i = 0; i != end; ++i) {
+        if (events[i].type > EV_MAX) {
+            return -1;
+        }
+    }
+    return (ssize_t)end;
+}
+
+/// Splice a pipe into ydotoold's socket until the pipe's end
+/// @param fd The read end of the pipe
+/// @return 0 on success, 1 if error(s), -1 if events can't be spliced
+static int raw_splice(int fd) {
+    ssize_t n;
+    int moved = 0;
+    while ((n = uinput_splice(fd, RAW_SPLICE_BYTES)) > 0) {
+        moved = 1;
+    }
+    if (!n) {
+        return 0;
+    }
+    if (errno == EINVAL && !moved) {
+        return -1;
+    }
+    fprintf(stderr, "Failed to splice input events: %s\n", strerror(errno));
+    return 1;
+}
+
+int raw_stream(int fd) {
+    if (uinput_raw()) {
+        return 1;
+    }
+
+    struct stat st;
+    if (!fstat(fd, &st) && S_ISFIFO(st.st_mode)) {
+        int ret = raw_splice(fd);
+        if (ret >= 0) {
+            return ret;
+        }
+        // Not through ydotoold: read them instead
+    }
+
+    char * buf = (char *)RAW_EVENTS;
+    size_t len = 0;
+    for (;;) {
+        ssize_t n = read(fd, buf + len, sizeof(RAW_EVENTS) - len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to read input events: %s\n", strerror(errno));
+            return 1;
+        }
+        len += (size_t)n;
+
+        // A frame longer than the whole buffer goes in pieces, as does an unfinished last one
+        size_t count = len / sizeof(*RAW_EVENTS);
+        ssize_t end = raw_frames(RAW_EVENTS, count, 0);
+        if (!n || (!end && len == sizeof(RAW_EVENTS))) {
+            end = raw_frames(RAW_EVENTS, count, 1);
+        }
+        if (end < 0) {
+            fprintf(stderr, "Invalid input event type in the input\n");
+            return 1;
+        }
+
+        if (end && uinput_send_raw(RAW_EVENTS, (size_t)end)) {
+            return 1;
+        }
+        size_t used = (size_t)end * sizeof(*RAW_EVENTS);
+        memmove(buf, buf + used, len - used);
+        len -= used;
+        if (!n) {
+            break;
+        }
+    }
+
+    if (len) {
+        fprintf(stderr, "Input ends with a partial input event\n");
+        return 1;
+    }
+    return 0;
+}
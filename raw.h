@@ -0,0 +1,50 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file raw.h
+/// @author Harry Austen
+/// @brief Interface for passing raw input events through to the device
+/// @details Raw input is a stream of native struct input_event records, as read from
+/// an evdev node. It is only looked at frame by frame: each frame must end with a
+/// SYN_REPORT and hold nothing but valid event types
+
+#ifndef __RAW_H__
+#define __RAW_H__
+
+// System includes
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/input.h>
+
+/// Number of events read and sent at once when not splicing
+#define RAW_BATCH_EVENTS 4096
+
+/// Number of bytes spliced at once, a pipe's worth by default
+#define RAW_SPLICE_BYTES 65536
+
+/// @brief Find the complete frames at the start of a batch of events, and check them
+/// @param events The events
+/// @param count Number of events
+/// @param all Set to take all the events, e.g. at the end of input
+/// @return Number of events up to and including the last SYN_REPORT (0 if there is
+/// none), or -1 if an event in those has a type beyond EV_MAX
+ssize_t raw_frames(const struct input_event * events, size_t count, int all);
+
+/// @brief Pass raw input events from a file descriptor through until its end
+/// @details Through ydotoold, a pipe is spliced straight into the daemon's socket,
+/// which then checks the frames itself. Anything else is read in batches of whole
+/// frames, checked and sent on with one write per batch (or per frame to a device)
+/// @param fd The file descriptor, e.g. stdin
+/// @return 0 on success, 1 if error(s)
+int raw_stream(int fd);
+
+#endif // __RAW_H__
@@ -0,0 +1,118 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file recorder.c
+/// @author Harry Austen
+/// @brief Implementation of the ydotoold flight recorder
+
+// System includes
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local includes
+#include "recorder.h"
+
+/// The ring of records
+static struct recorder_record RING[RECORDER_RECORDS];
+
+/// Number of records ever added
+static uint64_t TOTAL = 0;
+
+int64_t recorder_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void recorder_add(struct recorder_record * record) {
+    uint64_t seq = TOTAL + 1;
+    struct recorder_record * slot = &RING[TOTAL & (RECORDER_RECORDS - 1)];
+
+    // Mark the slot as being written, so a concurrent dump can skip it
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->client = record->client;
+    slot->events = record->events;
+    slot->flags = record->flags;
+    slot->t_send = record->t_send;
+    slot->t_recv = record->t_recv;
+    slot->t_dequeue = record->t_dequeue;
+    slot->t_written = record->t_written;
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&TOTAL, seq, __ATOMIC_RELEASE);
+
+    record->seq = seq;
+}
+
+/// Write a whole buffer to a file descriptor
+/// @param fd The file descriptor
+/// @param buf The buffer
+/// @param len Number of bytes in buf
+/// @return 0 on success, 1 if error(s)
+static int recorder_write(int fd, const void * buf, size_t len) {
+    const char * p = buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int recorder_dump(const char * path) {
+    // The dump usually goes to /tmp, as root: a fresh file, never one (or a symlink)
+    // planted there, is filled in and then renamed over the path
+    char tmp[PATH_MAX];
+    size_t len = strlen(path);
+    if (len + sizeof(RECORDER_TMP_SUFFIX) > sizeof(tmp)) {
+        return -1;
+    }
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, RECORDER_TMP_SUFFIX, sizeof(RECORDER_TMP_SUFFIX));
+    unlink(tmp);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    uint64_t total = __atomic_load_n(&TOTAL, __ATOMIC_ACQUIRE);
+    uint64_t count = total < RECORDER_RECORDS ? total : RECORDER_RECORDS;
+    struct recorder_header header = {
+        RECORDER_MAGIC,
+        RECORDER_VERSION,
+        sizeof(struct recorder_record),
+        (uint32_t)count,
+        total
+    };
+
+    // Oldest records first: from the slot after the newest to the end, then the start.
+    // Records overwritten while dumping keep their own seq, which the decoder checks
+    size_t start = (size_t)(total & (RECORDER_RECORDS - 1));
+    int err = recorder_write(fd, &header, sizeof(header));
+    if (count == RECORDER_RECORDS) {
+        err = err || recorder_write(fd, RING + start, sizeof(*RING) * (RECORDER_RECORDS - start));
+    }
+    err = err || recorder_write(fd, RING, sizeof(*RING) * start);
+
+    if (close(fd) || err || rename(tmp, path)) {
+        unlink(tmp);
+        return -1;
+    }
+    return (int)count;
+}
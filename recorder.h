@@ -0,0 +1,98 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file recorder.h
+/// @author Harry Austen
+/// @brief Interface for the ydotoold flight recorder
+/// @details The daemon's writer thread records the timestamps of every frame it
+/// writes into a fixed-size ring. Only that thread adds records, so adding one
+/// is a handful of stores and no locking. The ring can be dumped to a file at
+/// any time, including from a signal handler, and read back with frdecode
+
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+// System includes
+#include <stdint.h>
+
+/// Number of records held by the ring (a power of two)
+#define RECORDER_RECORDS 8192
+
+/// Magic number at the start of a dump file ("YDFR")
+#define RECORDER_MAGIC 0x52464459
+
+/// Version of the dump file format
+#define RECORDER_VERSION 1
+
+/// Suffix of the file a dump is written to before it is renamed into place
+#define RECORDER_TMP_SUFFIX ".tmp"
+
+/// Record flag: the frame was a macro run
+#define RECORDER_FLAG_MACRO 0x1
+/// Record flag: writing the frame failed and it was dropped
+#define RECORDER_FLAG_DROPPED 0x2
+/// Record flag: later motion frames were merged into the frame while it was queued
+#define RECORDER_FLAG_COALESCED 0x4
+
+/// @brief Timestamps of a single frame on its way to the device
+/// @details Times are CLOCK_MONOTONIC nanoseconds. t_send is 0 when the client didn't stamp the frame
+struct recorder_record {
+    /// Sequence number of the record, starting from 1 (0 marks an unused slot)
+    uint64_t seq;
+    /// Id of the client the frame came from
+    uint32_t client;
+    /// Number of events in the frame
+    uint16_t events;
+    /// RECORDER_FLAG_* bits
+    uint16_t flags;
+    /// When the client sent the frame
+    int64_t t_send;
+    /// When the daemon received the end of the frame
+    int64_t t_recv;
+    /// When the writer thread took the frame off the queue
+    int64_t t_dequeue;
+    /// When the write to the device returned
+    int64_t t_written;
+};
+
+/// @brief Header of a dump file, followed by the records oldest first
+struct recorder_header {
+    /// RECORDER_MAGIC
+    uint32_t magic;
+    /// RECORDER_VERSION
+    uint32_t version;
+    /// Size of each record in bytes
+    uint32_t record_size;
+    /// Number of records following the header
+    uint32_t count;
+    /// Total number of records ever added, including those overwritten
+    uint64_t total;
+};
+
+/// @brief Get the current CLOCK_MONOTONIC time
+/// @return Nanoseconds
+int64_t recorder_now();
+
+/// @brief Add a record to the ring, overwriting the oldest once full
+/// @details Must only be called from a single thread
+/// @param record The record (its seq is filled in)
+void recorder_add(struct recorder_record * record);
+
+/// @brief Write the ring to a file
+/// @details Only uses async-signal-safe calls, so may be called from a signal handler.
+/// The file is written next to path, with RECORDER_TMP_SUFFIX appended, created
+/// exclusively and without following symlinks, then renamed to path
+/// @param path Path of the file to write
+/// @return Number of records written, or -1 if error(s)
+int recorder_dump(const char * path);
+
+#endif // __RECORDER_H__
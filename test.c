@@ -14,11 +14,22 @@
 /// @brief Program for testing the ydotool code
 
 // System includes
+#include <errno.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 // Local includes
+#include "gamepad.h"
+#include "log.h"
+#include "program.h"
+#include "raw.h"
+#include "trace.h"
+#include "translate.h"
 #include "uinput.h"
+#include "ydotoold.h"
 
 /// Check that the char/string to keycode mapping arrays are in chronological order
 /// The strings/characters are compared when using the binary search algorithm and
@@ -120,6 +131,250 @@ int uinput_test_keystring_to_keycode() {
     return ret;
 }
 
+/// Replay a program through a minimal keyboard model and collect the typed text
+/// @param prog The program to replay
+/// @param [out] out Buffer for the typed text
+/// @param len Size of out
+/// @return 0 on success, >0 if errors
+int program_test_replay(const struct program * prog, char * out, size_t len) {
+    int ret = 0;
+    int shift = 0;
+    int caps = 0;
+    int down[KEY_CNT] = {0};
+    size_t n = 0;
+
+    for (size_t i = 0; i != prog->count; ++i) {
+        const struct input_event * ev = &prog->events[i];
+        if (ev->type != EV_KEY) {
+            continue;
+        }
+        if (ev->value == down[ev->code]) {
+            printf("Redundant %s of key %d\n", ev->value ? "press" : "release", ev->code);
+            ret++;
+        }
+        down[ev->code] = ev->value;
+        if (ev->code == KEY_LEFTSHIFT) {
+            shift = ev->value;
+            continue;
+        }
+        if (ev->code == KEY_CAPSLOCK) {
+            caps ^= ev->value;
+            continue;
+        }
+        if (!ev->value || n + 1 == len) {
+            continue;
+        }
+
+        char c = 0;
+        for (size_t j = 0; j != NUM_NORMAL_KEYS && !c; ++j) {
+            if (NORMAL_KEYS[j].code == ev->code) {
+                c = NORMAL_KEYS[j].character;
+            }
+        }
+        for (size_t j = 0; j != NUM_SHIFTED_KEYS && shift && c != ' '; ++j) {
+            if (SHIFTED_KEYS[j].code == ev->code) {
+                c = SHIFTED_KEYS[j].character;
+                break;
+            }
+        }
+        if (caps && c >= 'a' && c <= 'z') {
+            c = (char)(c - 'a' + 'A');
+        } else if (caps && c >= 'A' && c <= 'Z') {
+            c = (char)(c - 'A' + 'a');
+        }
+        out[n++] = c;
+    }
+    out[n] = '\0';
+
+    for (int code = 0; code != KEY_CNT; ++code) {
+        if (down[code]) {
+            printf("Key %d left held down\n", code);
+            ret++;
+        }
+    }
+    if (caps) {
+        printf("CapsLock left on\n");
+        ret++;
+    }
+    return ret;
+}
+
+/// Check that compiled text types back the same text in fewer events than the naive approach
+/// @return 0 on success, >0 if errors
+int program_test_compile_text() {
+    int ret = 0;
+    const char * texts[] = {
+        "HELLO WORLD",
+        "Hey guys. This is Austin.",
+        "aall  ZZ!!Ab",
+        "ABC-DEF-GHI-JKL-MNO-PQR x",
+        "int main(void) { return 0; }\n",
+    };
+    const struct program_type_options opts[] = {
+        { 1, 0 },
+        { 2, 0 },
+        { 4, 0 },
+        { 1, 3 },
+        { 3, 3 },
+    };
+
+    for (size_t i = 0; i != sizeof(texts) / sizeof(*texts); ++i) {
+        for (size_t j = 0; j != sizeof(opts) / sizeof(*opts); ++j) {
+            struct program prog;
+            char out[128];
+            program_init(&prog);
+
+            if (program_compile_text(&prog, texts[i], &opts[j])) {
+                printf("Failed to compile \"%s\"\n", texts[i]);
+                ret++;
+            } else if (program_test_replay(&prog, out, sizeof(out))) {
+                printf("Bad key state compiling \"%s\" (overlap %u, capslock %u)\n", texts[i], opts[j].overlap, opts[j].capslock_run);
+                ret++;
+            } else if (strcmp(out, texts[i])) {
+                printf("Compiled \"%s\" types \"%s\" (overlap %u, capslock %u)\n", texts[i], out, opts[j].overlap, opts[j].capslock_run);
+                ret++;
+            } else if (prog.count >= program_naive_text_events(texts[i])) {
+                printf("Compiled \"%s\" takes %zu events, naive takes %zu\n", texts[i], prog.count, program_naive_text_events(texts[i]));
+                ret++;
+            }
+
+            program_free(&prog);
+        }
+    }
+
+    return ret;
+}
+
+/// Check that rolled typing never releases and presses the same key in one frame
+/// @return 0 on success, >0 if errors
+int program_test_rolled_repeat() {
+    int ret = 0;
+    const char * texts[] = {
+        "hello",
+        "bookkeeper",
+        "aall  ZZ!!Ab",
+    };
+
+    for (size_t i = 0; i != sizeof(texts) / sizeof(*texts); ++i) {
+        for (uint8_t overlap = 2; overlap <= UINPUT_MAX_OVERLAP; ++overlap) {
+            const struct program_type_options opts = { overlap, 0 };
+            struct program prog;
+            program_init(&prog);
+
+            if (program_compile_text(&prog, texts[i], &opts)) {
+                printf("Failed to compile \"%s\"\n", texts[i]);
+                ret++;
+            }
+
+            // Codes pressed and released in the current frame
+            int pressed[KEY_CNT] = {0};
+            int released[KEY_CNT] = {0};
+            for (size_t j = 0; j != prog.count; ++j) {
+                const struct input_event * ev = &prog.events[j];
+                if (ev->type == EV_SYN) {
+                    memset(pressed, 0, sizeof(pressed));
+                    memset(released, 0, sizeof(released));
+                } else if (ev->type == EV_KEY) {
+                    (ev->value ? pressed : released)[ev->code] = 1;
+                    if (pressed[ev->code] && released[ev->code]) {
+                        printf("Key %d released and pressed in one frame typing \"%s\" (overlap %u)\n", ev->code, texts[i], overlap);
+                        ret++;
+                    }
+                }
+            }
+
+            program_free(&prog);
+        }
+    }
+
+    return ret;
+}
+
+/// Check that chords are pressed in one frame and released in reverse order in the next
+/// @return 0 on success, >0 if errors
+int program_test_compile_chord() {
+    int ret = 0;
+    const struct {
+        const char * chord;
+        uint16_t keys[4];
+        size_t count;
+    } chords[] = {
+        { "CTRL+ALT+F1", { KEY_LEFTCTRL, KEY_LEFTALT, KEY_F1 }, 3 },
+        { "SHIFT+!", { KEY_LEFTSHIFT, KEY_1 }, 2 },
+        { "CTRL+A+b", { KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_A, KEY_B }, 4 },
+        { "ENTER", { KEY_ENTER }, 1 },
+    };
+
+    for (size_t i = 0; i != sizeof(chords) / sizeof(*chords); ++i) {
+        struct program prog;
+        char out[16];
+        size_t count = chords[i].count;
+        program_init(&prog);
+
+        if (program_compile_chord(&prog, chords[i].chord)) {
+            printf("Failed to compile chord %s\n", chords[i].chord);
+            ret++;
+        } else if (prog.frames != 2 || prog.count != 2 * count + 2 || program_test_replay(&prog, out, sizeof(out))) {
+            printf("Chord %s takes %zu events in %zu frames\n", chords[i].chord, prog.count, prog.frames);
+            ret++;
+        } else {
+            for (size_t j = 0; j != count; ++j) {
+                if (prog.events[j].code != chords[i].keys[j] || prog.events[j].value != 1
+                        || prog.events[count + 1 + j].code != chords[i].keys[count - 1 - j]
+                        || prog.events[count + 1 + j].value != 0) {
+                    printf("Chord %s pressed or released out of order\n", chords[i].chord);
+                    ret++;
+                    break;
+                }
+            }
+        }
+
+        program_free(&prog);
+    }
+
+    struct program prog;
+    program_init(&prog);
+    if (!program_compile_chord(&prog, "CTRL++a") || prog.count) {
+        printf("Chord CTRL++a accepted\n");
+        ret++;
+    }
+    program_free(&prog);
+
+    return ret;
+}
+
+/// Check that a pace written by uinput_save_pace() is read back from the config file
+/// @return 0 on success, >0 if errors
+int uinput_test_pace() {
+    int ret = 0;
+    char path[] = "/tmp/ydotool-test-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        printf("Failed to create %s\n", path);
+        return 1;
+    }
+    close(fd);
+
+    setenv(UINPUT_CONFIG_ENV, path, 1);
+    if (strcmp(uinput_config_path(), path)) {
+        printf("Config path %s instead of %s\n", uinput_config_path(), path);
+        ret++;
+    }
+    if (uinput_save_pace(path, 137) || uinput_get_pace() != 137) {
+        printf("Pace %u read back instead of 137\n", uinput_get_pace());
+        ret++;
+    }
+    uinput_set_pace(0);
+    if (uinput_get_pace()) {
+        printf("Pace %u after setting 0\n", uinput_get_pace());
+        ret++;
+    }
+
+    unsetenv(UINPUT_CONFIG_ENV);
+    unlink(path);
+    return ret;
+}
+
 /// Tests for the uinput.c/h functions
 /// @return 0 on success, >0 if errors
 int uinput_test() {
@@ -127,7 +382,322 @@ int uinput_test() {
 
     ret += uinput_test_array_order();
     ret += uinput_test_keystring_to_keycode();
+    ret += uinput_test_pace();
+
+    return ret;
+}
+
+/// Check that trace lines parse into the right samples, and malformed ones are refused
+/// @return 0 on success, >0 if errors
+int trace_test_parse_line() {
+    int ret = 0;
+    const struct {
+        const char * line;
+        int parsed;
+        struct trace_sample sample;
+    } cases[] = {
+        { "10 20",          1, { 0, 10, 20, 0, 0 } },
+        { " -5\t+7 \r",     1, { 0, -5, 7, 0, 0 } },
+        { "1 2 3",          1, { 3000, 1, 2, TRACE_TIMED, 0 } },
+        { "1 2 16.6667",    1, { 16666, 1, 2, TRACE_TIMED, 0 } },
+        { "",               0, { 0, 0, 0, 0, 0 } },
+        { "  ",             0, { 0, 0, 0, 0, 0 } },
+        { "1",             -1, { 0, 0, 0, 0, 0 } },
+        { "1 2 -3",        -1, { 0, 0, 0, 0, 0 } },
+        { "1 2 3 4",       -1, { 0, 0, 0, 0, 0 } },
+        { "x 2",           -1, { 0, 0, 0, 0, 0 } },
+        { "4294967296 0",  -1, { 0, 0, 0, 0, 0 } },
+    };
+
+    for (size_t i = 0; i != sizeof(cases) / sizeof(*cases); ++i) {
+        struct trace_sample sample;
+        int parsed = trace_parse_line(cases[i].line, strlen(cases[i].line), &sample);
+        if (parsed != cases[i].parsed || (parsed == 1 && memcmp(&sample, &cases[i].sample, sizeof(sample)))) {
+            printf("Trace line \"%s\" parsed as %d: %d %d %" PRId64 " %u\n", cases[i].line, parsed,
+                sample.x, sample.y, sample.t_us, sample.flags);
+            ret++;
+        }
+    }
+
+    return ret;
+}
+
+/// Check that the vector and scalar translations agree with the key arrays on every byte,
+/// wherever it falls in a block
+/// @return 0 on success, >0 if errors
+int translate_test_bytes() {
+    int ret = 0;
+    char text[TRANSLATE_BLOCK * 2 + 1];
+    uint16_t codes[sizeof(text)];
+    uint8_t shifted[sizeof(text)];
+
+    for (int c = 1; c != 256; ++c) {
+        uint16_t code = 0;
+        uint8_t shift = 0;
+        for (size_t i = 0; i != NUM_NORMAL_KEYS; ++i) {
+            code = NORMAL_KEYS[i].character == (char)c ? NORMAL_KEYS[i].code : code;
+        }
+        for (size_t i = 0; i != NUM_SHIFTED_KEYS; ++i) {
+            if (SHIFTED_KEYS[i].character == (char)c) {
+                code = SHIFTED_KEYS[i].code;
+                shift = 1;
+            }
+        }
+
+        for (size_t at = 0; at != TRANSLATE_BLOCK; ++at) {
+            memset(text, 'a', sizeof(text) - 1);
+            text[sizeof(text) - 1] = '\0';
+            text[at] = (char)c;
 
+            size_t simd = translate_text_simd(text, sizeof(text) - 1, codes, shifted);
+            size_t scalar = translate_text_scalar(text + simd, sizeof(text) - 1 - simd, codes + simd, shifted + simd);
+            if (!code) {
+                ret += simd > at || simd + scalar != at;
+            } else if (simd + scalar != sizeof(text) - 1 || codes[at] != code || shifted[at] != shift
+                    || codes[TRANSLATE_BLOCK] != KEY_A || shifted[TRANSLATE_BLOCK]) {
+                printf("Byte 0x%02x at %zu translates to %u (shift %u), not %u (shift %u)\n",
+                    c, at, codes[at], shifted[at], code, shift);
+                ret++;
+            }
+        }
+    }
+    return ret;
+}
+
+/// Check that simplification keeps corners and contact changes, and resampling lands on the grid
+/// @return 0 on success, >0 if errors
+int trace_test_simplify() {
+    int ret = 0;
+
+    // Along x then y at a steady speed, then lifted where it stopped
+    struct trace_sample samples[102];
+    for (int32_t i = 0; i != 102; ++i) {
+        samples[i].t_us = i * 1000;
+        samples[i].x = i < 50 ? i : 50;
+        samples[i].y = i < 50 ? 0 : (i < 101 ? i - 50 : 50);
+        samples[i].flags = TRACE_TIMED | (i < 101 ? TRACE_DOWN : 0);
+        samples[i].reserved = 0;
+    }
+    double max_error;
+    size_t kept = trace_simplify(samples, 102, TRACE_EPSILON, &max_error);
+    const int32_t expected[][2] = { { 0, 0 }, { 50, 0 }, { 50, 50 }, { 50, 50 } };
+    if (kept != 4 || max_error > 1e-9) {
+        printf("Simplified an L to %zu samples, error %f\n", kept, max_error);
+        ret++;
+    }
+    for (size_t i = 0; i != kept && i != 4; ++i) {
+        if (samples[i].x != expected[i][0] || samples[i].y != expected[i][1]) {
+            printf("Simplified sample %zu is at %d,%d\n", i, samples[i].x, samples[i].y);
+            ret++;
+        }
+    }
+    ret += kept == 4 && (samples[3].flags & TRACE_DOWN || !(samples[2].flags & TRACE_DOWN));
+
+    // A zigzag further from its line than the bound is kept whole
+    for (int32_t i = 0; i != 10; ++i) {
+        samples[i].t_us = 0;
+        samples[i].x = i;
+        samples[i].y = i % 2 ? 3 : 0;
+        samples[i].flags = 0;
+    }
+    kept = trace_simplify(samples, 10, TRACE_EPSILON, &max_error);
+    if (kept != 10) {
+        printf("Simplified a zigzag to %zu samples\n", kept);
+        ret++;
+    }
+
+    // Every 5ms from 0 to 20ms, between samples 10ms apart
+    struct trace_sample in[3] = {
+        { 0,     0,  0, TRACE_TIMED | TRACE_DOWN, 0 },
+        { 10000, 10, 4, TRACE_TIMED | TRACE_DOWN, 0 },
+        { 20000, 20, 4, TRACE_TIMED | TRACE_DOWN, 0 },
+    };
+    struct trace_sample * out;
+    size_t count;
+    if (trace_resample(in, 3, 5000, &out, &count)) {
+        printf("Failed to resample\n");
+        return ret + 1;
+    }
+    if (count != 5 || out[1].t_us != 5000 || out[1].x != 5 || out[1].y != 2 || out[3].x != 15 || out[4].t_us != 20000) {
+        printf("Resampled to %zu samples\n", count);
+        ret++;
+    }
+    free(out);
+
+    return ret;
+}
+
+/// Check that raw input is cut after its last complete frame, and checked up to there
+/// @return 0 on success, >0 if errors
+int raw_test_frames() {
+    int ret = 0;
+    struct input_event events[5];
+    memset(events, 0, sizeof(events));
+    events[0].type = EV_KEY;
+    events[1].type = EV_SYN;
+    events[2].type = EV_REL;
+    events[3].type = EV_SYN;
+    events[4].type = EV_KEY;
+
+    const struct {
+        size_t count;
+        int all;
+        ssize_t end;
+    } cases[] = {
+        { 5, 0, 4 },
+        { 3, 0, 2 },
+        { 1, 0, 0 },
+        { 0, 0, 0 },
+        { 5, 1, 5 },
+    };
+    for (size_t i = 0; i != sizeof(cases) / sizeof(*cases); ++i) {
+        ssize_t end = raw_frames(events, cases[i].count, cases[i].all);
+        if (end != cases[i].end) {
+            printf("Raw frames of %zu events (all %d) end at %zd, not %zd\n", cases[i].count, cases[i].all, end, cases[i].end);
+            ret++;
+        }
+    }
+
+    // Past the last frame nothing is looked at, unless taking all
+    events[4].type = 0xffff;
+    ret += raw_frames(events, 5, 0) != 4;
+    ret += raw_frames(events, 5, 1) != -1;
+    events[0].type = 0xffff;
+    ret += raw_frames(events, 5, 0) != -1;
+
+    return ret;
+}
+
+/// Check that logged messages come out as printf would have formatted them, once flushed
+/// @return 0 on success, >0 if errors
+int log_test_format() {
+    int ret = 0;
+    FILE * f = tmpfile();
+    if (!f) {
+        printf("Failed to create a file to log to\n");
+        return 1;
+    }
+    char name[16] = "client";
+    size_t size = 24;
+
+    char expected[512];
+    int len = snprintf(expected, sizeof(expected),
+        "%s %u (pid %d): %5.2f%% |%zu %c %lld %#x\n" "no args\n" "%s\n" "%s %d\n",
+        name, 7u, -3, 12.345, size, 'x', -1234567890123LL, 255u, "info", "error", 1);
+
+    log_set_output(f, f);
+    log_set_level(LOG_LEVEL_INFO);
+    log_info("%s %u (pid %d): %5.2f%% |%zu %c %lld %#x\n", name, 7u, -3, 12.345, size, 'x', -1234567890123LL, 255u);
+    // The string is copied, not referenced
+    strcpy(name, "changed");
+    log_warn("no args\n");
+    log_info("%s\n", "info");
+    log_debug("%s\n", "filtered");
+    log_error("%s %d\n", "error", 1);
+    log_flush();
+    log_set_output(NULL, NULL);
+    log_set_level(LOG_LEVEL_WARN);
+
+    char actual[512];
+    rewind(f);
+    size_t n = fread(actual, 1, sizeof(actual) - 1, f);
+    actual[n] = '\0';
+    fclose(f);
+    if (n != (size_t)len || strcmp(actual, expected)) {
+        printf("Logged:\n%sExpected:\n%s", actual, expected);
+        ret++;
+    }
+    return ret;
+}
+
+/// Check that gamepad snapshots are written as frames of only what changed
+/// @return 0 on success, >0 if errors
+int gamepad_test_frame() {
+    int ret = 0;
+    struct gamepad_profile profile;
+    gamepad_profile_default(&profile);
+    ret += gamepad_parse_axes("x,x", &profile) != 1;
+    ret += gamepad_parse_axes("q", &profile) != 1;
+    ret += gamepad_parse_axes("z:5:1", &profile) != 1;
+    ret += gamepad_parse_buttons("a,start,nope", &profile) != 1;
+    ret += gamepad_parse_axes("x,y,z:0:255", &profile);
+    ret += gamepad_parse_buttons("a,b", &profile);
+    profile.hats = 1;
+
+    struct gamepad gamepad;
+    if (gamepad_init(&gamepad, &profile) || gamepad.num_abs != 5) {
+        printf("Failed to set up gamepad\n");
+        return ret + 1;
+    }
+
+    // Out of range values are clamped, and values left out keep theirs
+    struct gamepad_snapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    const char line[] = " 100\t-5 300 -2 0 0x2";
+    ret += gamepad_parse_line(&gamepad, line, sizeof(line) - 1, &snapshot);
+    ret += gamepad_parse_line(&gamepad, "1 2 3 4 5 0x4", 13, &snapshot) != 1;
+    ret += gamepad_parse_line(&gamepad, "1 2 3 4 5 6 7", 13, &snapshot) != 1;
+    ret += gamepad_parse_line(&gamepad, "1 x", 3, &snapshot) != 1;
+
+    struct input_event frame[GAMEPAD_FRAME_EVENTS];
+    const struct {
+        uint16_t type;
+        uint16_t code;
+        int32_t value;
+    } expected[] = {
+        { EV_ABS, ABS_X, 100 },
+        { EV_ABS, ABS_Y, -5 },
+        { EV_ABS, ABS_Z, 255 },
+        { EV_ABS, ABS_HAT0X, -1 },
+        { EV_KEY, BTN_B, 1 },
+        { EV_SYN, SYN_REPORT, 0 },
+    };
+    size_t count = gamepad_frame(&gamepad, &snapshot, frame);
+    if (count != sizeof(expected) / sizeof(*expected)) {
+        printf("Gamepad frame has %zu events, not %zu\n", count, sizeof(expected) / sizeof(*expected));
+        return ret + 1;
+    }
+    for (size_t i = 0; i != count; ++i) {
+        if (frame[i].type != expected[i].type || frame[i].code != expected[i].code || frame[i].value != expected[i].value) {
+            printf("Gamepad event %zu is %u %u %d, not %u %u %d\n", i, frame[i].type, frame[i].code, frame[i].value,
+                expected[i].type, expected[i].code, expected[i].value);
+            ret++;
+        }
+    }
+
+    ret += gamepad_parse_line(&gamepad, "100 7", 5, &snapshot);
+    count = gamepad_frame(&gamepad, &snapshot, frame);
+    ret += count != 2 || frame[0].code != ABS_Y || frame[0].value != 7;
+    ret += gamepad_parse_line(&gamepad, "", 0, &snapshot);
+    ret += gamepad_frame(&gamepad, &snapshot, frame) != 0;
+    ret += gamepad_parse_line(&gamepad, "100 7 255 -1 0 0x1", 18, &snapshot);
+    count = gamepad_frame(&gamepad, &snapshot, frame);
+    ret += count != 3 || frame[0].code != BTN_A || frame[0].value != 1 || frame[1].code != BTN_B || frame[1].value != 0;
+
+    return ret;
+}
+
+/// Check that ydotoold turns down malformed macro definitions before splitting them
+/// @return 0 on success, >0 if errors
+int ydotoold_test_macro_define() {
+    int ret = 0;
+    char payload[YDOTOOLD_MAX_PAYLOAD];
+
+    // Only NUL bytes: no name, and as many empty words as fit
+    memset(payload, 0, sizeof(payload));
+    ret += ydotoold_macro_define(payload, sizeof(payload)) != -EINVAL;
+    // A name, then only empty words
+    payload[0] = 'm';
+    ret += ydotoold_macro_define(payload, sizeof(payload)) != -EINVAL;
+    // A name and a word, then an empty word
+    memcpy(payload, "m\0a\0\0", 5);
+    ret += ydotoold_macro_define(payload, 5) != -EINVAL;
+    // Not null-terminated
+    ret += ydotoold_macro_define(payload, 3) != -EINVAL;
+
+    if (ret) {
+        printf("Malformed macro definitions were accepted\n");
+    }
     return ret;
 }
 
@@ -137,6 +707,16 @@ int main() {
     int ret = 0;
 
     ret += uinput_test();
+    ret += program_test_compile_text();
+    ret += program_test_rolled_repeat();
+    ret += translate_test_bytes();
+    ret += program_test_compile_chord();
+    ret += trace_test_parse_line();
+    ret += trace_test_simplify();
+    ret += raw_test_frames();
+    ret += log_test_format();
+    ret += gamepad_test_frame();
+    ret += ydotoold_test_macro_define();
 
     if (ret) {
         printf("FAILED %d tests\n", ret);
@@ -0,0 +1,659 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file trace.c
+/// @author Harry Austen
+/// @brief Implementation of streaming pointer and touch traces
+
+// System includes
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Local includes
+#include "trace.h"
+#include "uinput.h"
+
+/// Nanoseconds per second
+#define NSEC_PER_SEC 1000000000L
+
+/// Most samples resampling may produce
+#define TRACE_MAX_SAMPLES (1 << 26)
+
+/// Usage string of the trace tools
+static const char trace_usage[] =
+    "Usage: trace simplify [--epsilon <px>] [--interval <ms>] [--relative] [--output <path>] [<path>]\n"
+    "    --help           Show this help\n"
+    "    --epsilon px     Farthest a dropped sample may be from the simplified path (default 1)\n"
+    "    --interval ms    Resample to one sample every ms (fractional) milliseconds first\n"
+    "    --relative       Samples are movements, as for mouse --relative, rather than positions\n"
+    "    --output path    File to write (default stdout)\n"
+    "Reads struct trace_sample records (see trace.h) from path, or stdin, and writes them\n"
+    "simplified. Samples where the contact goes down or up are always kept\n";
+
+/// Skip spaces and tabs
+/// @param p Current position
+/// @param end End of the line
+/// @return The first position that isn't a space or tab
+static const char * trace_skip(const char * p, const char * end) {
+    while (p != end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        ++p;
+    }
+    return p;
+}
+
+/// Parse a signed decimal integer
+/// @param [in,out] p Current position, moved past the number
+/// @param end End of the line
+/// @param [out] value The number
+/// @return 0 on success, 1 if there is no number or it is out of range
+static int trace_parse_int(const char ** p, const char * end, int32_t * value) {
+    const char * s = *p;
+    int negative = s != end && *s == '-';
+    if (s != end && (*s == '-' || *s == '+')) {
+        ++s;
+    }
+    if (s == end || *s < '0' || *s > '9') {
+        return 1;
+    }
+
+    int64_t n = 0;
+    for (; s != end && *s >= '0' && *s <= '9'; ++s) {
+        n = n * 10 + (*s - '0');
+        if (n > (int64_t)INT32_MAX + 1) {
+            return 1;
+        }
+    }
+    n = negative ? -n : n;
+    if (n > INT32_MAX) {
+        return 1;
+    }
+    *value = (int32_t)n;
+    *p = s;
+    return 0;
+}
+
+/// Parse a non-negative decimal number of milliseconds into microseconds
+/// @param [in,out] p Current position, moved past the number
+/// @param end End of the line
+/// @param [out] us The time in microseconds, rounded down
+/// @return 0 on success, 1 if there is no number or it is out of range
+static int trace_parse_ms(const char ** p, const char * end, int64_t * us) {
+    const char * s = *p;
+    if (s == end || *s < '0' || *s > '9') {
+        return 1;
+    }
+
+    int64_t n = 0;
+    for (; s != end && *s >= '0' && *s <= '9'; ++s) {
+        n = n * 10 + (*s - '0');
+        if (n > INT64_MAX / 10000) {
+            return 1;
+        }
+    }
+    n *= 1000;
+
+    // Fractional milliseconds down to microseconds, further digits ignored
+    if (s != end && *s == '.') {
+        int64_t scale = 100;
+        for (++s; s != end && *s >= '0' && *s <= '9'; ++s) {
+            n += (*s - '0') * scale;
+            scale /= 10;
+        }
+    }
+    *us = n;
+    *p = s;
+    return 0;
+}
+
+int trace_parse_line(const char * line, size_t len, struct trace_sample * sample) {
+    const char * end = line + len;
+    const char * p = trace_skip(line, end);
+    memset(sample, 0, sizeof(*sample));
+    if (p == end) {
+        return 0;
+    }
+
+    if (trace_parse_int(&p, end, &sample->x)) {
+        return -1;
+    }
+    p = trace_skip(p, end);
+    if (trace_parse_int(&p, end, &sample->y)) {
+        return -1;
+    }
+    p = trace_skip(p, end);
+    if (p != end) {
+        if (trace_parse_ms(&p, end, &sample->t_us)) {
+            return -1;
+        }
+        sample->flags |= TRACE_TIMED;
+        p = trace_skip(p, end);
+    }
+    return p == end ? 1 : -1;
+}
+
+void trace_player_init(struct trace_player * player, enum trace_target target) {
+    memset(player, 0, sizeof(*player));
+    player->target = target;
+}
+
+/// Append an event to a frame
+/// @param [in,out] frame The frame being built
+/// @param [in,out] count Number of events in frame
+/// @param type Type of the event
+/// @param code Code of the event
+/// @param value Value of the event
+static void trace_frame_add(struct input_event * frame, size_t * count, uint16_t type, uint16_t code, int32_t value) {
+    memset(&frame[*count], 0, sizeof(frame[*count]));
+    frame[*count].type = type;
+    frame[*count].code = code;
+    frame[*count].value = value;
+    (*count)++;
+}
+
+/// Wait until a timed sample is due
+/// @param player The player
+/// @param t_us Time of the sample
+static void trace_wait(struct trace_player * player, int64_t t_us) {
+    if (!player->timed) {
+        player->timed = 1;
+        player->t0 = t_us;
+        clock_gettime(CLOCK_MONOTONIC, &player->start);
+        return;
+    }
+    if (t_us <= player->t0) {
+        return;
+    }
+
+    int64_t offset = t_us - player->t0;
+    struct timespec deadline = player->start;
+    deadline.tv_sec += (time_t)(offset / 1000000);
+    deadline.tv_nsec += (long)(offset % 1000000) * 1000;
+    if (deadline.tv_nsec >= NSEC_PER_SEC) {
+        deadline.tv_nsec -= NSEC_PER_SEC;
+        deadline.tv_sec++;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+int trace_play(struct trace_player * player, const struct trace_sample * sample) {
+    if (sample->flags & TRACE_TIMED) {
+        trace_wait(player, sample->t_us);
+    }
+
+    struct input_event frame[3];
+    size_t count = 0;
+    if (player->target == TRACE_MOUSE_RELATIVE) {
+        if (sample->x) {
+            trace_frame_add(frame, &count, EV_REL, REL_X, sample->x);
+        }
+        if (sample->y) {
+            trace_frame_add(frame, &count, EV_REL, REL_Y, sample->y);
+        }
+    } else {
+        if (!player->positioned || sample->x != player->x) {
+            trace_frame_add(frame, &count, EV_ABS, ABS_X, sample->x);
+        }
+        if (!player->positioned || sample->y != player->y) {
+            trace_frame_add(frame, &count, EV_ABS, ABS_Y, sample->y);
+        }
+        player->positioned = 1;
+        player->x = sample->x;
+        player->y = sample->y;
+    }
+
+    // The contact lands where the sample is, in the same frame
+    int down = (sample->flags & TRACE_DOWN) != 0;
+    if (down != player->down) {
+        trace_frame_add(frame, &count, EV_KEY, player->target == TRACE_TOUCH ? BTN_TOUCH : BTN_LEFT, down);
+        player->down = down;
+    }
+
+    return count && uinput_send_frame(frame, count);
+}
+
+int trace_player_finish(struct trace_player * player) {
+    if (!player->down) {
+        return 0;
+    }
+    struct input_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = EV_KEY;
+    ev.code = player->target == TRACE_TOUCH ? BTN_TOUCH : BTN_LEFT;
+    player->down = 0;
+    return uinput_send_frame(&ev, 1);
+}
+
+/// Play the text samples in a buffer
+/// @param player The player
+/// @param buf The buffer
+/// @param len Number of bytes in buf
+/// @param last Set if no more input follows, so a final line needs no newline
+/// @param [in,out] line Number of the line at the start of buf, for errors
+/// @return Number of bytes consumed, or -1 if error(s)
+static ssize_t trace_play_text(struct trace_player * player, const char * buf, size_t len, int last, size_t * line) {
+    size_t pos = 0;
+    while (pos != len) {
+        const char * nl = memchr(buf + pos, '\n', len - pos);
+        if (!nl && !last) {
+            break;
+        }
+        size_t end = nl ? (size_t)(nl - buf) : len;
+
+        struct trace_sample sample;
+        int parsed = trace_parse_line(buf + pos, end - pos, &sample);
+        ++*line;
+        if (parsed < 0) {
+            fprintf(stderr, "Invalid sample on line %zu: %.*s\n", *line, (int)(end - pos), buf + pos);
+            return -1;
+        }
+
+        // Text samples are down while touching; an empty line lifts the contact
+        if (parsed) {
+            sample.flags |= player->target == TRACE_TOUCH ? TRACE_DOWN : 0;
+        } else {
+            sample.x = player->x;
+            sample.y = player->y;
+        }
+        if ((parsed || player->positioned) && trace_play(player, &sample)) {
+            return -1;
+        }
+        pos = nl ? end + 1 : len;
+    }
+    return (ssize_t)pos;
+}
+
+int trace_stream(int fd, enum trace_target target, int binary) {
+    char buf[TRACE_BUFFER];
+    size_t len = 0;
+    size_t line = 0;
+    struct trace_player player;
+    trace_player_init(&player, target);
+
+    for (;;) {
+        ssize_t n = read(fd, buf + len, sizeof(buf) - len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to read trace: %s\n", strerror(errno));
+            return 1;
+        }
+        len += (size_t)n;
+
+        size_t pos = 0;
+        if (binary) {
+            // Records are copied out, as the buffer doesn't keep them aligned
+            for (; len - pos >= sizeof(struct trace_sample); pos += sizeof(struct trace_sample)) {
+                struct trace_sample sample;
+                memcpy(&sample, buf + pos, sizeof(sample));
+                if (trace_play(&player, &sample)) {
+                    return 1;
+                }
+            }
+        } else {
+            ssize_t used = trace_play_text(&player, buf, len, !n, &line);
+            if (used < 0) {
+                return 1;
+            }
+            pos = (size_t)used;
+        }
+
+        if (!pos && len == sizeof(buf)) {
+            fprintf(stderr, "Trace line %zu is too long\n", line + 1);
+            return 1;
+        }
+        memmove(buf, buf + pos, len - pos);
+        len -= pos;
+        if (!n) {
+            break;
+        }
+    }
+
+    if (binary && len) {
+        fprintf(stderr, "Trace ends with a partial record\n");
+        return 1;
+    }
+    return trace_player_finish(&player);
+}
+
+void trace_accumulate(struct trace_sample * samples, size_t count, int to_positions) {
+    if (to_positions) {
+        for (size_t i = 1; i < count; ++i) {
+            samples[i].x += samples[i - 1].x;
+            samples[i].y += samples[i - 1].y;
+        }
+    } else {
+        for (size_t i = count; i-- > 1;) {
+            samples[i].x -= samples[i - 1].x;
+            samples[i].y -= samples[i - 1].y;
+        }
+    }
+}
+
+/// Check whether the contact goes down or up between two samples
+/// @param a The earlier sample
+/// @param b The later sample
+/// @return 1 if it does, 0 otherwise
+static int trace_transition(const struct trace_sample * a, const struct trace_sample * b) {
+    return ((a->flags ^ b->flags) & TRACE_DOWN) != 0;
+}
+
+int trace_resample(const struct trace_sample * in, size_t count, int64_t interval_us, struct trace_sample ** out, size_t * out_count) {
+    if (interval_us <= 0) {
+        return 1;
+    }
+    for (size_t i = 0; i != count; ++i) {
+        if (!(in[i].flags & TRACE_TIMED) || (i && in[i].t_us < in[i - 1].t_us)) {
+            fprintf(stderr, "Only traces timed throughout, in order of time, can be resampled\n");
+            return 1;
+        }
+    }
+
+    // Each stretch adds its two ends to the samples on the grid
+    int64_t span = count ? in[count - 1].t_us - in[0].t_us : 0;
+    if (span / interval_us + 1 > TRACE_MAX_SAMPLES - (int64_t)count * 2) {
+        fprintf(stderr, "Resampling the trace makes too many samples\n");
+        return 1;
+    }
+    struct trace_sample * samples = malloc(sizeof(*samples) * (size_t)(span / interval_us + 1 + (int64_t)count * 2));
+    if (!samples) {
+        fprintf(stderr, "Failed to allocate resampled trace\n");
+        return 1;
+    }
+
+    size_t n = 0;
+    for (size_t a = 0; a != count;) {
+        size_t b = a;
+        while (b + 1 != count && !trace_transition(&in[b], &in[b + 1])) {
+            ++b;
+        }
+
+        samples[n++] = in[a];
+        size_t j = a;
+        for (int64_t t = in[a].t_us + interval_us; t < in[b].t_us; t += interval_us) {
+            while (in[j + 1].t_us < t) {
+                ++j;
+            }
+            // in[j] is before t and in[j + 1] at or after it
+            double f = (double)(t - in[j].t_us) / (double)(in[j + 1].t_us - in[j].t_us);
+            struct trace_sample * sample = &samples[n++];
+            *sample = in[a];
+            sample->t_us = t;
+            sample->x = (int32_t)lround(in[j].x + f * (in[j + 1].x - in[j].x));
+            sample->y = (int32_t)lround(in[j].y + f * (in[j + 1].y - in[j].y));
+        }
+        if (b != a) {
+            samples[n++] = in[b];
+        }
+        a = b + 1;
+    }
+
+    *out = samples;
+    *out_count = n;
+    return 0;
+}
+
+/// Distance of a sample from the path between two others
+/// @details Where all three are timed, the path is taken at the sample's time, otherwise
+/// the nearest point of the line segment is used
+/// @param a Start of the path
+/// @param b End of the path
+/// @param p The sample
+/// @return Distance in pixels
+static double trace_error(const struct trace_sample * a, const struct trace_sample * b, const struct trace_sample * p) {
+    double dx = (double)b->x - a->x;
+    double dy = (double)b->y - a->y;
+    double f;
+    if ((a->flags & b->flags & p->flags & TRACE_TIMED) && b->t_us != a->t_us) {
+        f = (double)(p->t_us - a->t_us) / (double)(b->t_us - a->t_us);
+    } else {
+        double len2 = dx * dx + dy * dy;
+        f = len2 > 0.0 ? (((double)p->x - a->x) * dx + ((double)p->y - a->y) * dy) / len2 : 0.0;
+        f = f < 0.0 ? 0.0 : f > 1.0 ? 1.0 : f;
+    }
+    return hypot(a->x + f * dx - p->x, a->y + f * dy - p->y);
+}
+
+size_t trace_simplify(struct trace_sample * samples, size_t count, double epsilon, double * max_error) {
+    *max_error = 0.0;
+    if (count < 3) {
+        return count;
+    }
+
+    // Ranges still to look at are disjoint, so there are never more than samples
+    uint8_t * keep = calloc(count, sizeof(*keep));
+    size_t (* ranges)[2] = malloc(sizeof(*ranges) * count);
+    if (!keep || !ranges) {
+        free(keep);
+        free(ranges);
+        return 0;
+    }
+
+    keep[0] = keep[count - 1] = 1;
+    for (size_t i = 1; i != count; ++i) {
+        if (trace_transition(&samples[i - 1], &samples[i])) {
+            keep[i - 1] = keep[i] = 1;
+        }
+    }
+
+    // Between each pair of samples kept so far, keep the farthest from the path while too far
+    size_t a = 0;
+    for (size_t b = 1; b != count; ++b) {
+        if (!keep[b]) {
+            continue;
+        }
+        size_t top = 0;
+        ranges[top][0] = a;
+        ranges[top++][1] = b;
+        while (top) {
+            --top;
+            size_t lo = ranges[top][0];
+            size_t hi = ranges[top][1];
+            double worst = 0.0;
+            size_t at = lo;
+            for (size_t i = lo + 1; i < hi; ++i) {
+                double d = trace_error(&samples[lo], &samples[hi], &samples[i]);
+                if (d > worst) {
+                    worst = d;
+                    at = i;
+                }
+            }
+            if (worst > epsilon) {
+                keep[at] = 1;
+                ranges[top][0] = lo;
+                ranges[top++][1] = at;
+                ranges[top][0] = at;
+                ranges[top++][1] = hi;
+            } else if (worst > *max_error) {
+                *max_error = worst;
+            }
+        }
+        a = b;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i != count; ++i) {
+        if (keep[i]) {
+            samples[n++] = samples[i];
+        }
+    }
+    free(keep);
+    free(ranges);
+    return n;
+}
+
+/// Read a whole binary trace
+/// @param fd The file descriptor
+/// @param [out] samples The samples, to be freed
+/// @param [out] count Number of samples
+/// @return 0 on success, 1 if error(s)
+static int trace_read_all(int fd, struct trace_sample ** samples, size_t * count) {
+    char * buf = NULL;
+    size_t len = 0;
+    size_t size = 0;
+    for (;;) {
+        if (len == size) {
+            size = size ? size * 2 : TRACE_BUFFER;
+            char * grown = realloc(buf, size);
+            if (!grown) {
+                fprintf(stderr, "Failed to allocate trace\n");
+                free(buf);
+                return 1;
+            }
+            buf = grown;
+        }
+        ssize_t n = read(fd, buf + len, size - len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to read trace: %s\n", strerror(errno));
+            free(buf);
+            return 1;
+        }
+        if (!n) {
+            break;
+        }
+        len += (size_t)n;
+    }
+
+    if (len % sizeof(struct trace_sample)) {
+        fprintf(stderr, "Trace ends with a partial record\n");
+        free(buf);
+        return 1;
+    }
+    *samples = (struct trace_sample *)(void *)buf;
+    *count = len / sizeof(struct trace_sample);
+    return 0;
+}
+
+int trace_main(int argc, char ** argv) {
+    if (argc < 2 || strcmp(argv[1], "simplify")) {
+        fprintf(stderr, "%s", trace_usage);
+        return 1;
+    }
+    argc--;
+    argv++;
+
+    double epsilon = TRACE_EPSILON;
+    double interval_ms = 0.0;
+    int relative = 0;
+    const char * output = NULL;
+
+    enum optlist_t {
+        opt_help,
+        opt_epsilon,
+        opt_interval,
+        opt_relative,
+        opt_output,
+    };
+
+    static struct option long_options[] = {
+        {"help",     no_argument,       NULL, opt_help    },
+        {"epsilon",  required_argument, NULL, opt_epsilon },
+        {"interval", required_argument, NULL, opt_interval},
+        {"relative", no_argument,       NULL, opt_relative},
+        {"output",   required_argument, NULL, opt_output  },
+        {NULL,       0,                 NULL, 0           }
+    };
+
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case opt_epsilon:
+                epsilon = strtod(optarg, NULL);
+                break;
+            case opt_interval:
+                interval_ms = strtod(optarg, NULL);
+                break;
+            case opt_relative:
+                relative = 1;
+                break;
+            case opt_output:
+                output = optarg;
+                break;
+            default:
+                fprintf(stderr, "%s", trace_usage);
+                return 1;
+        }
+    }
+    if (argc - optind > 1 || !(epsilon >= 0.0) || !(interval_ms >= 0.0)) {
+        fprintf(stderr, "%s", trace_usage);
+        return 1;
+    }
+
+    int fd = STDIN_FILENO;
+    if (optind != argc && (fd = open(argv[optind], O_RDONLY | O_CLOEXEC)) == -1) {
+        fprintf(stderr, "Failed to open %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    struct trace_sample * samples;
+    size_t count;
+    int err = trace_read_all(fd, &samples, &count);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    if (err) {
+        return 1;
+    }
+    size_t original = count;
+
+    if (relative) {
+        trace_accumulate(samples, count, 1);
+    }
+    int64_t interval_us = (int64_t)(interval_ms * 1000.0);
+    if (interval_us) {
+        struct trace_sample * resampled;
+        err = trace_resample(samples, count, interval_us, &resampled, &count);
+        free(samples);
+        if (err) {
+            return 1;
+        }
+        samples = resampled;
+    }
+    double max_error;
+    size_t kept = trace_simplify(samples, count, epsilon, &max_error);
+    if (count && !kept) {
+        fprintf(stderr, "Failed to allocate simplification state\n");
+        free(samples);
+        return 1;
+    }
+    if (relative) {
+        trace_accumulate(samples, kept, 0);
+    }
+
+    FILE * f = output ? fopen(output, "wb") : stdout;
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", output, strerror(errno));
+        free(samples);
+        return 1;
+    }
+    err = fwrite(samples, sizeof(*samples), kept, f) != kept;
+    err |= output ? fclose(f) != 0 : fflush(f) != 0;
+    free(samples);
+    if (err) {
+        fprintf(stderr, "Failed to write trace: %s\n", strerror(errno));
+        return 1;
+    }
+
+    fprintf(stderr, "%zu samples -> %zu (%.1f:1), max error %.2fpx\n", original, kept,
+        kept ? (double)original / (double)kept : 0.0, max_error);
+    return 0;
+}
@@ -0,0 +1,160 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file trace.h
+/// @author Harry Austen
+/// @brief Interface for streaming pointer and touch traces
+/// @details A trace is a sequence of samples, each a position and whether the touch
+/// contact (or left button) is down, optionally with the time it is due. Traces are
+/// read either as text, one "x y [t]" line per sample with t in (fractional)
+/// milliseconds and an empty line lifting the contact, or as struct trace_sample records
+///
+/// Recorded traces can be reduced offline (ydotool trace simplify): resampled to a fixed
+/// interval, then simplified after Ramer-Douglas-Peucker, dropping every sample the path
+/// through the others passes within a pixel bound of. Samples where the contact goes down
+/// or up, and the ones just before them, are always kept
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+// System includes
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/// Size of the buffer input is read into
+#define TRACE_BUFFER 65536
+
+/// Default pixel error bound of simplification
+#define TRACE_EPSILON 1.0
+
+/// Sample flag: t_us holds the time the sample is due
+#define TRACE_TIMED 0x1
+
+/// Sample flag: the touch contact (or left button) is down
+#define TRACE_DOWN 0x2
+
+/// @brief Binary trace record, in native byte order
+struct trace_sample {
+    /// Microseconds, relative to any fixed point, if TRACE_TIMED
+    int64_t t_us;
+    /// Horizontal position, or movement when relative
+    int32_t x;
+    /// Vertical position, or movement when relative
+    int32_t y;
+    /// TRACE_TIMED and TRACE_DOWN
+    uint32_t flags;
+    /// Must be 0
+    uint32_t reserved;
+};
+
+/// @brief What a trace drives
+enum trace_target {
+    /// Absolute pointer position, left button
+    TRACE_MOUSE,
+    /// Relative pointer movement, left button
+    TRACE_MOUSE_RELATIVE,
+    /// Touchscreen position and contact
+    TRACE_TOUCH,
+};
+
+/// @brief State of a trace being played
+struct trace_player {
+    /// What the trace drives
+    enum trace_target target;
+    /// Set once a timed sample has been played
+    int timed;
+    /// Time of the first timed sample, in microseconds
+    int64_t t0;
+    /// When the first timed sample was played
+    struct timespec start;
+    /// Set once a position has been written
+    int positioned;
+    /// Last position written
+    int32_t x;
+    /// Last position written
+    int32_t y;
+    /// Set while the contact (or button) is down
+    int down;
+};
+
+/// @brief Parse a text sample
+/// @param line The line, without its newline
+/// @param len Length of the line
+/// @param [out] sample The sample, with TRACE_TIMED set if the line has a time
+/// @return 1 for a sample, 0 for an empty line, -1 if malformed
+int trace_parse_line(const char * line, size_t len, struct trace_sample * sample);
+
+/// @brief Start playing a trace
+/// @param [out] player The player
+/// @param target What the trace drives
+void trace_player_init(struct trace_player * player, enum trace_target target);
+
+/// @brief Write a sample as one frame, once it is due
+/// @details Samples without a time are written right away. Timed samples are written
+/// their time after the first timed sample was, or right away if that has passed.
+/// Only what changed is written; a sample changing nothing writes nothing
+/// @param player The player
+/// @param sample The sample
+/// @return 0 on success, 1 if error(s)
+int trace_play(struct trace_player * player, const struct trace_sample * sample);
+
+/// @brief Finish playing a trace, lifting the contact (or button) if down
+/// @param player The player
+/// @return 0 on success, 1 if error(s)
+int trace_player_finish(struct trace_player * player);
+
+/// @brief Play a trace from a file descriptor until its end
+/// @details Samples are played as they arrive, so the trace can come from a pipe.
+/// Nothing is allocated: input is parsed in place in a fixed buffer
+/// @param fd The file descriptor, e.g. stdin
+/// @param target What the trace drives
+/// @param binary 1 if the trace is struct trace_sample records, 0 if text
+/// @return 0 on success, 1 if error(s)
+int trace_stream(int fd, enum trace_target target, int binary);
+
+/// @brief Turn relative movements into positions, or back
+/// @param [in,out] samples The samples
+/// @param count Number of samples
+/// @param to_positions 1 to add the movements up into positions, 0 to turn positions into movements
+void trace_accumulate(struct trace_sample * samples, size_t count, int to_positions);
+
+/// @brief Resample a timed trace to a fixed interval
+/// @details Positions in between input samples are interpolated linearly. The samples
+/// where the contact goes down or up keep their times, and so do those just before
+/// them, as every stretch of the trace between them is resampled on its own
+/// @param in The samples, all timed, in order of time
+/// @param count Number of samples
+/// @param interval_us Microseconds between output samples
+/// @param [out] out The resampled samples, to be freed
+/// @param [out] out_count Number of resampled samples
+/// @return 0 on success, 1 if error(s)
+int trace_resample(const struct trace_sample * in, size_t count, int64_t interval_us, struct trace_sample ** out, size_t * out_count);
+
+/// @brief Simplify a trace in place, after Ramer-Douglas-Peucker
+/// @details A sample is dropped if it is within epsilon pixels of the straight line
+/// between the samples kept around it. Between timed samples, that is the position on the
+/// line at the sample's time, so a simplified trace moves at the same speed as the original
+/// @param [in,out] samples The samples, those kept moved to the front
+/// @param count Number of samples
+/// @param epsilon Pixel error bound
+/// @param [out] max_error Largest distance of a dropped sample from the path, in pixels
+/// @return Number of samples kept, 0 if out of memory
+size_t trace_simplify(struct trace_sample * samples, size_t count, double epsilon, double * max_error);
+
+/// @brief Run the trace tools, ydotool trace ...
+/// @param argc Number of arguments, from the tool's name
+/// @param argv Arguments, from the tool's name
+/// @return 0 on success, 1 if error(s)
+int trace_main(int argc, char ** argv);
+
+#endif // __TRACE_H__
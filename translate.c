@@ -0,0 +1,380 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file translate.c
+/// @author Harry Austen
+/// @brief Implementation of whole text translation, vectorised where possible
+
+// System includes
+#include <stdio.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Local includes
+#include "translate.h"
+#include "uinput.h"
+
+/// Set in a TABLE entry for a character typed with shift
+#define TRANSLATE_SHIFT 0x8000
+
+/// Keycode of each byte, with TRANSLATE_SHIFT if typed with shift, 0 if unsupported.
+/// Mirrors NORMAL_KEYS and SHIFTED_KEYS, which the tests check
+static const uint16_t TABLE[256] = {
+    ['\t'] = KEY_TAB,
+    ['\n'] = KEY_ENTER,
+    [' '] = KEY_SPACE,
+    ['!'] = KEY_1 | TRANSLATE_SHIFT,
+    ['"'] = KEY_2 | TRANSLATE_SHIFT,
+    ['#'] = KEY_BACKSLASH,
+    ['$'] = KEY_4 | TRANSLATE_SHIFT,
+    ['%'] = KEY_5 | TRANSLATE_SHIFT,
+    ['&'] = KEY_7 | TRANSLATE_SHIFT,
+    ['\''] = KEY_APOSTROPHE,
+    ['('] = KEY_9 | TRANSLATE_SHIFT,
+    [')'] = KEY_0 | TRANSLATE_SHIFT,
+    ['*'] = KEY_8 | TRANSLATE_SHIFT,
+    ['+'] = KEY_EQUAL | TRANSLATE_SHIFT,
+    [','] = KEY_COMMA,
+    ['-'] = KEY_MINUS,
+    ['.'] = KEY_DOT,
+    ['/'] = KEY_SLASH,
+    ['0'] = KEY_0,
+    ['1'] = KEY_1,
+    ['2'] = KEY_2,
+    ['3'] = KEY_3,
+    ['4'] = KEY_4,
+    ['5'] = KEY_5,
+    ['6'] = KEY_6,
+    ['7'] = KEY_7,
+    ['8'] = KEY_8,
+    ['9'] = KEY_9,
+    [':'] = KEY_SEMICOLON | TRANSLATE_SHIFT,
+    [';'] = KEY_SEMICOLON,
+    ['<'] = KEY_COMMA | TRANSLATE_SHIFT,
+    ['='] = KEY_EQUAL,
+    ['>'] = KEY_DOT | TRANSLATE_SHIFT,
+    ['?'] = KEY_SLASH | TRANSLATE_SHIFT,
+    ['@'] = KEY_APOSTROPHE | TRANSLATE_SHIFT,
+    ['A'] = KEY_A | TRANSLATE_SHIFT,
+    ['B'] = KEY_B | TRANSLATE_SHIFT,
+    ['C'] = KEY_C | TRANSLATE_SHIFT,
+    ['D'] = KEY_D | TRANSLATE_SHIFT,
+    ['E'] = KEY_E | TRANSLATE_SHIFT,
+    ['F'] = KEY_F | TRANSLATE_SHIFT,
+    ['G'] = KEY_G | TRANSLATE_SHIFT,
+    ['H'] = KEY_H | TRANSLATE_SHIFT,
+    ['I'] = KEY_I | TRANSLATE_SHIFT,
+    ['J'] = KEY_J | TRANSLATE_SHIFT,
+    ['K'] = KEY_K | TRANSLATE_SHIFT,
+    ['L'] = KEY_L | TRANSLATE_SHIFT,
+    ['M'] = KEY_M | TRANSLATE_SHIFT,
+    ['N'] = KEY_N | TRANSLATE_SHIFT,
+    ['O'] = KEY_O | TRANSLATE_SHIFT,
+    ['P'] = KEY_P | TRANSLATE_SHIFT,
+    ['Q'] = KEY_Q | TRANSLATE_SHIFT,
+    ['R'] = KEY_R | TRANSLATE_SHIFT,
+    ['S'] = KEY_S | TRANSLATE_SHIFT,
+    ['T'] = KEY_T | TRANSLATE_SHIFT,
+    ['U'] = KEY_U | TRANSLATE_SHIFT,
+    ['V'] = KEY_V | TRANSLATE_SHIFT,
+    ['W'] = KEY_W | TRANSLATE_SHIFT,
+    ['X'] = KEY_X | TRANSLATE_SHIFT,
+    ['Y'] = KEY_Y | TRANSLATE_SHIFT,
+    ['Z'] = KEY_Z | TRANSLATE_SHIFT,
+    ['['] = KEY_LEFTBRACE,
+    ['\\'] = KEY_102ND,
+    [']'] = KEY_RIGHTBRACE,
+    ['^'] = KEY_6 | TRANSLATE_SHIFT,
+    ['_'] = KEY_MINUS | TRANSLATE_SHIFT,
+    ['`'] = KEY_GRAVE,
+    ['a'] = KEY_A,
+    ['b'] = KEY_B,
+    ['c'] = KEY_C,
+    ['d'] = KEY_D,
+    ['e'] = KEY_E,
+    ['f'] = KEY_F,
+    ['g'] = KEY_G,
+    ['h'] = KEY_H,
+    ['i'] = KEY_I,
+    ['j'] = KEY_J,
+    ['k'] = KEY_K,
+    ['l'] = KEY_L,
+    ['m'] = KEY_M,
+    ['n'] = KEY_N,
+    ['o'] = KEY_O,
+    ['p'] = KEY_P,
+    ['q'] = KEY_Q,
+    ['r'] = KEY_R,
+    ['s'] = KEY_S,
+    ['t'] = KEY_T,
+    ['u'] = KEY_U,
+    ['v'] = KEY_V,
+    ['w'] = KEY_W,
+    ['x'] = KEY_X,
+    ['y'] = KEY_Y,
+    ['z'] = KEY_Z,
+    ['{'] = KEY_LEFTBRACE | TRANSLATE_SHIFT,
+    ['|'] = KEY_102ND | TRANSLATE_SHIFT,
+    ['}'] = KEY_RIGHTBRACE | TRANSLATE_SHIFT,
+    ['~'] = KEY_BACKSLASH | TRANSLATE_SHIFT,
+};
+
+/// Keycode of each byte alone, for the vector pass which has the shift flags already
+static const uint16_t CODES[256] = {
+    ['\t'] = KEY_TAB,
+    ['\n'] = KEY_ENTER,
+    [' '] = KEY_SPACE,
+    ['!'] = KEY_1,
+    ['"'] = KEY_2,
+    ['#'] = KEY_BACKSLASH,
+    ['$'] = KEY_4,
+    ['%'] = KEY_5,
+    ['&'] = KEY_7,
+    ['\''] = KEY_APOSTROPHE,
+    ['('] = KEY_9,
+    [')'] = KEY_0,
+    ['*'] = KEY_8,
+    ['+'] = KEY_EQUAL,
+    [','] = KEY_COMMA,
+    ['-'] = KEY_MINUS,
+    ['.'] = KEY_DOT,
+    ['/'] = KEY_SLASH,
+    ['0'] = KEY_0,
+    ['1'] = KEY_1,
+    ['2'] = KEY_2,
+    ['3'] = KEY_3,
+    ['4'] = KEY_4,
+    ['5'] = KEY_5,
+    ['6'] = KEY_6,
+    ['7'] = KEY_7,
+    ['8'] = KEY_8,
+    ['9'] = KEY_9,
+    [':'] = KEY_SEMICOLON,
+    [';'] = KEY_SEMICOLON,
+    ['<'] = KEY_COMMA,
+    ['='] = KEY_EQUAL,
+    ['>'] = KEY_DOT,
+    ['?'] = KEY_SLASH,
+    ['@'] = KEY_APOSTROPHE,
+    ['A'] = KEY_A,
+    ['B'] = KEY_B,
+    ['C'] = KEY_C,
+    ['D'] = KEY_D,
+    ['E'] = KEY_E,
+    ['F'] = KEY_F,
+    ['G'] = KEY_G,
+    ['H'] = KEY_H,
+    ['I'] = KEY_I,
+    ['J'] = KEY_J,
+    ['K'] = KEY_K,
+    ['L'] = KEY_L,
+    ['M'] = KEY_M,
+    ['N'] = KEY_N,
+    ['O'] = KEY_O,
+    ['P'] = KEY_P,
+    ['Q'] = KEY_Q,
+    ['R'] = KEY_R,
+    ['S'] = KEY_S,
+    ['T'] = KEY_T,
+    ['U'] = KEY_U,
+    ['V'] = KEY_V,
+    ['W'] = KEY_W,
+    ['X'] = KEY_X,
+    ['Y'] = KEY_Y,
+    ['Z'] = KEY_Z,
+    ['['] = KEY_LEFTBRACE,
+    ['\\'] = KEY_102ND,
+    [']'] = KEY_RIGHTBRACE,
+    ['^'] = KEY_6,
+    ['_'] = KEY_MINUS,
+    ['`'] = KEY_GRAVE,
+    ['a'] = KEY_A,
+    ['b'] = KEY_B,
+    ['c'] = KEY_C,
+    ['d'] = KEY_D,
+    ['e'] = KEY_E,
+    ['f'] = KEY_F,
+    ['g'] = KEY_G,
+    ['h'] = KEY_H,
+    ['i'] = KEY_I,
+    ['j'] = KEY_J,
+    ['k'] = KEY_K,
+    ['l'] = KEY_L,
+    ['m'] = KEY_M,
+    ['n'] = KEY_N,
+    ['o'] = KEY_O,
+    ['p'] = KEY_P,
+    ['q'] = KEY_Q,
+    ['r'] = KEY_R,
+    ['s'] = KEY_S,
+    ['t'] = KEY_T,
+    ['u'] = KEY_U,
+    ['v'] = KEY_V,
+    ['w'] = KEY_W,
+    ['x'] = KEY_X,
+    ['y'] = KEY_Y,
+    ['z'] = KEY_Z,
+    ['{'] = KEY_LEFTBRACE,
+    ['|'] = KEY_102ND,
+    ['}'] = KEY_RIGHTBRACE,
+    ['~'] = KEY_BACKSLASH,
+};
+
+size_t translate_text_scalar(const char * text, size_t len, uint16_t * codes, uint8_t * shifted) {
+    for (size_t i = 0; i != len; ++i) {
+        uint16_t entry = TABLE[(unsigned char)text[i]];
+        if (!entry) {
+            return i;
+        }
+        codes[i] = entry & (uint16_t)~TRANSLATE_SHIFT;
+        shifted[i] = (uint8_t)(entry >> 15);
+    }
+    return len;
+}
+
+#if defined(__SSE2__)
+
+/// Bytes of a block within a range, as signed bytes: everything supported is ASCII
+/// @param x The block
+/// @param lo First byte of the range
+/// @param hi Last byte of the range, below 0x7f
+/// @return 0xff for each byte in the range, 0 otherwise
+static inline __m128i translate_range(__m128i x, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8((char)(lo - 1))), _mm_cmplt_epi8(x, _mm_set1_epi8((char)(hi + 1))));
+}
+
+/// Classify a block of bytes, and store whether each needs shift
+/// @param text The block, TRANSLATE_BLOCK bytes
+/// @param [out] shifted 1 for each byte typed with shift, 0 otherwise
+/// @return 0 if all bytes are supported, 1 otherwise (shifted isn't written then)
+static inline int translate_block(const char * text, uint8_t * shifted) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(const void *)text);
+
+    // Control characters but tab and newline, DEL and everything past ASCII (negative)
+    __m128i control = _mm_andnot_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'))),
+        _mm_cmplt_epi8(x, _mm_set1_epi8(' ')));
+    __m128i bad = _mm_or_si128(control, _mm_cmpeq_epi8(x, _mm_set1_epi8(0x7f)));
+    if (_mm_movemask_epi8(bad)) {
+        return 1;
+    }
+
+    // The shifted characters of SHIFTED_KEYS, in runs of ASCII
+    __m128i shift = _mm_andnot_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('#')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\''))),
+        translate_range(x, '!', '+'));
+    shift = _mm_or_si128(shift, _mm_cmpeq_epi8(x, _mm_set1_epi8(':')));
+    shift = _mm_or_si128(shift, _mm_cmpeq_epi8(x, _mm_set1_epi8('<')));
+    shift = _mm_or_si128(shift, translate_range(x, '>', 'Z'));
+    shift = _mm_or_si128(shift, translate_range(x, '^', '_'));
+    shift = _mm_or_si128(shift, translate_range(x, '{', '~'));
+    _mm_storeu_si128((__m128i *)(void *)shifted, _mm_and_si128(shift, _mm_set1_epi8(1)));
+    return 0;
+}
+
+#elif defined(__ARM_NEON)
+
+/// Bytes of a block within a range
+/// @param x The block
+/// @param lo First byte of the range
+/// @param hi Last byte of the range
+/// @return 0xff for each byte in the range, 0 otherwise
+static inline uint8x16_t translate_range(uint8x16_t x, uint8_t lo, uint8_t hi) {
+    return vandq_u8(vcgeq_u8(x, vdupq_n_u8(lo)), vcleq_u8(x, vdupq_n_u8(hi)));
+}
+
+/// Classify a block of bytes, and store whether each needs shift
+/// @param text The block, TRANSLATE_BLOCK bytes
+/// @param [out] shifted 1 for each byte typed with shift, 0 otherwise
+/// @return 0 if all bytes are supported, 1 otherwise (shifted isn't written then)
+static inline int translate_block(const char * text, uint8_t * shifted) {
+    uint8x16_t x = vld1q_u8((const uint8_t *)text);
+
+    // Control characters but tab and newline, DEL and everything past ASCII
+    uint8x16_t control = vbicq_u8(vcltq_u8(x, vdupq_n_u8(' ')),
+        vorrq_u8(vceqq_u8(x, vdupq_n_u8('\t')), vceqq_u8(x, vdupq_n_u8('\n'))));
+    uint64x2_t bad = vreinterpretq_u64_u8(vorrq_u8(control, vcgeq_u8(x, vdupq_n_u8(0x7f))));
+    if (vgetq_lane_u64(bad, 0) | vgetq_lane_u64(bad, 1)) {
+        return 1;
+    }
+
+    // The shifted characters of SHIFTED_KEYS, in runs of ASCII
+    uint8x16_t shift = vbicq_u8(translate_range(x, '!', '+'),
+        vorrq_u8(vceqq_u8(x, vdupq_n_u8('#')), vceqq_u8(x, vdupq_n_u8('\''))));
+    shift = vorrq_u8(shift, vceqq_u8(x, vdupq_n_u8(':')));
+    shift = vorrq_u8(shift, vceqq_u8(x, vdupq_n_u8('<')));
+    shift = vorrq_u8(shift, translate_range(x, '>', 'Z'));
+    shift = vorrq_u8(shift, translate_range(x, '^', '_'));
+    shift = vorrq_u8(shift, translate_range(x, '{', '~'));
+    vst1q_u8(shifted, vandq_u8(shift, vdupq_n_u8(1)));
+    return 0;
+}
+
+#endif
+
+size_t translate_text_simd(const char * text, size_t len, uint16_t * codes, uint8_t * shifted) {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    size_t i = 0;
+    for (; len - i >= TRANSLATE_BLOCK; i += TRANSLATE_BLOCK) {
+        if (translate_block(text + i, shifted + i)) {
+            break;
+        }
+        // Every byte is known to be in the table now
+        for (size_t j = i; j != i + TRANSLATE_BLOCK; ++j) {
+            codes[j] = CODES[(unsigned char)text[j]];
+        }
+    }
+    return i;
+#else
+    (void)text;
+    (void)len;
+    (void)codes;
+    (void)shifted;
+    return 0;
+#endif
+}
+
+const char * translate_simd_name() {
+#if defined(__SSE2__)
+    return "SSE2";
+#elif defined(__ARM_NEON)
+    return "NEON";
+#else
+    return "none";
+#endif
+}
+
+int translate_text(const char * text, size_t len, uint16_t * codes, uint8_t * shifted) {
+    size_t done = translate_text_simd(text, len, codes, shifted);
+    done += translate_text_scalar(text + done, len - done, codes + done, shifted + done);
+    if (done == len) {
+        return 0;
+    }
+
+    // Report every unsupported character, not just the first
+    for (size_t i = done; i != len; ++i) {
+        unsigned char c = (unsigned char)text[i];
+        if (TABLE[c]) {
+            continue;
+        }
+        if (c >= ' ' && c < 0x7f) {
+            fprintf(stderr, "Failed to find key char %c at offset %zu!\n", c, i);
+        } else {
+            fprintf(stderr, "Failed to find key char 0x%02x at offset %zu!\n", c, i);
+        }
+    }
+    return 1;
+}
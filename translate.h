@@ -0,0 +1,61 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file translate.h
+/// @author Harry Austen
+/// @brief Interface for translating whole texts into keycodes
+/// @details Every byte is classified as plain, shifted or unsupported, 16 at a time with
+/// SSE2 or NEON where the target has them, and its keycode looked up in a constant table
+/// mirroring NORMAL_KEYS and SHIFTED_KEYS, in a single sweep over the text. The vector
+/// classification mirrors the layout of those tables, which the tests check byte by byte
+
+#ifndef __TRANSLATE_H__
+#define __TRANSLATE_H__
+
+// System includes
+#include <stddef.h>
+#include <stdint.h>
+
+/// Number of bytes classified at once by the vector pass
+#define TRANSLATE_BLOCK 16
+
+/// @brief Translate a text into the keycodes typing it, checking all of it first
+/// @details Every unsupported character is reported, and nothing is translated if there are any
+/// @param text The text
+/// @param len Number of bytes in text
+/// @param [out] codes The keycode of each byte
+/// @param [out] shifted 1 for each byte typed with shift, 0 otherwise
+/// @return 0 on success, 1 if text has unsupported characters
+int translate_text(const char * text, size_t len, uint16_t * codes, uint8_t * shifted);
+
+/// @brief Translate a text a byte at a time, as translate_text() does without SIMD
+/// @param text The text
+/// @param len Number of bytes in text
+/// @param [out] codes The keycode of each byte
+/// @param [out] shifted 1 for each byte typed with shift, 0 otherwise
+/// @return Number of bytes translated: len on success, or the offset of the first unsupported one
+size_t translate_text_scalar(const char * text, size_t len, uint16_t * codes, uint8_t * shifted);
+
+/// @brief Translate a text with the vector pass, where the target has one
+/// @param text The text
+/// @param len Number of bytes in text
+/// @param [out] codes The keycode of each byte
+/// @param [out] shifted 1 for each byte typed with shift, 0 otherwise
+/// @return Number of bytes translated: len on success, or at most the offset of the first
+/// unsupported one (the block holding it is left to the scalar path)
+size_t translate_text_simd(const char * text, size_t len, uint16_t * codes, uint8_t * shifted);
+
+/// @brief Name the vector instructions translate_text_simd() uses
+/// @return "SSE2", "NEON" or "none"
+const char * translate_simd_name();
+
+#endif // __TRANSLATE_H__
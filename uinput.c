@@ -15,6 +15,9 @@
 /// @brief Implementation of functions for emulating input events
 /// @todo Implement time delay inputs
 
+// For splice
+#define _GNU_SOURCE
+
 // System includes
 #include <errno.h>
 #include <stdlib.h>
@@ -22,19 +25,46 @@
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
 #include <sys/utsname.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 // Local includes
+#include "log.h"
 #include "uinput.h"
+#include "ydotoold.h"
 
 /// Wrapper macro for errno error check
-#define CHECK(X) if (X == -1) { fprintf( stderr, "ERROR (%s:%d) -- %s\n", __FILE__, __LINE__, strerror(errno) ); return 1; }
+#define CHECK(X) if (X == -1) { log_error("ERROR (%s:%d) -- %s\n", __FILE__, __LINE__, strerror(errno)); return 1; }
 
 /// Total number of keycodes that can be entered
-#define NUM_KEYCODES 91
+#define NUM_KEYCODES 97
+
+/// Maximum number of events in a single frame sent by uinput_send_frame
+#define MAX_FRAME_EVENTS 16
+
+/// Number of times a write stalled by a full device queue is retried before the frame is dropped
+#define WRITE_RETRIES 8
+
+/// Milliseconds to wait for the device queue to drain before each retry
+#define WRITE_RETRY_MS 10
+
+/// Number of buffers written per writev
+#define WRITE_IOV_MAX 64
+
+/// Milliseconds to wait for a spawned ydotoold to take connections
+#define SPAWN_CONNECT_MS 2000
+
+/// Total number of relative axes that can be sent
+#define NUM_RELCODES 6
 
 /// Total number of event codes that can be sent
 #define NUM_EVCODES 4
@@ -44,6 +74,18 @@ struct uinput_user_dev uidev;
 /// uinput file descriptor
 static int FD = -1;
 
+/// 1 if FD is a socket connected to ydotoold rather than the uinput device
+static int FD_IS_SOCKET = 0;
+
+/// 1 if FD is the null device, see uinput_create_null()
+static int FD_IS_NULL = 0;
+
+/// Microseconds slept after each frame written to the device, -1 until read from the config file
+static int64_t PACE_US = -1;
+
+/// Write and backpressure counters, updated atomically
+static struct uinput_stats STATS;
+
 /// All valid keycodes
 static const int KEYCODES[NUM_KEYCODES] = {
     BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5,
@@ -58,7 +100,13 @@ static const int KEYCODES[NUM_KEYCODES] = {
     KEY_RIGHT, KEY_CAPSLOCK, KEY_NUMLOCK, KEY_SCROLLLOCK, KEY_ESC,
     KEY_BACKSPACE, KEY_DELETE, KEY_INSERT, KEY_HOME, KEY_END,
     KEY_PAGEUP, KEY_PAGEDOWN, KEY_SYSRQ, KEY_PAUSE, KEY_F1, KEY_F2, KEY_F3,
-    KEY_F4, KEY_F5, KEY_F6, KEY_F7, KEY_F8, KEY_F9, KEY_F10,  KEY_F11, KEY_F12
+    KEY_F4, KEY_F5, KEY_F6, KEY_F7, KEY_F8, KEY_F9, KEY_F10,  KEY_F11, KEY_F12,
+    KEY_BACK, KEY_HOMEPAGE, KEY_MENU, KEY_POWER, KEY_VOLUMEUP, KEY_VOLUMEDOWN
+};
+
+/// All relative axes
+static const int RELCODES[NUM_RELCODES] = {
+    REL_X, REL_Y, REL_WHEEL, REL_HWHEEL, REL_WHEEL_HI_RES, REL_HWHEEL_HI_RES
 };
 
 /// All valid event codes
@@ -240,8 +288,8 @@ const struct key_string FUNCTION_KEYS[] = {
 /// @return 0 on success, 1 if error(s)
 int uinput_binary_search_string(const struct key_string * arr, size_t len, const char * str, uint16_t * code) {
     size_t lo = 0;
-    size_t hi = len-1;
-    while (lo <= hi) {
+    size_t hi = len;
+    while (lo < hi) {
         // Calculate middle element index
         size_t mid = (hi + lo)/2;
 
@@ -256,7 +304,7 @@ int uinput_binary_search_string(const struct key_string * arr, size_t len, const
             lo = mid + 1;
         // If middle element greater than target string, remove upper half
         } else {
-            hi = mid - 1;
+            hi = mid;
         }
     }
 
@@ -272,8 +320,8 @@ int uinput_binary_search_string(const struct key_string * arr, size_t len, const
 /// @return 0 on success, 1 if error(s)
 int uinput_binary_search_char(const struct key_char * arr, size_t len, char c, uint16_t * code) {
     size_t lo = 0;
-    size_t hi = len-1;
-    while (lo <= hi) {
+    size_t hi = len;
+    while (lo < hi) {
         // Calculate middle element index
         size_t mid = (hi + lo)/2;
 
@@ -288,7 +336,7 @@ int uinput_binary_search_char(const struct key_char * arr, size_t len, char c, u
             lo = mid + 1;
         // If middle element greater than target char, remove upper half
         } else {
-            hi = mid - 1;
+            hi = mid;
         }
     }
 
@@ -296,27 +344,175 @@ int uinput_binary_search_char(const struct key_char * arr, size_t len, char c, u
     return 1;
 }
 
-/// Create socket to talk to ydotool daemon
-/// @return 0 on succes, 1 if error(s)
-int uinput_connect_socket() {
-    const char * path_socket = "/tmp/.ydotool_socket";
-    FD = socket(AF_UNIX, SOCK_STREAM, 0);
-
+/// Connect FD to the ydotool daemon socket
+/// @return 0 on success, 1 if error(s) with errno set
+static int uinput_socket_open() {
+    FD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (FD == -1) {
-        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
         return 1;
     }
 
     struct sockaddr_un addr;
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, path_socket, sizeof(addr.sun_path)-1);
+    strncpy(addr.sun_path, YDOTOOLD_SOCKET_PATH, sizeof(addr.sun_path)-1);
 
     if (connect(FD, (struct sockaddr *)&addr, sizeof(addr))) {
+        int err = errno;
+        close(FD);
+        FD = -1;
+        errno = err;
+        return 1;
+    }
+
+    FD_IS_SOCKET = 1;
+    return 0;
+}
+
+// Create socket to talk to ydotool daemon
+int uinput_connect_socket() {
+    if (uinput_socket_open()) {
         fprintf(stderr, "Failed to connect to socket: %s\n", strerror(errno));
         return 1;
     }
+    return 0;
+}
+
+/// Start ydotoold in the background, to exit once it has been idle for YDOTOOLD_SPAWN_IDLE_MS
+/// @return 0 once ydotoold has been executed, 1 if error(s)
+static int uinput_spawn_daemon() {
+    // Closed by a successful exec, otherwise carries its errno back
+    int status[2];
+    CHECK( pipe(status) );
+    fcntl(status[0], F_SETFD, FD_CLOEXEC);
+    fcntl(status[1], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Leave the session and get reparented, so the daemon outlives this client and its terminal
+        setsid();
+        if (fork() == 0) {
+            int null = open("/dev/null", O_RDWR);
+            for (int fd = 0; fd != 3; ++fd) {
+                dup2(null, fd);
+            }
+            for (int fd = 3; fd != 1024; ++fd) {
+                if (fd != status[1]) {
+                    close(fd);
+                }
+            }
+
+            char idle[16];
+            snprintf(idle, sizeof(idle), "%u", YDOTOOLD_SPAWN_IDLE_MS);
+            execlp("ydotoold", "ydotoold", "--idle-timeout", idle, (char *)NULL);
+            int err = errno;
+            if (write(status[1], &err, sizeof(err))) {
+            }
+        }
+        _exit(0);
+    }
+    close(status[1]);
+    if (pid == -1) {
+        fprintf(stderr, "Failed to start ydotoold: %s\n", strerror(errno));
+        close(status[0]);
+        return 1;
+    }
+    waitpid(pid, NULL, 0);
+
+    int err = 0;
+    ssize_t n = read(status[0], &err, sizeof(err));
+    close(status[0]);
+    if (n == sizeof(err)) {
+        fprintf(stderr, "Failed to start ydotoold: %s\n", strerror(err));
+        return 1;
+    }
+    return 0;
+}
+
+/// Connect to ydotoold, starting it first if it isn't running
+/// @details YDOTOOLD_LOCK_PATH is held shared while connecting, so an idle daemon can't
+/// exit in between, and exclusively while spawning, so concurrent clients start one daemon
+/// @return 0 on success, 1 if error(s)
+static int uinput_connect_spawn() {
+    // flock() only needs the file open for reading, so whoever created it, everyone can
+    // take it. It lives in /tmp: never follow a symlink planted there, or change its mode
+    int lock = open(YDOTOOLD_LOCK_PATH, O_RDONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+    CHECK( lock );
+
+    int ret = 0;
+    if (flock(lock, LOCK_SH)) {
+        ret = 1;
+    } else if (uinput_socket_open()) {
+        // Someone else may have started it while we waited for the lock
+        if (flock(lock, LOCK_EX)) {
+            ret = 1;
+        } else if (uinput_socket_open()) {
+            ret = uinput_spawn_daemon();
+
+            // It listens before creating its device, so this is quick
+            for (int i = 0; !ret && uinput_socket_open(); ++i) {
+                if (i == SPAWN_CONNECT_MS) {
+                    fprintf(stderr, "ydotoold didn't come up: %s\n", strerror(errno));
+                    ret = 1;
+                }
+                usleep(1000);
+            }
+        }
+    }
+    close(lock);
+    return ret;
+}
+
+// Send a control request to ydotoold and wait for its answer
+int uinput_request(uint16_t request, const void * payload, int32_t len, void * reply, size_t reply_len, int32_t * result) {
+    if (FD == -1 && uinput_connect_socket()) {
+        fprintf(stderr, "This command needs ydotoold to be running\n");
+        return 1;
+    }
+    if (!FD_IS_SOCKET) {
+        fprintf(stderr, "This command needs ydotoold, but the device is already open directly\n");
+        return 1;
+    }
+
+    struct input_event ie;
+    memset(&ie, 0, sizeof(ie));
+    ie.type = YDOTOOLD_CTL;
+    ie.code = request;
+    ie.value = len;
+
+    // Header and payload go out in a single write
+    struct iovec iov[2] = {
+        { &ie, sizeof(ie) },
+        { (void *)payload, (size_t)len }
+    };
+    CHECK( writev(FD, iov, 2) );
+
+    if (recv(FD, &ie, sizeof(ie), MSG_WAITALL) != sizeof(ie) || ie.type != YDOTOOLD_CTL || ie.code != request) {
+        fprintf(stderr, "No valid answer from ydotoold\n");
+        return 1;
+    }
+
+    // Requests answering with data send that many bytes after the answer
+    if (reply && ie.value > 0) {
+        char discard[256];
+        size_t remaining = (size_t)ie.value;
+        while (remaining) {
+            char * dst = reply_len ? (char *)reply : discard;
+            size_t n = reply_len ? reply_len : sizeof(discard);
+            n = n < remaining ? n : remaining;
+            if (recv(FD, dst, n, MSG_WAITALL) != (ssize_t)n) {
+                fprintf(stderr, "Truncated answer from ydotoold\n");
+                return 1;
+            }
+            if (reply_len) {
+                reply = dst + n;
+                reply_len -= n;
+            }
+            remaining -= n;
+        }
+    }
 
+    *result = ie.value;
     return 0;
 }
 
@@ -325,14 +521,105 @@ int uinput_connect_socket() {
         exit(EXIT_FAILURE); \
     } while(0)
 
+// Discard all events instead of creating a device
+int uinput_create_null() {
+    FD = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    CHECK( FD );
+    FD_IS_NULL = 1;
+    return 0;
+}
+
+// Wait until everything sent so far has been written to the device
+int uinput_sync() {
+    if (!FD_IS_SOCKET) {
+        return 0;
+    }
+
+    int32_t result = 0;
+    if (uinput_request(YDOTOOLD_CTL_SYNC, NULL, 0, NULL, 0, &result) || result < 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// Leave whatever is held down so far held after disconnecting from ydotoold
+int uinput_keep() {
+    if (!FD_IS_SOCKET) {
+        return 0;
+    }
+
+    int32_t result = 0;
+    if (uinput_request(YDOTOOLD_CTL_KEEP, NULL, 0, NULL, 0, &result) || result < 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// Have ydotoold release whatever is held down so far after a while
+int uinput_hold(uint32_t hold_ms) {
+    if (!FD_IS_SOCKET) {
+        return 1;
+    }
+
+    int32_t result = 0;
+    if (uinput_request(YDOTOOLD_CTL_HOLD, &hold_ms, sizeof(hold_ms), NULL, 0, &result) || result < 0) {
+        return 1;
+    }
+    return 0;
+}
+
 // Initialise the input device
+int uinput_raw() {
+    if (FD == -1) {
+        if (uinput_init()) {
+            return 1;
+        }
+    }
+    if (!FD_IS_SOCKET) {
+        return 0;
+    }
+
+    int32_t result = 0;
+    if (uinput_request(YDOTOOLD_CTL_RAW, NULL, 0, NULL, 0, &result) || result < 0) {
+        fprintf(stderr, "ydotoold doesn't take raw input events\n");
+        return 1;
+    }
+    return 0;
+}
+
+ssize_t uinput_splice(int fd, size_t len) {
+    if (!FD_IS_SOCKET) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ssize_t n;
+    do {
+        n = splice(fd, NULL, FD, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
 int uinput_init() {
-    // Attempt to connect to ydotoold backend if running
-    if (!uinput_connect_socket()) {
-        printf("Using ydotoold backend\n");
+    // Attempt to connect to ydotoold backend if running, or start it if asked to
+    const char * spawn = getenv(YDOTOOLD_SPAWN_ENV);
+    if (spawn && !strcmp(spawn, "1") ? !uinput_connect_spawn() : !uinput_connect_socket()) {
+        log_info("Using ydotoold backend\n");
         return 0;
     }
 
+    if (uinput_create_device()) {
+        return 1;
+    }
+
+    // Wait for device to come up
+    usleep(1000000);
+
+    return 0;
+}
+
+// Create the virtual input device
+int uinput_create_device() {
     // Check write access to uinput driver device
     if (access("/dev/uinput", W_OK)) {
         fprintf(stderr, "Do not have access to write to /dev/uinput!\n"
@@ -390,17 +677,23 @@ int uinput_init() {
 	        die("error: ioctl");
     	if(ioctl(FD, UI_SET_KEYBIT, KEY_LEFTMETA) < 0)
 	        die("error: ioctl");
+    // Keyboard keys for the type/key commands (mouse buttons are left out so
+    // the device is still classified as a touchscreen)
+    for (int i = 0; i != NUM_KEYCODES; ++i) {
+        if (KEYCODES[i] < BTN_MISC && ioctl(FD, UI_SET_KEYBIT, KEYCODES[i]) < 0)
+            die("error: ioctl");
+    }
 //    	if(ioctl(fd, UI_SET_KEYBIT, BTN_LEFT) < 0)
    	if(ioctl(FD, UI_SET_KEYBIT, BTN_TOUCH) < 0)
  	      die("error: ioctl");
 
-	// for mouse
-//    	if(ioctl(FD, UI_SET_EVBIT, EV_REL) < 0)
-//        	die("error: ioctl");
-//    	if(ioctl(FD, UI_SET_RELBIT, REL_X) < 0)
-//        	die("error: ioctl");
-//    	if(ioctl(FD, UI_SET_RELBIT, REL_Y) < 0)
-//        	die("error: ioctl");
+    // Relative pointer and wheels, including hi-res scrolling
+    if(ioctl(FD, UI_SET_EVBIT, EV_REL) < 0)
+        die("error: ioctl");
+    for (int i = 0; i != NUM_RELCODES; ++i) {
+        if(ioctl(FD, UI_SET_RELBIT, RELCODES[i]) < 0)
+            die("error: ioctl");
+    }
 
     	if(ioctl(FD, UI_SET_EVBIT, EV_ABS) < 0)
         	die("error: ioctl");
@@ -429,19 +722,92 @@ int uinput_init() {
     	if(ioctl(FD, UI_DEV_CREATE) < 0)
         	die("error: ioctl");
 
+    return 0;
+}
 
-    // Wait for device to come up
-    usleep(1000000);
+// Find the evdev node of the virtual input device
+int uinput_event_node(char * name, size_t len, char * dev, size_t dev_len) {
+    char sysname[64];
+    char path[PATH_MAX];
+
+    if (FD == -1 || FD_IS_SOCKET || FD_IS_NULL) {
+        return 1;
+    }
+    if (ioctl(FD, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+        fprintf(stderr, "Failed to get device name: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // Device number of the event node, e.g. 13:67
+    dev[0] = '\0';
+    snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+    DIR * dir = opendir(path);
+    if (dir) {
+        struct dirent * ent;
+        while ((ent = readdir(dir))) {
+            if (!strncmp(ent->d_name, "event", 5)) {
+                snprintf(name, len, "/dev/input/%s", ent->d_name);
+                snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s/%s/dev", sysname, ent->d_name);
+                FILE * f = fopen(path, "r");
+                if (f) {
+                    if (!fgets(dev, (int)dev_len, f)) {
+                        dev[0] = '\0';
+                    }
+                    dev[strcspn(dev, "\n")] = '\0';
+                    fclose(f);
+                }
+                break;
+            }
+        }
+        closedir(dir);
+    }
+    if (!dev[0]) {
+        fprintf(stderr, "Failed to find event node of %s\n", sysname);
+        return 1;
+    }
+    return 0;
+}
+
+// Wait until udev has set up the device node for the virtual device
+int uinput_wait_device(uint32_t timeout_ms) {
+    char name[PATH_MAX];
+    char path[PATH_MAX];
+    char dev[32];
+
+    if (FD_IS_NULL) {
+        return 0;
+    }
+    if (uinput_event_node(name, sizeof(name), dev, sizeof(dev))) {
+        return 1;
+    }
 
+    // udev records each device it has finished processing. Without udev there
+    // is nothing more to wait for once the kernel has created the node
+    struct stat stats;
+    if (stat("/run/udev/data", &stats) || !S_ISDIR(stats.st_mode)) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "/run/udev/data/c%s", dev);
+    for (uint32_t waited = 0; stat(path, &stats); waited += 5) {
+        if (waited >= timeout_ms) {
+            fprintf(stderr, "Timed out waiting for udev to set up %s\n", name);
+            return 1;
+        }
+        usleep(5000);
+    }
     return 0;
 }
 
 // Delete the input device
 int uinput_destroy() {
     if (FD != -1) {
-        ioctl(FD, UI_DEV_DESTROY);
+        if (!FD_IS_SOCKET && !FD_IS_NULL) {
+            ioctl(FD, UI_DEV_DESTROY);
+        }
         close(FD);
         FD = -1;
+        FD_IS_SOCKET = 0;
+        FD_IS_NULL = 0;
     }
     return 0;
 }
@@ -522,6 +888,141 @@ int uinput_enter_char(char c) {
     return 1;
 }
 
+/// Allow processing time for uinput before sending the next frame (the null device needs none)
+static void uinput_pace() {
+    if (!FD_IS_NULL) {
+        uint32_t us = uinput_get_pace();
+        if (us) {
+            usleep(us);
+        }
+    }
+}
+
+const char * uinput_config_path() {
+    const char * path = getenv(UINPUT_CONFIG_ENV);
+    return path && path[0] ? path : UINPUT_CONFIG_PATH;
+}
+
+uint32_t uinput_get_pace() {
+    if (PACE_US >= 0) {
+        return (uint32_t)PACE_US;
+    }
+
+    // Lines of key=value, # starts a comment
+    PACE_US = UINPUT_PACE_US;
+    FILE * f = fopen(uinput_config_path(), "r");
+    if (f) {
+        char line[128];
+        unsigned long us;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, " pace_us = %lu", &us) == 1 && us <= 1000000) {
+                PACE_US = (int64_t)us;
+            }
+        }
+        fclose(f);
+    }
+    return (uint32_t)PACE_US;
+}
+
+void uinput_set_pace(uint32_t us) {
+    PACE_US = us;
+}
+
+int uinput_save_pace(const char * path, uint32_t us) {
+    FILE * f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fprintf(f, "# Written by ydotool calibrate\n"
+        "# Microseconds to wait after each frame written to the device\n");
+    if (us) {
+        fprintf(f, "# At most %.0f frames/s\n", 1e6 / us);
+    }
+    fprintf(f, "pace_us=%u\n", us);
+    if (fclose(f)) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/// Write buffers of whole events, waiting for the device queue to drain when it's full
+/// @details Whatever hasn't been written yet is retried a bounded number of
+/// times, so a frame is either written whole or counted as dropped
+/// @param [in,out] iov The buffers, advanced past whatever has been written
+/// @param iovcnt Number of buffers
+/// @return 0 on success, 1 if error(s)
+static int uinput_write_iov(struct iovec * iov, int iovcnt) {
+    int retries = 0;
+
+    while (iovcnt) {
+        ssize_t n = writev(FD, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN && retries++ != WRITE_RETRIES) {
+                __atomic_fetch_add(&STATS.stalls, 1, __ATOMIC_RELAXED);
+                struct pollfd pfd = { FD, POLLOUT, 0 };
+                poll(&pfd, 1, WRITE_RETRY_MS);
+                continue;
+            }
+            __atomic_fetch_add(&STATS.drops, 1, __ATOMIC_RELAXED);
+            log_error("ERROR (%s:%d) -- %s\n", __FILE__, __LINE__, strerror(errno));
+            return 1;
+        }
+
+        // Skip past whatever was written
+        size_t written = (size_t)n;
+        __atomic_fetch_add(&STATS.events, written / sizeof(struct input_event), __ATOMIC_RELAXED);
+        while (iovcnt && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    __atomic_fetch_add(&STATS.frames, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/// Write a buffer of whole events, see uinput_write_iov()
+/// @param events The events
+/// @param count Number of events
+/// @return 0 on success, 1 if error(s)
+static int uinput_write(const struct input_event * events, size_t count) {
+    struct iovec iov[2] = {
+        { (void *)events, sizeof(*events) * count },
+        { NULL, 0 }
+    };
+    struct input_event syn;
+
+    // Stamp the SYN_REPORT ending a frame sent to ydotoold with the send time, see ydotoold.h
+    if (FD_IS_SOCKET && count && events[count - 1].type == EV_SYN && events[count - 1].code == SYN_REPORT) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        syn = events[count - 1];
+        syn.input_event_sec = now.tv_sec;
+        syn.input_event_usec = now.tv_nsec;
+        iov[0].iov_len -= sizeof(syn);
+        iov[1].iov_base = &syn;
+        iov[1].iov_len = sizeof(syn);
+    }
+    return uinput_write_iov(iov, 2);
+}
+
+void uinput_get_stats(struct uinput_stats * stats) {
+    stats->frames = __atomic_load_n(&STATS.frames, __ATOMIC_RELAXED);
+    stats->events = __atomic_load_n(&STATS.events, __ATOMIC_RELAXED);
+    stats->stalls = __atomic_load_n(&STATS.stalls, __ATOMIC_RELAXED);
+    stats->drops = __atomic_load_n(&STATS.drops, __ATOMIC_RELAXED);
+}
+
 // Trigger an input event
 int uinput_emit(uint16_t type, uint16_t code, int32_t value) {
     struct input_event ie = {
@@ -538,10 +1039,11 @@ int uinput_emit(uint16_t type, uint16_t code, int32_t value) {
         }
     }
 
-    CHECK( write(FD, &ie, sizeof(ie)) );
+    if (uinput_write(&ie, 1)) {
+        return 1;
+    }
 
-    // Allow processing time for uinput before sending next event
-    usleep( 50 );
+    uinput_pace();
 
     return 0;
 }
@@ -575,6 +1077,104 @@ int uinput_send_shifted_keypress(uint16_t code) {
     return 0;
 }
 
+// Write a group of events terminated by a single SYN_REPORT
+int uinput_send_frame(const struct input_event * events, size_t count) {
+    struct input_event frame[MAX_FRAME_EVENTS + 1];
+
+    if (count > MAX_FRAME_EVENTS) {
+        fprintf(stderr, "Frame of %zu events exceeds maximum of %d\n", count, MAX_FRAME_EVENTS);
+        return 1;
+    }
+
+    if (FD == -1) {
+        if (uinput_init()) {
+            return 1;
+        }
+    }
+
+    memcpy(frame, events, sizeof(*events) * count);
+    memset(&frame[count], 0, sizeof(frame[count]));
+    frame[count].type = EV_SYN;
+    frame[count].code = SYN_REPORT;
+
+    // One write per frame so the whole frame reaches the device together
+    if (uinput_write(frame, count + 1)) {
+        return 1;
+    }
+
+    uinput_pace();
+
+    return 0;
+}
+
+// Write prebuilt buffers of events in a single system call
+int uinput_send_iov(const struct iovec * iov, int iovcnt) {
+    if (FD == -1) {
+        if (uinput_init()) {
+            return 1;
+        }
+    }
+
+    // Buffers are advanced as they're written, so work on a copy
+    struct iovec batch[WRITE_IOV_MAX];
+    for (int i = 0; i < iovcnt; i += WRITE_IOV_MAX) {
+        int n = iovcnt - i < WRITE_IOV_MAX ? iovcnt - i : WRITE_IOV_MAX;
+        memcpy(batch, iov + i, sizeof(*iov) * (size_t)n);
+        if (uinput_write_iov(batch, n)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Write a sequence of complete frames, one write per frame
+int uinput_send_raw(const struct input_event * events, size_t count) {
+    if (FD == -1) {
+        if (uinput_init()) {
+            return 1;
+        }
+    }
+
+    // Left unstamped: in raw mode ydotoold takes no send times
+    if (FD_IS_SOCKET) {
+        struct iovec iov = { (void *)events, sizeof(*events) * count };
+        return uinput_send_iov(&iov, 1);
+    }
+    return uinput_send_frames(events, count);
+}
+
+int uinput_send_frames(const struct input_event * events, size_t count) {
+    if (FD == -1) {
+        if (uinput_init()) {
+            return 1;
+        }
+    }
+
+    size_t start = 0;
+    for (size_t i = 0; i != count; ++i) {
+        if (events[i].type != EV_SYN || events[i].code != SYN_REPORT) {
+            continue;
+        }
+
+        if (uinput_write(events + start, i + 1 - start)) {
+            return 1;
+        }
+        start = i + 1;
+
+        uinput_pace();
+    }
+
+    // Anything after the last SYN_REPORT is sent as is
+    if (start != count) {
+        if (uinput_write(events + start, count - start)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 // Move the cursor to a given (x,y) position
 int uinput_move_mouse(int32_t x, int32_t y) {
     if (uinput_emit(EV_ABS, ABS_X, x)
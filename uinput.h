@@ -18,7 +18,9 @@
 #define __UINPUT_H__
 
 // System includes
+#include <stddef.h>
 #include <stdint.h>
+#include <sys/uio.h>
 #include <linux/uinput.h>
 
 /// Number of normal keys
@@ -29,6 +31,19 @@
 #define NUM_MODIFIER_KEYS 15
 /// Number of function keys
 #define NUM_FUNCTION_KEYS 31
+/// Maximum number of keys compiled typing may hold down at once
+#define UINPUT_MAX_OVERLAP 8
+/// Maximum number of keys in a single key sequence (e.g. CTRL+ALT+DELETE)
+#define UINPUT_MAX_CHORD 8
+
+/// Config file holding the pacing of writes to the device, see uinput_get_pace()
+#define UINPUT_CONFIG_PATH "/etc/ydotool.conf"
+
+/// Environment variable naming a config file to use instead of UINPUT_CONFIG_PATH
+#define UINPUT_CONFIG_ENV "YDOTOOL_CONFIG"
+
+/// Microseconds slept after each frame written to the device when the config file doesn't say
+#define UINPUT_PACE_US 50
 
 /// @brief uinput event information
 struct uinput_raw_data {
@@ -40,6 +55,18 @@ struct uinput_raw_data {
     int32_t value;
 };
 
+/// @brief Counters of writes to the device (or daemon socket)
+struct uinput_stats {
+    /// Number of writes completed, each a frame or a batch of frames
+    uint64_t frames;
+    /// Number of events written
+    uint64_t events;
+    /// Number of times a write found the device queue full and had to wait
+    uint64_t stalls;
+    /// Number of writes given up on, after retrying or on error
+    uint64_t drops;
+};
+
 /// @brief Represents a single keyboard character
 /// @details Used to convert between the char and the integer keycode
 struct key_char {
@@ -74,6 +101,104 @@ extern const struct key_string FUNCTION_KEYS[NUM_FUNCTION_KEYS];
 /// @return 0 on success, 1 if error(s)
 int uinput_init();
 
+/// @brief Create the virtual input device, without trying ydotoold first
+/// @details The device may not be usable until udev has set it up, see uinput_wait_device()
+/// @return 0 on success, 1 if error(s)
+int uinput_create_device();
+
+/// @brief Discard all events instead of creating a virtual input device
+/// @details For measuring the rest of the pipeline without /dev/uinput. Writes
+/// aren't paced, as nothing has to process them
+/// @return 0 on success, 1 if error(s)
+int uinput_create_null();
+
+/// @brief Find the evdev node of the virtual input device
+/// @param [out] name Path of the node, e.g. /dev/input/event5
+/// @param len Size of name
+/// @param [out] dev Device number of the node, e.g. 13:69
+/// @param dev_len Size of dev
+/// @return 0 on success, 1 if error(s) or the device isn't a uinput device
+int uinput_event_node(char * name, size_t len, char * dev, size_t dev_len);
+
+/// @brief Wait until udev has finished setting up the virtual input device
+/// @param timeout_ms Maximum number of milliseconds to wait
+/// @return 0 once the device is set up, 1 on timeout or error(s)
+int uinput_wait_device(uint32_t timeout_ms);
+
+/// @brief Connect to the ydotool daemon socket
+/// @return 0 on success, 1 if error(s)
+int uinput_connect_socket();
+
+/// @brief Send a control request to the ydotool daemon and wait for its answer
+/// @param request The request (enum ydotoold_ctl)
+/// @param payload The request payload
+/// @param len Number of bytes of payload
+/// @param [out] reply Buffer for data sent with the answer, or NULL if none is expected
+/// @param reply_len Size of reply. Any further data is discarded
+/// @param [out] result The result returned by the daemon (negative errno on failure, number of bytes of data otherwise if reply is set)
+/// @return 0 on success, 1 if error(s)
+int uinput_request(uint16_t request, const void * payload, int32_t len, void * reply, size_t reply_len, int32_t * result);
+
+/// @brief Wait until every event sent so far has been written to the device
+/// @details Events written to the device directly are there already. Through
+/// ydotoold, this waits for the daemon to drain this client's queue
+/// @return 0 on success, 1 if error(s)
+int uinput_sync();
+
+/// @brief Leave the keys, buttons and touch contacts held down so far down after disconnecting
+/// @details ydotoold otherwise releases them when this client disconnects. Until then
+/// (or without ydotoold) this does nothing
+/// @return 0 on success, 1 if error(s)
+int uinput_keep();
+
+/// @brief Have ydotoold release the keys, buttons and touch contacts held down so far after a while
+/// @details The release is scheduled by ydotoold, so it happens even once this client
+/// has disconnected
+/// @param hold_ms Number of milliseconds to hold them for
+/// @return 0 if ydotoold will release them, 1 if error(s) or not connected to ydotoold
+int uinput_hold(uint32_t hold_ms);
+
+/// @brief Announce that only complete frames read from elsewhere follow, see uinput_send_raw()
+/// @details Through ydotoold, this switches the connection to raw input events
+/// (YDOTOOLD_CTL_RAW), after which no other request can be made on it
+/// @return 0 on success, 1 if error(s)
+int uinput_raw();
+
+/// @brief Send frames read from elsewhere, such as an evdev node, after uinput_raw()
+/// @details Through ydotoold the batch goes in a single write, and the daemon splits and
+/// paces the frames. A device is written frame by frame, as by uinput_send_frames()
+/// @param events The events, each frame terminated by a SYN_REPORT
+/// @param count Number of events
+/// @return 0 on success, 1 if error(s)
+int uinput_send_raw(const struct input_event * events, size_t count);
+
+/// @brief Move raw input events from a pipe to ydotoold without copying them, after uinput_raw()
+/// @param fd The read end of the pipe
+/// @param len Maximum number of bytes to move
+/// @return Number of bytes moved, 0 at the end of input, or -1 with errno set if error(s).
+/// errno is EINVAL if events can't be spliced, e.g. because there is no ydotoold
+ssize_t uinput_splice(int fd, size_t len);
+
+/// @brief Get the path of the config file, UINPUT_CONFIG_ENV if set, UINPUT_CONFIG_PATH otherwise
+/// @return The path
+const char * uinput_config_path();
+
+/// @brief Get the time slept after each frame written to the device
+/// @details Read from the config file (written by ydotool calibrate) on first use,
+/// UINPUT_PACE_US if it has none
+/// @return Microseconds
+uint32_t uinput_get_pace();
+
+/// @brief Set the time slept after each frame written to the device, instead of the config file's
+/// @param us Microseconds, 0 not to sleep
+void uinput_set_pace(uint32_t us);
+
+/// @brief Write the time slept after each frame to a config file
+/// @param path Path of the config file
+/// @param us Microseconds
+/// @return 0 on success, 1 if error(s)
+int uinput_save_pace(const char * path, uint32_t us);
+
 /// @brief Close uinput device if open
 /// @return 0 on success, 1 if error(s)
 int uinput_destroy();
@@ -90,6 +215,10 @@ int uinput_enter_char(char c);
 /// @return 0 on success, 1 if error(s)
 int uinput_emit(uint16_t type, uint16_t code, int32_t value);
 
+/// @brief Get the write and backpressure counters of this process
+/// @param [out] stats The counters
+void uinput_get_stats(struct uinput_stats * stats);
+
 /// @brief Emulate a single key event for the given string representation of a key
 /// @param key_string Character array representing the key to be pressed/released
 /// @param value 1 for press, 0 for release
@@ -126,6 +255,24 @@ int uinput_send_keypress(uint16_t code);
 /// @return 0 on success, 1 if error(s)
 int uinput_send_shifted_keypress(uint16_t code);
 
+/// @brief Send a group of events as a single frame, followed by one SYN_REPORT
+/// @param events The events making up the frame (without the trailing SYN_REPORT)
+/// @param count Number of events in the frame
+/// @return 0 on success, 1 if error(s)
+int uinput_send_frame(const struct input_event * events, size_t count);
+
+/// @brief Write prebuilt buffers of events to the device in a single system call
+/// @param iov The buffers, each holding whole input events
+/// @param iovcnt Number of buffers
+/// @return 0 on success, 1 if error(s)
+int uinput_send_iov(const struct iovec * iov, int iovcnt);
+
+/// @brief Send a sequence of complete frames, such as a compiled program
+/// @param events The events, each frame terminated by a SYN_REPORT
+/// @param count Number of events
+/// @return 0 on success, 1 if error(s)
+int uinput_send_frames(const struct input_event * events, size_t count);
+
 /// @brief Move the mouse to a given x and y pixel position
 /// @param x Horizontal pixel position
 /// @param y Vertical pixel position
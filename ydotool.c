@@ -16,19 +16,35 @@
 
 // System includes
 #include <errno.h>
+#include <fnmatch.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 // Local includes
+#include "adbinput.h"
+#include "calibrate.h"
+#include "gamepad.h"
+#include "log.h"
+#include "pointer.h"
+#include "program.h"
+#include "raw.h"
+#include "trace.h"
 #include "uinput.h"
+#include "ydotool.h"
+#include "ydotoold.h"
 
 /// @brief Click command usage string
-static const char * click_usage =
+static const char click_usage[] =
     "Usage: click [--delay <ms>] <button>\n"
     "    --help      Show this help\n"
     "    --delay ms  Delay time before start clicking (default = 100ms)\n"
@@ -37,7 +53,7 @@ static const char * click_usage =
     "                3: middle\n";
 
 /// @brief Key command usage string
-static const char * key_usage =
+static const char key_usage[] =
     "Usage: key [--delay <ms>] [--key-delay <ms>] [--repeat <times>] [--repeat-delay <ms>] <key sequence> ...\n"
     "    --help             Show this help\n"
     "    --delay ms         Delay time before start pressing keys (default = 100ms)\n"
@@ -46,20 +62,97 @@ static const char * key_usage =
     "    --repeat-delay ms  Delay time between repetitions (default = 0ms)\n"
     "Each key sequence can be any number of modifiers and keys, separated by plus (+)\nFor example: alt+r Alt+F4 CTRL+alt+f3 aLT+1+2+3 ctrl+Backspace\n";
 
+/// @brief Keydown/keyup command usage string
+static const char key_press_usage[] =
+    "Usage: keydown|keyup [--delay <ms>] <key sequence> ...\n"
+    "    --help      Show this help\n"
+    "    --delay ms  Delay time before sending the keys (default = 100ms)\n"
+    "Presses (keydown) or releases (keyup) the keys of each sequence in a single frame, leaving them\n"
+    "that way. Keys stay down between commands while ydotoold is running. For example: keydown SHIFT\n";
+
+/// @brief Hold command usage string
+static const char key_hold_usage[] =
+    "Usage: hold [--delay <ms>] <hold ms> <key sequence> ...\n"
+    "    --help      Show this help\n"
+    "    --delay ms  Delay time before pressing the keys (default = 100ms)\n"
+    "Presses the keys of each sequence, holds them for the given time and releases them in reverse\n"
+    "order. While ydotoold is running it schedules the release and hold returns at once, otherwise\n"
+    "hold waits and releases them itself\n";
+
+/// @brief Macro command usage string
+static const char macro_usage[] =
+    "Usage: macro define <name> <step> [\\; <step>] ...\n"
+    "       macro run [--repeats <times>] <name|id>\n"
+    "    --help             Show this help\n"
+    "    --repeats times    Times to run the macro back to back\n"
+    "Macros are compiled once by ydotoold and run with a single request. Each step is one of:\n"
+    "    key <key sequence> ...   keydown <key sequence> ...   keyup <key sequence> ...\n"
+    "    type <text> ...   click <button>   mouse <x> <y>   tap <x> <y>\n"
+    "For example: macro define screenshot key SUPER+s; macro define tap100 tap 100 100 \\; click 1\n";
+
 /// @brief Mouse command usage string
-static const char * mouse_usage =
-    "Usage: mouse [--delay <ms>] <x> <y>\n"
+static const char mouse_usage[] =
+    "Usage: mouse [--delay <ms>] [--relative [--duration <ms>] [--rate <hz>] [--ease]] <x> <y>\n"
+    "       mouse [--delay <ms>] [--relative] --stream [--binary]\n"
+    "    --help         Show this help\n"
+    "    --delay ms     Delay time before start moving (default = 100ms)\n"
+    "    --relative     Move by x/y pixels instead of to an absolute position\n"
+    "    --duration ms  Spread a relative move over this long (default = 0ms, a single report)\n"
+    "    --rate hz      Report rate of a spread move, 125 to 1000 (default = 1000Hz)\n"
+    "    --ease         Accelerate and decelerate instead of moving at constant speed\n"
+    "    --stream       Move along \"x y [t]\" lines read from stdin, each at its time t in\n"
+    "                   milliseconds, or right away without one\n"
+    "    --binary       Read struct trace_sample records instead of lines (see trace.h)\n";
+
+/// @brief Raw command usage string
+static const char raw_usage[] =
+    "Usage: raw [--delay <ms>]\n"
     "    --help      Show this help\n"
-    "    --delay ms  Delay time before start moving (default = 100ms)\n";
+    "    --delay ms  Delay time before start sending (default = 100ms)\n"
+    "Passes native struct input_event records read from stdin, such as from an evdev node,\n"
+    "through to the device. Each frame must end with a SYN_REPORT\n";
+
+/// @brief Scroll command usage string
+static const char scroll_usage[] =
+    "Usage: scroll [--delay <ms>] [--duration <ms>] [--rate <hz>] [--ease] <vertical> [<horizontal>]\n"
+    "    --help         Show this help\n"
+    "    --delay ms     Delay time before start scrolling (default = 100ms)\n"
+    "    --duration ms  Spread the scrolling over this long (default = 0ms, a single report)\n"
+    "    --rate hz      Report rate, 125 to 1000 (default = 1000Hz)\n"
+    "    --ease         Accelerate and decelerate instead of scrolling at constant speed\n"
+    "Amounts are in wheel detents and may be fractional. Positive scrolls up/right\n";
+
+/// @brief Screenshot command usage string
+static const char screenshot_usage[] =
+    "Usage: screenshot [--wait <dir> [--pattern <glob>] [--timeout <ms>]]\n"
+    "    --help          Show this help\n"
+    "    --wait dir      Wait for the compositor to write a new file to dir and print its path\n"
+    "    --pattern glob  Only wait for a file whose name matches glob (default = wayland*)\n"
+    "    --timeout ms    Maximum time to wait for the file (default = 5000ms)\n";
+
+/// @brief Stats command usage string
+static const char stats_usage[] =
+    "Usage: stats [clients]\n"
+    "    --help  Show this help\n"
+    "Shows the counters of the running ydotoold, or of each client connected to it\n";
 
 /// @brief Touch tap command usage string
-static const char * touch_tap_usage =
+static const char touch_tap_usage[] =
     "Usage: touch [--delay <ms>] <x> <y>\n"
     "    --help      Show this help\n"
     "    --delay ms  Delay time before start moving (default = 100ms)\n";
 
+/// @brief Touch stream command usage string
+static const char touch_stream_usage[] =
+    "Usage: touch [--delay <ms>] --stream [--binary]\n"
+    "    --help      Show this help\n"
+    "    --delay ms  Delay time before start moving (default = 100ms)\n"
+    "    --stream    Touch along \"x y [t]\" lines read from stdin, each at its time t in\n"
+    "                milliseconds, or right away without one. An empty line lifts the contact\n"
+    "    --binary    Read struct trace_sample records instead of lines (see trace.h)\n";
+
 /// @brief Touch swipe command usage string
-static const char * touch_swipe_usage =
+static const char touch_swipe_usage[] =
     "Usage: touch [--delay <ms>] <startx> <starty> <endx> <endy> <time>\n"
     "    --help      Show this help\n"
     "    --delay ms  Delay time before start moving (default = 100ms)\n";
@@ -67,11 +160,16 @@ static const char * touch_swipe_usage =
 
 
 /// @brief Type command usage string
-static const char * type_usage =
-    "Usage: type [--delay milliseconds] [--key-delay milliseconds] [--args N] [--file <filepath>] <things to type>\n"
+static const char type_usage[] =
+    "Usage: type [--delay milliseconds] [--key-delay milliseconds] [--overlap N] [--capslock N] [--dump] [--args N] [--file <filepath>] <things to type>\n"
     "    --help                    Show this help\n"
     "    --delay milliseconds      Delay time before start typing\n"
     "    --key-delay milliseconds  Delay time between keystrokes (default = 12ms)\n"
+    "    --overlap N               Fast typing: hold up to N keys down at once, pressing the next key\n"
+    "                              before releasing the previous one (default = 1, no overlap, max = 8)\n"
+    "    --capslock N              Use CapsLock instead of shift for spans of at least N uppercase letters,\n"
+    "                              where that takes fewer events (default = 0, never). Assumes CapsLock is off\n"
+    "    --dump                    Print the compiled event stream and its event count instead of typing\n"
     "    --file filepath           Specify a file, the contents of which will be be typed as if passed as an argument. The filepath may also be '-' to read from stdin\n";
 
 /// @brief Print usage string to stderr
@@ -115,22 +213,60 @@ int click_run(uint16_t button, uint32_t time_delay) {
 /// @brief Press all keys, then release all keys
 /// @param[in] key_string Sequence of string representations of keys to be pressed together, separated by '+'
 /// @return 0 on success, 1 if error(s)
-int key_enter_keys(char * key_string) {
-    char * ptr = strtok(key_string, "+");
-    while (ptr) {
-        if (uinput_enter_key(ptr, 1)) {
-            return 1;
-        }
-        ptr = strtok(NULL, "+");
+int key_enter_keys(const char * key_string) {
+    struct program prog;
+    program_init(&prog);
+
+    // One frame pressing every key, one releasing them in reverse order
+    int ret = program_compile_chord(&prog, key_string) || uinput_send_frames(prog.events, prog.count);
+    program_free(&prog);
+    return ret;
+}
+
+/// @brief Press or release key sequences, leaving them that way
+/// @param[in] value 1 to press the keys, 0 to release them
+/// @param[in] time_delay Number of milliseconds to wait before sending the keys
+/// @param[in] argc Number of key sequences
+/// @param[in] argv The key sequences
+/// @return 0 on success, 1 if error(s)
+int key_press_run(int32_t value, uint32_t time_delay, int argc, char ** argv) {
+    struct program prog;
+    program_init(&prog);
+
+    // Release in the reverse order of pressing
+    int ret = 0;
+    for (int i = 0; i != argc && !ret; ++i) {
+        ret = program_compile_keys(&prog, argv[value ? i : argc - 1 - i], value);
     }
-    ptr = strtok(key_string, "+");
-    while (ptr) {
-        if (uinput_enter_key(ptr, 0)) {
-            return 1;
-        }
-        ptr = strtok(NULL, "+");
+
+    if (!ret) {
+        usleep(time_delay * 1000);
+        ret = uinput_send_frames(prog.events, prog.count);
     }
-    return 0;
+    program_free(&prog);
+    return ret;
+}
+
+/// @brief Hold key sequences down for a while, then release them
+/// @details Through ydotoold the release is left to it, so this doesn't wait
+/// @param[in] hold_ms Number of milliseconds to hold the keys
+/// @param[in] time_delay Number of milliseconds to wait before pressing the keys
+/// @param[in] argc Number of key sequences
+/// @param[in] argv The key sequences
+/// @return 0 on success, 1 if error(s)
+int key_hold_run(uint32_t hold_ms, uint32_t time_delay, int argc, char ** argv) {
+    if (key_press_run(1, time_delay, argc, argv)) {
+        return 1;
+    }
+    if (!uinput_hold(hold_ms)) {
+        return 0;
+    }
+
+    struct timespec hold = { (time_t)(hold_ms / 1000), (long)(hold_ms % 1000) * 1000000 };
+    while (nanosleep(&hold, &hold) && errno == EINTR) {
+    }
+
+    return key_press_run(0, 0, argc, argv);
 }
 
 /// @brief Emulate entering any number of given sequences of keys
@@ -154,6 +290,148 @@ int key_run(uint32_t time_delay, uint64_t repeats, int argc, char ** argv) {
 	return 0;
 }
 
+/// @brief Register a named macro with ydotoold
+/// @param[in] name Name of the macro
+/// @param[in] argc Number of words making up the macro steps
+/// @param[in] argv The words making up the macro steps
+/// @return 0 on success, 1 if error(s)
+int macro_define(const char * name, int argc, char ** argv) {
+    char payload[YDOTOOLD_MAX_PAYLOAD];
+    size_t len = 0;
+
+    if (strlen(name) >= YDOTOOLD_MACRO_NAME_LEN) {
+        fprintf(stderr, "Macro name %s is too long\n", name);
+        return 1;
+    }
+
+    // Name and words, each null terminated
+    for (int i = -1; i != argc; ++i) {
+        const char * word = i < 0 ? name : argv[i];
+        size_t size = strlen(word) + 1;
+        if (len + size > sizeof(payload)) {
+            fprintf(stderr, "Macro %s is too long\n", name);
+            return 1;
+        }
+        memcpy(payload + len, word, size);
+        len += size;
+    }
+
+    int32_t id = 0;
+    if (uinput_request(YDOTOOLD_CTL_MACRO_DEFINE, payload, (int32_t)len, NULL, 0, &id)) {
+        return 1;
+    }
+    if (id < 0) {
+        fprintf(stderr, "ydotoold failed to define macro %s: %s\n", name, strerror(-id));
+        return 1;
+    }
+
+    printf("%d\n", id);
+    return 0;
+}
+
+/// @brief Run a macro previously registered with ydotoold
+/// @param[in] macro Name or id of the macro
+/// @param[in] repeats Number of times to run the macro
+/// @return 0 on success, 1 if error(s)
+int macro_run(const char * macro, uint64_t repeats) {
+    struct ydotoold_macro_run run;
+    memset(&run, 0, sizeof(run));
+
+    char * end = NULL;
+    run.id = (int32_t)strtol(macro, &end, 10);
+    if (end == macro || *end) {
+        run.id = -1;
+        strncpy(run.name, macro, sizeof(run.name) - 1);
+    }
+    run.repeats = (uint32_t)repeats;
+
+    int32_t result = 0;
+    if (uinput_request(YDOTOOLD_CTL_MACRO_RUN, &run, sizeof(run), NULL, 0, &result)) {
+        return 1;
+    }
+    if (result < 0) {
+        fprintf(stderr, "ydotoold failed to run macro %s: %s\n", macro, strerror(-result));
+        return 1;
+    }
+    return 0;
+}
+
+/// @brief Print the counters of the running ydotoold
+/// @return 0 on success, 1 if error(s)
+int stats_run() {
+    struct ydotoold_stats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    int32_t result = 0;
+    if (uinput_request(YDOTOOLD_CTL_STATS, NULL, 0, &stats, sizeof(stats), &result)) {
+        return 1;
+    }
+    if (result < 0) {
+        fprintf(stderr, "ydotoold failed to get counters: %s\n", strerror(-result));
+        return 1;
+    }
+
+    printf("clients     %" PRIu64 "\n"
+        "frames      %" PRIu64 "\n"
+        "queued      %" PRIu64 "\n"
+        "queue_full  %" PRIu64 "\n"
+        "writes      %" PRIu64 "\n"
+        "events      %" PRIu64 "\n"
+        "stalls      %" PRIu64 "\n"
+        "drops       %" PRIu64 "\n"
+        "coalesced   %" PRIu64 "\n"
+        "redundant   %" PRIu64 "\n"
+        "released    %" PRIu64 "\n"
+        "cancelled   %" PRIu64 "\n",
+        stats.clients, stats.frames, stats.queued, stats.queue_full,
+        stats.writes, stats.events, stats.stalls, stats.drops, stats.coalesced,
+        stats.redundant, stats.released, stats.cancelled);
+    return 0;
+}
+
+/// @brief Print the counters of each client connected to the running ydotoold
+/// @return 0 on success, 1 if error(s)
+int stats_clients_run() {
+    static struct ydotoold_client_stats clients[YDOTOOLD_MAX_CLIENTS];
+
+    int32_t result = 0;
+    if (uinput_request(YDOTOOLD_CTL_CLIENTS, NULL, 0, clients, sizeof(clients), &result)) {
+        return 1;
+    }
+    if (result < 0) {
+        fprintf(stderr, "ydotoold failed to get client counters: %s\n", strerror(-result));
+        return 1;
+    }
+
+    // The connection asking is among them
+    size_t count = (size_t)result / sizeof(*clients);
+    count = count < YDOTOOLD_MAX_CLIENTS ? count : YDOTOOLD_MAX_CLIENTS;
+    printf("%8s %8s %6s %6s %8s %10s %12s %6s %9s %12s %11s %11s\n", "id", "pid", "uid", "weight", "rate",
+        "frames", "events", "queued", "throttled", "throttled_ms", "avg_wait_us", "max_wait_us");
+    for (size_t i = 0; i != count; ++i) {
+        const struct ydotoold_client_stats * c = &clients[i];
+        printf("%8u %8u %6u %6u %8u %10" PRIu64 " %12" PRIu64 " %6" PRIu64 " %9" PRIu64 " %12.1f %11.1f %11.1f\n", c->id, c->pid, c->uid, c->weight, c->rate,
+            c->frames, c->events, c->queued, c->throttled, (double)c->throttled_ns / 1e6,
+            c->frames ? (double)c->wait_ns / (double)c->frames / 1e3 : 0.0, (double)c->max_wait_ns / 1e3);
+    }
+    return 0;
+}
+
+/// @brief Ask the running ydotoold to dump its flight recorder
+/// @return 0 on success, 1 if error(s)
+int recorder_run() {
+    int32_t result = 0;
+    if (uinput_request(YDOTOOLD_CTL_RECORDER_DUMP, NULL, 0, NULL, 0, &result)) {
+        return 1;
+    }
+    if (result < 0) {
+        fprintf(stderr, "ydotoold failed to dump flight recorder: %s\n", strerror(-result));
+        return 1;
+    }
+    printf("%d records dumped\n", result);
+    return 0;
+}
+
 int screenshot(void) {
         if (uinput_enter_key("SUPER", 1)) {
             return 1;
@@ -170,6 +448,63 @@ int screenshot(void) {
         }
 	return 0;
 }
+
+/// @brief Take a screenshot and wait for the compositor to write it out
+/// @details The directory is watched before the keys are sent, so a capture
+/// finishing quickly isn't missed. Files renamed into place count as written, but only
+/// those whose name matches the pattern, so other files written to dir are ignored
+/// @param[in] dir Directory the compositor writes screenshots to
+/// @param[in] pattern Shell glob the name of the screenshot file matches, e.g. wayland*
+/// @param[in] timeout_ms Milliseconds to wait for the file
+/// @return 0 once the path of the new file has been printed, 1 on timeout or error(s)
+int screenshot_wait(const char * dir, const char * pattern, uint32_t timeout_ms) {
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd == -1 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        fprintf(stderr, "ydotool: screenshot: failed to watch %s: %s\n", dir, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    if (screenshot()) {
+        close(fd);
+        return 1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t deadline = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000 + timeout_ms;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t remaining = deadline - ((int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int rc = remaining > 0 ? poll(&pfd, 1, remaining < INT_MAX ? (int)remaining : INT_MAX) : 0;
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            fprintf(stderr, "ydotool: screenshot: no file written to %s within %ums\n", dir, timeout_ms);
+            close(fd);
+            return 1;
+        }
+
+        ssize_t len = read(fd, buf, sizeof(buf));
+        for (ssize_t i = 0; i < len; ) {
+            const struct inotify_event * ev = (const struct inotify_event *)(buf + i);
+            if (ev->len && !fnmatch(pattern, ev->name, FNM_PERIOD)) {
+                size_t dir_len = strlen(dir);
+                printf("%s%s%s\n", dir, dir_len && dir[dir_len - 1] == '/' ? "" : "/", ev->name);
+                close(fd);
+                return 0;
+            }
+            i += (ssize_t)(sizeof(*ev) + ev->len);
+        }
+    }
+}
+
 /// @brief  positioning absolutely by the given x/y coordinates
 /// @param[in] x Horizontal pixel position
 /// @param[in] y Vertical pixel position
@@ -209,13 +544,14 @@ int touch_swipe_run(int32_t startx, int32_t starty, int32_t endx, int32_t endy,
 /// @param[in] y Vertical pixel position
 /// @param[in] time_delay Milliseconds to wait before moving mouse
 /// @param[in] relative true if movement is to be relative to current mouse position
+/// @param[in] motion How a relative movement is spread over time
 /// @return 0 on success, 1 if error(s)
-int mouse_run(int32_t x, int32_t y, uint32_t time_delay, bool relative) {
+int mouse_run(int32_t x, int32_t y, uint32_t time_delay, bool relative, const struct pointer_motion * motion) {
     // Sleep time_delay milliseconds
     usleep(time_delay * 1000);
 
 	if (relative) {
-        if (uinput_relative_move_mouse(x, y)) {
+        if (pointer_move(x, y, motion)) {
             return 1;
         }
 	} else {
@@ -227,23 +563,51 @@ int mouse_run(int32_t x, int32_t y, uint32_t time_delay, bool relative) {
 	return 0;
 }
 
-/// @brief Enter characters in input string one at a time
+/// @brief Scroll the mouse wheels
+/// @param[in] vertical Wheel detents to scroll vertically, positive is up
+/// @param[in] horizontal Wheel detents to scroll horizontally, positive is right
+/// @param[in] time_delay Milliseconds to wait before scrolling
+/// @param[in] motion How the scrolling is spread over time
+/// @return 0 on success, 1 if error(s)
+int scroll_run(double vertical, double horizontal, uint32_t time_delay, const struct pointer_motion * motion) {
+    // Sleep time_delay milliseconds
+    usleep(time_delay * 1000);
+
+    return pointer_scroll(vertical, horizontal, motion);
+}
+
+/// @brief Compile the input string into a minimal sequence of key events and send it
 /// @param[in] text Array of characters to be entered
+/// @param[in] opts Options for compiling the text
 /// @return 0 on success, >0 if errors
-int type_text(char * text) {
-	for (size_t i = 0; text[i] != '\0'; ++i) {
-        if (uinput_enter_char(text[i])) {
-            return 1;
-        }
-	}
-    return 0;
+int type_text(char * text, const struct type_options * opts) {
+    struct program prog;
+    program_init(&prog);
+
+    if (program_compile_text(&prog, text, &opts->compile)) {
+        program_free(&prog);
+        return 1;
+    }
+
+    int ret = 0;
+    if (opts->dump) {
+        program_dump(stdout, &prog);
+        printf("%zu events in %zu frames (naive: %zu events)\n",
+            prog.count, prog.frames, program_naive_text_events(text));
+    } else {
+        ret = uinput_send_frames(prog.events, prog.count);
+    }
+
+    program_free(&prog);
+    return ret;
 }
 
 /// @brief Type the given text using a virtual keyboard device
 /// @param[in] argc The number of strings to type
 /// @param[in] argv Pointer to the strings
+/// @param[in] opts Options for compiling the text
 /// @return 0 on success, 1 on error(s)
-int type_args(int argc, char ** argv) {
+int type_args(int argc, char ** argv, const struct type_options * opts) {
     // Sum length of args
     size_t len = 0;
     for (int i = 0; i != argc; ++i) {
@@ -263,7 +627,7 @@ int type_args(int argc, char ** argv) {
     }
 
     // Emulate keyboard input of buffer characters
-    if (type_text(buf)) {
+    if (type_text(buf, opts)) {
         return 1;
     }
 
@@ -274,11 +638,12 @@ int type_args(int argc, char ** argv) {
 }
 
 /// @brief Type the given text using a virtual keyboard device
+/// @param[in] opts Options for compiling the text
 /// @return 0 on success, 1 on error(s)
-int type_stdin() {
+int type_stdin(const struct type_options * opts) {
     // Allocate buffer for reading in chunks and text for holding full input
     char * buf = malloc(sizeof(char) * 10);
-    char * text = malloc(sizeof(char));
+    char * text = calloc(1, sizeof(char));
 
     // Read up to 10 chars at a time from stdin
     while (fgets(buf, 10, stdin)) {
@@ -308,7 +673,7 @@ int type_stdin() {
     free(buf);
 
     // Call uinput to type the text
-    if (type_text(text)) {
+    if (type_text(text, opts)) {
         return 1;
     }
 
@@ -320,8 +685,9 @@ int type_stdin() {
 
 /// @brief Type the given text using a virtual keyboard device
 /// @param[in] file_path The path to the file containing the text to write
+/// @param[in] opts Options for compiling the text
 /// @return 0 on success, 1 on error(s)
-int type_file(char * file_path) {
+int type_file(char * file_path, const struct type_options * opts) {
     // Open file_path file in read only mode
     FILE * fd = fopen(file_path, "r");
 
@@ -349,8 +715,8 @@ int type_file(char * file_path) {
     char * buf = malloc(sizeof(char) * len_with_null);
 
     // Extract text from file and pass to uinput to type
-    fgets(buf, (int)len_with_null, fd);
-    if (type_text(buf)) {
+    buf[fread(buf, sizeof(char), (size_t)len, fd)] = '\0';
+    if (type_text(buf, opts)) {
         // Free up buffer memory
         free(buf);
 
@@ -383,9 +749,21 @@ int usage_main(char * prog) {
     fprintf(stderr,
         "Usage: %s cmd [opt ...]\n"
         "Available commands:\n"
+        "    calibrate\n"
         "    click\n"
+        "    gamepad\n"
+        "    hold\n"
+        "    input\n"
         "    key\n"
+        "    keydown\n"
+        "    keyup\n"
+        "    macro\n"
         "    mouse\n"
+        "    raw\n"
+        "    recorder\n"
+        "    scroll\n"
+        "    stats\n"
+        "    trace\n"
         "    type\n"
         "    screenshot\n"
         "    touch\n",
@@ -402,33 +780,87 @@ int main(int argc, char ** argv) {
     if (argc == 1) {
         return usage_main(argv[0]);
     }
+
+    // Messages wait until exit, rather than holding up events on a slow console
+    log_init(LOG_LEVEL_WARN, 0);
+
+    // Takes Android's options, not ours
+    if (!strcmp(argv[1], "input")) {
+        int ret = adbinput_main(argc - 2, argv + 2);
+        return ret + uinput_destroy();
+    }
+
+    // Creates a device of its own rather than going through ydotoold
+    if (!strcmp(argv[1], "calibrate")) {
+        return calibrate_main(argc - 1, argv + 1);
+    }
+
+    // So does the gamepad, to be classified as a joystick
+    if (!strcmp(argv[1], "gamepad")) {
+        return gamepad_main(argc - 1, argv + 1);
+    }
+
+    // Works on files, not the device
+    if (!strcmp(argv[1], "trace")) {
+        return trace_main(argc - 1, argv + 1);
+    }
 	int ret = 0;
 
     // Options
     /// @todo Implement delays
 
-    char * file_path;
+    char * file_path = NULL;
+    const char * wait_dir = NULL;
+    const char * pattern = "wayland*";
+    uint32_t timeout_ms = 5000;
     bool relative = false;
+    bool stream = false;
+    bool binary = false;
+    struct pointer_motion motion = { 0, POINTER_MAX_RATE, POINTER_PATH_LINEAR };
+    struct type_options type_opts = { { 1, 0 }, false };
     uint64_t repeats = 1;
     uint32_t time_delay = 100;
     //uint32_t time_keydelay = 12;
 
     enum optlist_t {
+        opt_binary,
+        opt_capslock,
         opt_delay,
+        opt_dump,
+        opt_duration,
+        opt_ease,
         opt_file,
         opt_help,
         opt_key_delay,
+        opt_overlap,
+        opt_pattern,
+        opt_rate,
         opt_relative,
         opt_repeats,
+        opt_stream,
+        opt_timeout,
+        opt_wait,
     };
 
     static struct option long_options[] = {
         {"help",      no_argument,       NULL, opt_help     },
+        {"binary",    no_argument,       NULL, opt_binary   },
         {"delay",     required_argument, NULL, opt_delay    },
+        {"capslock",  required_argument, NULL, opt_capslock },
+        {"dump",      no_argument,       NULL, opt_dump     },
         //{"key-delay", required_argument, NULL, opt_key_delay},
+        {"duration",  required_argument, NULL, opt_duration },
+        {"ease",      no_argument,       NULL, opt_ease     },
         {"file",      required_argument, NULL, opt_file     },
+        {"rate",      required_argument, NULL, opt_rate     },
+        {"overlap",   required_argument, NULL, opt_overlap  },
+        {"pattern",   required_argument, NULL, opt_pattern  },
         {"relative",  no_argument,       NULL, opt_relative },
         {"repeats",   required_argument, NULL, opt_repeats  },
+        {"stream",    no_argument,       NULL, opt_stream   },
+        {"timeout",   required_argument, NULL, opt_timeout  },
+        {"wait",      required_argument, NULL, opt_wait     },
+        {NULL,        0,                 NULL, 0            }
     };
 
     int opt;
@@ -447,7 +879,37 @@ int main(int argc, char ** argv) {
             case 'f':
             case opt_file:
                 file_path = malloc(sizeof(char) * (strlen(optarg) + 1));
-                strcat(file_path, optarg);
+                strcpy(file_path, optarg);
+                break;
+            case opt_timeout:
+                timeout_ms = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_wait:
+                wait_dir = optarg;
+                break;
+            case opt_pattern:
+                pattern = optarg;
+                break;
+            case opt_overlap: {
+                // Clamped before narrowing, so e.g. 257 doesn't wrap around to 1
+                unsigned long overlap = strtoul(optarg, NULL, 10);
+                type_opts.compile.overlap = (uint8_t)(overlap > UINPUT_MAX_OVERLAP ? UINPUT_MAX_OVERLAP : overlap);
+                break;
+            }
+            case opt_duration:
+                motion.duration_ms = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_ease:
+                motion.path = POINTER_PATH_EASE;
+                break;
+            case opt_rate:
+                motion.rate_hz = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_capslock:
+                type_opts.compile.capslock_run = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_dump:
+                type_opts.dump = true;
                 break;
             case 'r':
             case opt_relative:
@@ -456,6 +918,12 @@ int main(int argc, char ** argv) {
             case opt_repeats:
                 repeats = strtoul(optarg, NULL, 10);
                 break;
+            case opt_binary:
+                binary = true;
+                break;
+            case opt_stream:
+                stream = true;
+                break;
             case 'h':
             case opt_help:
             case '?':
@@ -483,26 +951,99 @@ int main(int argc, char ** argv) {
         } else {
             ret += key_run(time_delay, repeats, argc - optind, argv + optind);
         }
+    } else if (!strcmp(argv[optind], "keydown") || !strcmp(argv[optind], "keyup")) {
+        int32_t value = !strcmp(argv[optind], "keydown");
+        optind++;
+        if (argc == optind) {
+            ret += usage(key_press_usage);
+        } else {
+            ret += key_press_run(value, time_delay, argc - optind, argv + optind);
+            // ydotoold would release the keys again once we're gone
+            if (!ret && value) {
+                ret += uinput_keep();
+            }
+        }
+    } else if (!strcmp(argv[optind], "hold")) {
+        optind++;
+        if (argc - optind < 2) {
+            ret += usage(key_hold_usage);
+        } else {
+            uint32_t hold_ms = (uint32_t)strtoul(argv[optind], NULL, 10);
+            ret += key_hold_run(hold_ms, time_delay, argc - optind - 1, argv + optind + 1);
+        }
+    } else if (!strcmp(argv[optind], "macro")) {
+        optind++;
+        if (argc - optind >= 3 && !strcmp(argv[optind], "define")) {
+            ret += macro_define(argv[optind + 1], argc - optind - 2, argv + optind + 2);
+        } else if (argc - optind == 2 && !strcmp(argv[optind], "run")) {
+            ret += macro_run(argv[optind + 1], repeats);
+        } else {
+            ret += usage(macro_usage);
+        }
+    } else if (!strcmp(argv[optind], "raw")) {
+        optind++;
+        if (argc != optind) {
+            ret += usage(raw_usage);
+        } else {
+            usleep(time_delay * 1000);
+            ret += raw_stream(STDIN_FILENO);
+        }
+    } else if (!strcmp(argv[optind], "recorder")) {
+        ret += recorder_run();
+    } else if (!strcmp(argv[optind], "stats")) {
+        optind++;
+        if (argc == optind) {
+            ret += stats_run();
+        } else if (argc - optind == 1 && !strcmp(argv[optind], "clients")) {
+            ret += stats_clients_run();
+        } else {
+            ret += usage(stats_usage);
+        }
     } else if (!strcmp(argv[optind], "screenshot")) {
-//        optind++;
-//        if (argc == optind) {
-//            ret += usage(key_usage);
-//        } else {
-//            ret += key_run(time_delay, repeats, argc - optind, argv + optind);
-//        }
-	ret += screenshot();
+        optind++;
+        if (argc != optind) {
+            ret += usage(screenshot_usage);
+        } else if (wait_dir) {
+            ret += screenshot_wait(wait_dir, pattern, timeout_ms);
+        } else {
+            ret += screenshot();
+        }
     } else if (!strcmp(argv[optind], "mouse")) {
         optind++;
-        if (argc - optind != 2) {
+        if (stream) {
+            if (argc != optind) {
+                ret += usage(mouse_usage);
+            } else {
+                usleep(time_delay * 1000);
+                ret += trace_stream(STDIN_FILENO, relative ? TRACE_MOUSE_RELATIVE : TRACE_MOUSE, binary);
+            }
+        } else if (argc - optind != 2) {
             ret += usage(mouse_usage);
         } else {
             int32_t x = (int32_t)strtol(argv[optind], NULL, 10);
             int32_t y = (int32_t)strtol(argv[optind + 1], NULL, 10);
-            ret += mouse_run(x, y, time_delay, relative);
+            ret += mouse_run(x, y, time_delay, relative, &motion);
+        }
+    } else if (!strcmp(argv[optind], "scroll")) {
+        optind++;
+        if (argc - optind != 1 && argc - optind != 2) {
+            ret += usage(scroll_usage);
+        } else {
+            double vertical = strtod(argv[optind], NULL);
+            double horizontal = argc - optind == 2 ? strtod(argv[optind + 1], NULL) : 0.0;
+            ret += scroll_run(vertical, horizontal, time_delay, &motion);
         }
     } else if (!strcmp(argv[optind], "touch")) {
         optind++;
-	if (!strcmp(argv[optind], "tap")){
+    if (stream) {
+        if (argc != optind) {
+            ret += usage(touch_stream_usage);
+        } else {
+            usleep(time_delay * 1000);
+            ret += trace_stream(STDIN_FILENO, TRACE_TOUCH, binary);
+        }
+    }
+	else if (!strcmp(argv[optind], "tap")){
 	optind++;
         if (argc - optind != 2) {
             ret += usage(touch_tap_usage);
@@ -528,13 +1069,13 @@ int main(int argc, char ** argv) {
     } else if (!strcmp(argv[optind], "type")) {
         optind++;
         if (argc > optind) {
-            ret += type_args(argc - optind, argv + optind);
-        } else if (!strcmp(file_path, "")) {
+            ret += type_args(argc - optind, argv + optind, &type_opts);
+        } else if (file_path) {
             // Hyphen means read from stdin
             if (!strcmp(file_path, "-")) {
-                ret += type_stdin();
+                ret += type_stdin(&type_opts);
             } else {
-                ret += type_file(file_path);
+                ret += type_file(file_path, &type_opts);
             }
         } else {
             ret += usage(type_usage);
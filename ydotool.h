@@ -0,0 +1,69 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file ydotool.h
+/// @author Harry Austen
+/// @brief ydotool command implementations shared with the benchmark harness
+
+#ifndef __YDOTOOL_H__
+#define __YDOTOOL_H__
+
+// System includes
+#include <stdbool.h>
+
+// Local includes
+#include "program.h"
+
+/// @brief Options for the type command
+struct type_options {
+    /// How the text is compiled into key events
+    struct program_type_options compile;
+    /// Print the compiled events instead of sending them
+    bool dump;
+};
+
+/// @brief Entry point of ydotool in the multi-call binary, main() of ydotool.c built with -Dmain=ydotool_main
+/// @param[in] argc Number of input arguments
+/// @param[in] argv Array of input arguments
+/// @return 0 on success, 1 if error(s)
+int ydotool_main(int argc, char ** argv);
+
+/// @brief Press all keys, then release all keys
+/// @param[in] key_string Sequence of string representations of keys to be pressed together, separated by '+'
+/// @return 0 on success, 1 if error(s)
+int key_enter_keys(const char * key_string);
+
+/// @brief Type the given text using a virtual keyboard device
+/// @param[in] text The text
+/// @param[in] opts Options for compiling the text
+/// @return 0 on success, 1 on error(s)
+int type_text(char * text, const struct type_options * opts);
+
+/// @brief Type the concatenation of the given strings
+/// @param[in] argc The number of strings to type
+/// @param[in] argv Pointer to the strings
+/// @param[in] opts Options for compiling the text
+/// @return 0 on success, 1 on error(s)
+int type_args(int argc, char ** argv, const struct type_options * opts);
+
+/// @brief Type everything read from stdin
+/// @param[in] opts Options for compiling the text
+/// @return 0 on success, 1 on error(s)
+int type_stdin(const struct type_options * opts);
+
+/// @brief Type the contents of a file
+/// @param[in] file_path The path to the file, freed before returning
+/// @param[in] opts Options for compiling the text
+/// @return 0 on success, 1 on error(s)
+int type_file(char * file_path, const struct type_options * opts);
+
+#endif // __YDOTOOL_H__
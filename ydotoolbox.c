@@ -0,0 +1,79 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file ydotoolbox.c
+/// @author Harry Austen
+/// @brief Multi-call binary holding both ydotool and ydotoold, chosen by the name it is run as.
+/// Built statically with link-time optimisation by make STATIC=1 ydotoolbox, it starts without
+/// loading or relocating any shared objects
+
+// System includes
+#include <stdio.h>
+#include <string.h>
+
+// Local includes
+#include "ydotool.h"
+#include "ydotoold.h"
+
+/// @brief A program of the multi-call binary
+struct ydotoolbox_applet {
+    /// Name the program is run as
+    char name[16];
+    /// Its entry point
+    int (*main)(int, char **);
+};
+
+/// Programs of the multi-call binary
+static const struct ydotoolbox_applet APPLETS[] = {
+    { "ydotool", ydotool_main },
+    { "ydotoold", ydotoold_main }
+};
+
+/// Number of programs
+#define NUM_APPLETS (sizeof(APPLETS) / sizeof(*APPLETS))
+
+/// Find a program by name
+/// @param path Name or path the program is run as
+/// @return The program, NULL if there is none of that name
+static const struct ydotoolbox_applet * ydotoolbox_find(const char * path) {
+    const char * name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    for (size_t i = 0; i != NUM_APPLETS; ++i) {
+        if (!strcmp(APPLETS[i].name, name)) {
+            return &APPLETS[i];
+        }
+    }
+    return NULL;
+}
+
+/// Main entrypoint of the multi-call binary
+/// @param argc Number of input arguments
+/// @param argv Array of input arguments: run as a link named after a program, or
+/// as ydotoolbox followed by the program name and its arguments
+/// @return The return value of the program, 1 if there is no such program
+int main(int argc, char ** argv) {
+    const struct ydotoolbox_applet * applet = ydotoolbox_find(argv[0]);
+    if (!applet && argc > 1) {
+        applet = ydotoolbox_find(argv[1]);
+        argc--;
+        argv++;
+    }
+    if (!applet) {
+        fprintf(stderr, "Usage: ydotoolbox <program> [<arg>...]\nPrograms:");
+        for (size_t i = 0; i != NUM_APPLETS; ++i) {
+            fprintf(stderr, " %s", APPLETS[i].name);
+        }
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    return applet->main(argc, argv);
+}
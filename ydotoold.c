@@ -14,72 +14,1577 @@
 /// @author Harry Austen
 /// @brief Main entry point to the ydotool daemon program. Run this in the background to speed up the ydotool program commands
 
+// For CPU affinity and struct ucred
+#define _GNU_SOURCE
+
 // System includes
 #include <sys/un.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <getopt.h>
+#include <time.h>
 
 // Local includes
+#include "log.h"
+#include "program.h"
+#include "recorder.h"
 #include "uinput.h"
+#include "ydotoold.h"
+
+/// Number of macro repetitions written per writev
+#define MACRO_IOV_BATCH 64
+
+/// Number of events of a filtered macro repetition written per write, see ydotoold_write_macro()
+#define MACRO_FILTER_EVENTS 256
+
+/// Stack size of client threads in real-time mode, where every page mapped is locked
+#define RT_CLIENT_STACK (256 * 1024)
+
+/// Maximum number of --policy options
+#define MAX_POLICIES 32
+
+/// Maximum weight in a --policy option
+#define MAX_WEIGHT 1000
+
+/// Number of 64-bit words in a bitmap of every key and button code
+#define KEY_WORDS ((KEY_CNT + 63) / 64)
+
+/// Number of multi-touch slots whose contacts are tracked
+#define MAX_SLOTS 64
+
+/// Largest frame built by ydotoold_release(): every key, every contact and a SYN_REPORT
+#define RELEASE_EVENTS (KEY_CNT + 2 * MAX_SLOTS + 1)
+
+/// Virtual time a client with weight 1 is charged per event written, see ydotoold_writer().
+/// Divisible by every weight up to 16, so common weights charge exactly
+#define VTIME_PER_EVENT 720720
+
+/// Milliseconds a frame split over several slots may hold up the other clients before
+/// the writer ends it with a SYN_REPORT of its own
+#define STICKY_MS 100
+
+/// Number of timed holds (YDOTOOLD_CTL_HOLD) that may be waiting for their release at once
+#define MAX_HOLDS 64
+
+/// Number of keys whose press order each holder remembers, see ydotoold_release()
+#define HELD_ORDER 16
 
 /// File decriptor for the socket listener
 static int FD_LIST = -1;
 
+/// Set if the daemon created the socket itself, rather than inheriting it
+static int OWN_SOCKET = 0;
+
+/// Milliseconds without clients after which the daemon exits, 0 to run until stopped
+static uint32_t IDLE_MS = 0;
+
+/// When the last client left (CLOCK_MONOTONIC ns), protected by QUEUE_LOCK
+static int64_t LAST_ACTIVE = 0;
+
+/// Set to merge motion frames queued behind each other, see ydotoold_coalesce()
+static int COALESCE = 0;
+
+/// SCHED_FIFO priority of the writer thread, 0 to schedule it like the other threads
+static int RT_PRIORITY = 0;
+
+/// CPU the writer thread is pinned to, -1 to let it run anywhere
+static int RT_CPU = -1;
+
+/// File the flight recorder is dumped to
+static const char * RECORDER_PATH = YDOTOOLD_RECORDER_PATH;
+
+/// @brief How the clients of a user share the device
+struct ydotoold_policy {
+    /// The user, or -1 for users without a policy of their own
+    int64_t uid;
+    /// Share of the device each client gets while others are waiting too
+    uint32_t weight;
+    /// Events per second each client may queue, 0 if unlimited
+    uint32_t rate;
+    /// Events each client may queue at once, ahead of its rate
+    uint32_t burst;
+};
+
+/// Policies given with --policy
+static struct ydotoold_policy POLICIES[MAX_POLICIES];
+
+/// Number of POLICIES
+static size_t NUM_POLICIES = 0;
+
+/// Policy of users without a --policy, unless one is given for all users
+static const struct ydotoold_policy DEFAULT_POLICY = { -1, 1, 0, 0 };
+
+/// @brief A compiled macro program, shared by the registry and queued runs
+struct ydotoold_macro_prog {
+    /// The compiled events
+    struct program prog;
+    /// Number of references held (registry and queued runs), protected by MACROS_LOCK
+    uint32_t refs;
+};
+
+/// @brief A registered macro
+struct ydotoold_macro {
+    /// Name the macro was registered under (empty if the slot is free)
+    char name[YDOTOOLD_MACRO_NAME_LEN];
+    /// The compiled program
+    struct ydotoold_macro_prog * prog;
+};
+
+/// Registered macros, indexed by macro id
+static struct ydotoold_macro MACROS[YDOTOOLD_MAX_MACROS];
+
+/// Lock protecting MACROS
+static pthread_mutex_t MACROS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+/// @brief Keys, buttons and touch contacts held down, only touched by the writer thread
+struct ydotoold_held {
+    /// Bitmap of key and button codes
+    uint64_t keys[KEY_WORDS];
+    /// Bitmap of multi-touch slots with a contact
+    uint64_t contacts;
+    /// Multi-touch slot the next contact events are for
+    int32_t slot;
+    /// Number of keys in order
+    uint32_t num_order;
+    /// The first HELD_ORDER keys still held, in the order they were pressed
+    uint16_t order[HELD_ORDER];
+};
+
+/// What clients left held down on purpose (YDOTOOLD_CTL_KEEP), until any client releases it
+static struct ydotoold_held KEPT;
+
+/// @brief What a client handed over with YDOTOOLD_CTL_HOLD, only touched by the writer thread
+struct ydotoold_hold {
+    /// When to release it (CLOCK_MONOTONIC ns), 0 if the slot is free
+    int64_t due;
+    /// Id of the client that handed it over
+    uint32_t client;
+    /// What is held down
+    struct ydotoold_held held;
+};
+
+/// Timed holds waiting for their release
+static struct ydotoold_hold HOLDS[MAX_HOLDS];
+
+/// Number of holders (clients, KEPT and HOLDS) of each key and button, which is down on the device while nonzero
+static uint16_t KEY_HOLDERS[KEY_CNT];
+
+/// @brief What the writer does with a queued frame
+enum ydotoold_frame_op {
+    /// Write its events, or its macro
+    FRAME_WRITE,
+    /// Release whatever the client holds down
+    FRAME_RELEASE,
+    /// Hand whatever the client holds down over to KEPT
+    FRAME_KEEP,
+    /// Hand whatever the client holds down over to HOLDS, for hold_ms
+    FRAME_HOLD,
+};
+
+/// @brief A queued frame, or a queued macro run
+struct ydotoold_frame {
+    /// The events, ending with a SYN_REPORT unless the frame was too long for one slot
+    struct input_event events[YDOTOOLD_FRAME_EVENTS];
+    /// Number of events
+    uint16_t count;
+    /// Repetitions of macro to write instead of events
+    uint32_t repeats;
+    /// Macro to run instead of writing events, or NULL
+    struct ydotoold_macro_prog * macro;
+    /// When the client sent the frame (CLOCK_MONOTONIC ns), 0 if it didn't say
+    int64_t t_send;
+    /// When the frame was queued (CLOCK_MONOTONIC ns)
+    int64_t t_recv;
+    /// Number of later frames merged into this one, see ydotoold_coalesce()
+    uint32_t merged;
+    /// Milliseconds to hold for, if op is FRAME_HOLD
+    uint32_t hold_ms;
+    /// What to do with the frame (enum ydotoold_frame_op)
+    uint8_t op;
+};
+
+/// @brief A connected client and its queue of frames waiting for the device
+struct ydotoold_client {
+    /// Socket of the client
+    int fd;
+    /// Number identifying the client
+    uint32_t id;
+    /// Set once the client has disconnected
+    int closing;
+    /// Set once the client switched to raw input events, see YDOTOOLD_CTL_RAW
+    int raw;
+    /// Process of the client, from SO_PEERCRED
+    struct ucred cred;
+    /// How the client shares the device
+    const struct ydotoold_policy * policy;
+    /// Events the client may still queue without waiting, see ydotoold_throttle()
+    double tokens;
+    /// When tokens were last topped up (CLOCK_MONOTONIC ns)
+    int64_t t_tokens;
+    /// Virtual time at which the client's next frame starts, see ydotoold_writer()
+    uint64_t vtime;
+    /// Frames queued before this index are skipped, see YDOTOOLD_CTL_CANCEL
+    uint32_t discard;
+    /// What the client holds down
+    struct ydotoold_held held;
+    /// Usage counters, protected by QUEUE_LOCK
+    struct ydotoold_client_stats stats;
+    /// Index of the next frame for the writer, wraps around
+    uint32_t head;
+    /// Index of the next free frame, wraps around
+    uint32_t tail;
+    /// Signalled when the writer frees a frame
+    pthread_cond_t space;
+    /// Frames waiting for the device
+    struct ydotoold_frame frames[YDOTOOLD_QUEUE_FRAMES];
+    /// Number of bytes in buf
+    size_t buf_len;
+    /// Number of bytes of buf already consumed
+    size_t buf_pos;
+    /// Data received from the socket but not yet consumed
+    char buf[YDOTOOLD_READ_BUFFER];
+};
+
+/// Connected clients, NULL where a slot is free
+static struct ydotoold_client * CLIENTS[YDOTOOLD_MAX_CLIENTS];
+
+/// Lock protecting CLIENTS, their queues and STATS
+static pthread_mutex_t QUEUE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+/// Signalled when a frame is queued
+static pthread_cond_t QUEUE_WORK = PTHREAD_COND_INITIALIZER;
+
+/// Number of frames queued over all clients
+static uint32_t QUEUED = 0;
+
+/// Client whose frame split over several slots the writer is in the middle of
+static struct ydotoold_client * STICKY = NULL;
+
+/// When the writer gives up waiting for the rest of STICKY's frame (CLOCK_MONOTONIC ns)
+static int64_t STICKY_DUE = 0;
+
+/// Virtual time of the frame last started by the writer
+static uint64_t VTIME = 0;
+
+/// Daemon counters
+static struct ydotoold_stats STATS;
+
+/// Drop a reference to a macro program, freeing it with the last one
+/// @param prog The macro program
+void ydotoold_macro_unref(struct ydotoold_macro_prog * prog) {
+    pthread_mutex_lock(&MACROS_LOCK);
+    int last = !--prog->refs;
+    pthread_mutex_unlock(&MACROS_LOCK);
+
+    if (last) {
+        program_free(&prog->prog);
+        free(prog);
+    }
+}
+
+/// Compile a macro and register it, replacing any macro of the same name
+/// @param payload Null-terminated name followed by the null-terminated words of the macro
+/// @param len Number of bytes in payload
+/// @return The macro id, or negative errno on failure
+int32_t ydotoold_macro_define(char * payload, size_t len) {
+    char * argv[YDOTOOLD_MAX_PAYLOAD / 2];
+    int argc = 0;
+
+    if (!len || payload[len - 1] != '\0') {
+        return -EINVAL;
+    }
+
+    // Split payload into name and words, none of them empty
+    const char * name = payload;
+    if (!*name || strlen(name) >= YDOTOOLD_MACRO_NAME_LEN) {
+        return -EINVAL;
+    }
+    for (char * word = payload + strlen(name) + 1; word != payload + len; word += strlen(word) + 1) {
+        if (!*word) {
+            return -EINVAL;
+        }
+        if (argc == sizeof(argv) / sizeof(*argv)) {
+            return -E2BIG;
+        }
+        argv[argc++] = word;
+    }
+    if (!argc) {
+        return -EINVAL;
+    }
+
+    struct ydotoold_macro_prog * prog = calloc(1, sizeof(*prog));
+    if (!prog) {
+        return -ENOMEM;
+    }
+    program_init(&prog->prog);
+    prog->refs = 1;
+    if (program_compile_macro(&prog->prog, argc, argv)) {
+        program_free(&prog->prog);
+        free(prog);
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&MACROS_LOCK);
+    int32_t id = -ENOSPC;
+    for (int32_t i = 0; i != YDOTOOLD_MAX_MACROS; ++i) {
+        if (!strcmp(MACROS[i].name, name)) {
+            id = i;
+            break;
+        }
+        if (id < 0 && !MACROS[i].name[0]) {
+            id = i;
+        }
+    }
+    struct ydotoold_macro_prog * old = NULL;
+    if (id >= 0) {
+        old = MACROS[id].prog;
+        strcpy(MACROS[id].name, name);
+        MACROS[id].prog = prog;
+        prog = NULL;
+    }
+    pthread_mutex_unlock(&MACROS_LOCK);
+
+    // Runs still queued keep their own reference to a replaced program
+    if (old) {
+        ydotoold_macro_unref(old);
+    }
+    if (prog) {
+        ydotoold_macro_unref(prog);
+    }
+
+    return id;
+}
+
+/// Wait for a free frame at the end of a client's queue
+/// @details Waiting here stops the client's socket being read, so a client
+/// writing faster than the device drains is held up by its own socket
+/// @param client The client
+/// @return The free frame, which becomes queued once ydotoold_queue_push() is called
+struct ydotoold_frame * ydotoold_queue_reserve(struct ydotoold_client * client) {
+    pthread_mutex_lock(&QUEUE_LOCK);
+    if (client->tail - client->head == YDOTOOLD_QUEUE_FRAMES) {
+        STATS.queue_full++;
+        while (client->tail - client->head == YDOTOOLD_QUEUE_FRAMES) {
+            pthread_cond_wait(&client->space, &QUEUE_LOCK);
+        }
+    }
+    pthread_mutex_unlock(&QUEUE_LOCK);
+
+    struct ydotoold_frame * frame = &client->frames[client->tail % YDOTOOLD_QUEUE_FRAMES];
+    frame->count = 0;
+    frame->macro = NULL;
+    frame->repeats = 0;
+    frame->t_send = 0;
+    frame->merged = 0;
+    frame->op = FRAME_WRITE;
+    return frame;
+}
+
+/// Check whether a frame only moves pointer or touch axes
+/// @param frame The frame
+/// @return 1 if the frame is complete and holds nothing but motion, 0 otherwise
+static int ydotoold_is_motion(const struct ydotoold_frame * frame) {
+    if (frame->macro || !frame->count) {
+        return 0;
+    }
+    const struct input_event * last = &frame->events[frame->count - 1];
+    if (last->type != EV_SYN || last->code != SYN_REPORT) {
+        return 0;
+    }
+    for (uint16_t i = 0; i != frame->count - 1; ++i) {
+        const struct input_event * ev = &frame->events[i];
+        // Slot changes and touch contacts starting or ending are transitions, not motion
+        if (ev->type != EV_REL && (ev->type != EV_ABS || ev->code == ABS_MT_SLOT || ev->code == ABS_MT_TRACKING_ID)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/// Merge a motion frame into the motion frame queued before it, if the writer hasn't got to that yet
+/// @details Absolute axes take the later position and relative axes add up, so the device ends
+/// up where the two frames would have left it. Anything but motion is never merged, so button
+/// and key transitions keep their place between the positions around them
+/// @param client The client, with QUEUE_LOCK held
+/// @param frame The complete frame about to be queued, in the slot at tail
+/// @return 1 if the frame was merged and its slot is free again, 0 if it has to be queued
+static int ydotoold_coalesce(struct ydotoold_client * client, const struct ydotoold_frame * frame) {
+    // The frame at head may be being written, so only merge into one queued behind it
+    if (client->tail - client->head < 2) {
+        return 0;
+    }
+    struct ydotoold_frame * prev = &client->frames[(client->tail - 1) % YDOTOOLD_QUEUE_FRAMES];
+    if (!ydotoold_is_motion(prev) || !ydotoold_is_motion(frame)) {
+        return 0;
+    }
+
+    // Both frames end with a SYN_REPORT, which the merged frame takes from the later one
+    size_t axes = prev->count - 1u;
+    int match[YDOTOOLD_FRAME_EVENTS];
+    size_t added = 0;
+    for (size_t i = 0; i != frame->count - 1u; ++i) {
+        match[i] = -1;
+        for (size_t j = 0; j != axes; ++j) {
+            if (prev->events[j].type == frame->events[i].type && prev->events[j].code == frame->events[i].code) {
+                match[i] = (int)j;
+                break;
+            }
+        }
+        added += match[i] == -1;
+    }
+    if (axes + added + 1 > YDOTOOLD_FRAME_EVENTS) {
+        return 0;
+    }
+
+    for (size_t i = 0; i != frame->count - 1u; ++i) {
+        const struct input_event * ev = &frame->events[i];
+        if (match[i] == -1) {
+            prev->events[axes++] = *ev;
+        } else if (ev->type == EV_REL) {
+            prev->events[match[i]].value += ev->value;
+        } else {
+            prev->events[match[i]].value = ev->value;
+        }
+    }
+    prev->events[axes] = frame->events[frame->count - 1];
+    prev->count = (uint16_t)(axes + 1);
+    prev->t_send = frame->t_send;
+    prev->t_recv = frame->t_recv;
+    prev->merged += 1 + frame->merged;
+    STATS.coalesced++;
+    return 1;
+}
+
+/// Get the number of events a queued frame writes
+/// @param frame The frame
+/// @return Number of events
+static uint64_t ydotoold_frame_events(const struct ydotoold_frame * frame) {
+    return frame->macro ? (uint64_t)frame->macro->prog.count * frame->repeats : frame->count;
+}
+
+/// Take events from a client's token bucket, first waiting for as long as it is in debt
+/// @details The bucket fills at the rate of the client's policy up to its burst, and
+/// can go negative, so a frame larger than the burst is let through and paid for after
+/// @param client The client
+/// @param events Number of events about to be queued
+/// @return Nanoseconds waited
+static int64_t ydotoold_throttle(struct ydotoold_client * client, uint64_t events) {
+    const struct ydotoold_policy * policy = client->policy;
+    if (!policy->rate) {
+        return 0;
+    }
+
+    int64_t now = recorder_now();
+    double tokens = client->tokens + (double)policy->rate * (double)(now - client->t_tokens) / 1e9;
+    client->tokens = tokens < (double)policy->burst ? tokens : (double)policy->burst;
+    client->t_tokens = now;
+    if (client->tokens >= 0.0) {
+        client->tokens -= (double)events;
+        return 0;
+    }
+
+    int64_t wait = (int64_t)(-client->tokens * 1e9 / (double)policy->rate);
+    struct timespec ts = { (time_t)(wait / 1000000000), (long)(wait % 1000000000) };
+    while (nanosleep(&ts, &ts) && errno == EINTR) {
+    }
+    client->tokens -= (double)events;
+    return wait;
+}
+
+/// Queue the frame returned by ydotoold_queue_reserve() for the writer
+/// @param client The client
+void ydotoold_queue_push(struct ydotoold_client * client) {
+    // Only this client's handler moves tail, so the frame can be found unlocked
+    struct ydotoold_frame * frame = &client->frames[client->tail % YDOTOOLD_QUEUE_FRAMES];
+
+    // A client over its rate waits before queueing, so it's its own socket that backs up
+    int64_t throttled = ydotoold_throttle(client, ydotoold_frame_events(frame));
+    frame->t_recv = recorder_now();
+
+    pthread_mutex_lock(&QUEUE_LOCK);
+    if (throttled) {
+        client->stats.throttled++;
+        client->stats.throttled_ns += (uint64_t)throttled;
+    }
+    if (COALESCE && ydotoold_coalesce(client, frame)) {
+        pthread_mutex_unlock(&QUEUE_LOCK);
+        return;
+    }
+    // A client that had nothing queued starts at the current virtual time: idling earns no credit
+    if (client->head == client->tail && client->vtime < VTIME) {
+        client->vtime = VTIME;
+    }
+    client->tail++;
+    QUEUED++;
+    pthread_cond_signal(&QUEUE_WORK);
+    pthread_mutex_unlock(&QUEUE_LOCK);
+}
+
+/// Queue a frame telling the writer what to do with what the client holds down
+/// @param client The client
+/// @param op FRAME_RELEASE, FRAME_KEEP or FRAME_HOLD
+/// @param hold_ms Milliseconds to hold for, if op is FRAME_HOLD
+void ydotoold_queue_op(struct ydotoold_client * client, uint8_t op, uint32_t hold_ms) {
+    struct ydotoold_frame * frame = ydotoold_queue_reserve(client);
+    frame->op = op;
+    frame->hold_ms = hold_ms;
+    ydotoold_queue_push(client);
+}
+
+/// Remember that a key was pressed, after those pressed before it
+/// @param held Who pressed it
+/// @param code Code of the key
+static void ydotoold_order_add(struct ydotoold_held * held, uint16_t code) {
+    if (held->num_order != HELD_ORDER) {
+        held->order[held->num_order++] = code;
+    }
+}
+
+/// Forget the press of a key that is no longer held
+/// @param held Who held it
+/// @param code Code of the key
+static void ydotoold_order_remove(struct ydotoold_held * held, uint16_t code) {
+    for (uint32_t i = 0; i != held->num_order; ++i) {
+        if (held->order[i] == code) {
+            memmove(&held->order[i], &held->order[i + 1], (held->num_order - i - 1) * sizeof(held->order[0]));
+            held->num_order--;
+            return;
+        }
+    }
+}
+
+/// Track an event a client writes, telling whether it changes anything on the device
+/// @details A key is down while any client holds it, or it was kept down. Pressing a key
+/// that is already down, releasing one neither the client, KEPT nor a timed hold holds, and ending a
+/// touch contact that isn't there change nothing
+/// @param held What the client holds down
+/// @param ev The event
+/// @return 1 if the event should be written, 0 if it changes nothing
+static int ydotoold_track(struct ydotoold_held * held, const struct input_event * ev) {
+    if (ev->type == EV_KEY && ev->code < KEY_CNT) {
+        uint64_t bit = (uint64_t)1 << (ev->code % 64);
+        uint64_t * mine = &held->keys[ev->code / 64];
+        uint64_t * kept = &KEPT.keys[ev->code / 64];
+        if (ev->value == 2) {
+            // Autorepeat only of a key that is down
+            return KEY_HOLDERS[ev->code] != 0;
+        }
+        if (ev->value) {
+            if (*mine & bit) {
+                return 0;
+            }
+            *mine |= bit;
+            ydotoold_order_add(held, ev->code);
+            return KEY_HOLDERS[ev->code]++ == 0;
+        }
+        if (*mine & bit) {
+            *mine &= ~bit;
+            ydotoold_order_remove(held, ev->code);
+        } else if (*kept & bit) {
+            *kept &= ~bit;
+            ydotoold_order_remove(&KEPT, ev->code);
+        } else {
+            // Released early by someone else, like a kept key
+            size_t i = 0;
+            while (i != MAX_HOLDS && !(HOLDS[i].due && HOLDS[i].held.keys[ev->code / 64] & bit)) {
+                ++i;
+            }
+            if (i == MAX_HOLDS) {
+                return 0;
+            }
+            HOLDS[i].held.keys[ev->code / 64] &= ~bit;
+            ydotoold_order_remove(&HOLDS[i].held, ev->code);
+        }
+        return --KEY_HOLDERS[ev->code] == 0;
+    }
+
+    if (ev->type == EV_ABS && ev->code == ABS_MT_SLOT) {
+        held->slot = ev->value;
+    } else if (ev->type == EV_ABS && ev->code == ABS_MT_TRACKING_ID && held->slot >= 0 && held->slot < MAX_SLOTS) {
+        uint64_t bit = (uint64_t)1 << held->slot;
+        if (ev->value >= 0) {
+            held->contacts |= bit;
+        } else if (held->contacts & bit) {
+            held->contacts &= ~bit;
+        } else if (KEPT.contacts & bit) {
+            KEPT.contacts &= ~bit;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/// Drop the events of a frame that change nothing on the device
+/// @param held What the frame's client holds down
+/// @param frame The frame, compacted in place
+/// @param continued Set if the frame continues one split over several slots, whose SYN_REPORT must stay
+/// @return Number of events dropped
+static uint16_t ydotoold_filter(struct ydotoold_held * held, struct ydotoold_frame * frame, int continued) {
+    uint16_t count = 0;
+    int useful = 0;
+    for (uint16_t i = 0; i != frame->count; ++i) {
+        if (ydotoold_track(held, &frame->events[i])) {
+            useful |= frame->events[i].type != EV_SYN;
+            frame->events[count++] = frame->events[i];
+        }
+    }
+
+    // Nothing left but the SYN_REPORT: write nothing at all
+    if (count != frame->count && !useful && !continued) {
+        count = 0;
+    }
+    uint16_t dropped = (uint16_t)(frame->count - count);
+    frame->count = count;
+    return dropped;
+}
+
+/// Fill in an event
+/// @param [out] ev The event
+/// @param type Type of the event
+/// @param code Code of the event
+/// @param value Value of the event
+static void ydotoold_event(struct input_event * ev, uint16_t type, uint16_t code, int32_t value) {
+    memset(ev, 0, sizeof(*ev));
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+}
+
+/// Build the frame releasing everything a client holds down, and forget it
+/// @details Keys also held by other clients, or kept, stay down. Keys are released in the
+/// reverse of the order they were pressed, so modifiers outlast the keys they modify; keys
+/// pressed after the first HELD_ORDER are released first, in code order
+/// @param held What the client holds down
+/// @param [out] events Room for RELEASE_EVENTS events
+/// @return Number of events, 0 if nothing needs releasing
+static size_t ydotoold_release(struct ydotoold_held * held, struct input_event * events) {
+    size_t count = 0;
+    uint64_t rest[KEY_WORDS];
+    memcpy(rest, held->keys, sizeof(rest));
+    for (uint32_t i = 0; i != held->num_order; ++i) {
+        rest[held->order[i] / 64] &= ~((uint64_t)1 << (held->order[i] % 64));
+    }
+    for (uint16_t word = 0; word != KEY_WORDS; ++word) {
+        for (uint64_t bits = rest[word]; bits; bits &= bits - 1) {
+            uint16_t code = (uint16_t)(word * 64 + (uint16_t)__builtin_ctzll(bits));
+            if (--KEY_HOLDERS[code] == 0) {
+                ydotoold_event(&events[count++], EV_KEY, code, 0);
+            }
+        }
+        held->keys[word] = 0;
+    }
+    while (held->num_order) {
+        uint16_t code = held->order[--held->num_order];
+        if (--KEY_HOLDERS[code] == 0) {
+            ydotoold_event(&events[count++], EV_KEY, code, 0);
+        }
+    }
+    for (int32_t slot = 0; slot != MAX_SLOTS; ++slot) {
+        if (held->contacts & ((uint64_t)1 << slot)) {
+            ydotoold_event(&events[count++], EV_ABS, ABS_MT_SLOT, slot);
+            ydotoold_event(&events[count++], EV_ABS, ABS_MT_TRACKING_ID, -1);
+        }
+    }
+    held->contacts = 0;
+
+    if (count) {
+        ydotoold_event(&events[count++], EV_SYN, SYN_REPORT, 0);
+    }
+    return count;
+}
+
+/// Hand everything a client holds down over to KEPT, so it stays down once the client leaves
+/// @param held What the client holds down
+static void ydotoold_keep(struct ydotoold_held * held) {
+    for (uint32_t i = 0; i != held->num_order; ++i) {
+        uint16_t code = held->order[i];
+        if (!(KEPT.keys[code / 64] & ((uint64_t)1 << (code % 64)))) {
+            ydotoold_order_add(&KEPT, code);
+        }
+    }
+    held->num_order = 0;
+    for (uint16_t word = 0; word != KEY_WORDS; ++word) {
+        // Keys already kept lose a holder
+        for (uint64_t bits = held->keys[word] & KEPT.keys[word]; bits; bits &= bits - 1) {
+            KEY_HOLDERS[word * 64 + __builtin_ctzll(bits)]--;
+        }
+        KEPT.keys[word] |= held->keys[word];
+        held->keys[word] = 0;
+    }
+    KEPT.contacts |= held->contacts;
+    held->contacts = 0;
+}
+
+/// Hand everything a client holds down over to a timed hold, to be released once due
+/// @param client The client
+/// @param hold_ms Milliseconds from now to release it
+/// @return 0 on success, 1 if every timed hold is taken and nothing was handed over
+static int ydotoold_hold(struct ydotoold_client * client, uint32_t hold_ms) {
+    struct ydotoold_held * held = &client->held;
+    for (size_t i = 0; i != MAX_HOLDS; ++i) {
+        if (!HOLDS[i].due) {
+            HOLDS[i].client = client->id;
+            HOLDS[i].held = *held;
+            HOLDS[i].held.slot = -1;
+            HOLDS[i].due = recorder_now() + (int64_t)hold_ms * 1000000;
+            memset(held, 0, sizeof(*held));
+            held->slot = -1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/// Build the frame releasing the first timed hold that is due, and free it
+/// @param now Current time (CLOCK_MONOTONIC ns)
+/// @param [out] events Room for RELEASE_EVENTS events
+/// @param [out] count Number of events, 0 if nothing needs releasing
+/// @param [out] expired The hold released, for the flight recorder
+/// @return When the next timed hold is due if none is due now (0 if there are none), -1 if one was released
+static int64_t ydotoold_hold_expire(int64_t now, struct input_event * events, size_t * count,
+        struct ydotoold_hold * expired) {
+    int64_t next = 0;
+    for (size_t i = 0; i != MAX_HOLDS; ++i) {
+        if (HOLDS[i].due && HOLDS[i].due <= now) {
+            *expired = HOLDS[i];
+            *count = ydotoold_release(&HOLDS[i].held, events);
+            HOLDS[i].due = 0;
+            return -1;
+        }
+        if (HOLDS[i].due && (!next || HOLDS[i].due < next)) {
+            next = HOLDS[i].due;
+        }
+    }
+    *count = 0;
+    return next;
+}
+
+/// Wait for work queued for the writer, or until a time
+/// @param due When to stop waiting (CLOCK_MONOTONIC ns), 0 to wait for work only
+static void ydotoold_writer_wait(int64_t due) {
+    if (!due) {
+        pthread_cond_wait(&QUEUE_WORK, &QUEUE_LOCK);
+        return;
+    }
+    // QUEUE_WORK waits against CLOCK_REALTIME
+    int64_t wait = due - recorder_now();
+    if (wait <= 0) {
+        return;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)(wait / 1000000000);
+    deadline.tv_nsec += (long)(wait % 1000000000);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_nsec -= 1000000000L;
+        deadline.tv_sec++;
+    }
+    pthread_cond_timedwait(&QUEUE_WORK, &QUEUE_LOCK, &deadline);
+}
+
+/// Queue a run of a registered macro
+/// @param client The client asking for the run
+/// @param run Which macro to run and how many times
+/// @return 0 on success, negative errno on failure
+int32_t ydotoold_macro_run(struct ydotoold_client * client, const struct ydotoold_macro_run * run) {
+    struct ydotoold_macro_prog * prog = NULL;
+
+    pthread_mutex_lock(&MACROS_LOCK);
+    int32_t id = run->id;
+    if (id < 0) {
+        for (int32_t i = 0; i != YDOTOOLD_MAX_MACROS; ++i) {
+            if (MACROS[i].name[0] && !strncmp(MACROS[i].name, run->name, YDOTOOLD_MACRO_NAME_LEN)) {
+                id = i;
+                break;
+            }
+        }
+    }
+    if (id >= 0 && id < YDOTOOLD_MAX_MACROS && MACROS[id].name[0]) {
+        prog = MACROS[id].prog;
+        prog->refs++;
+    }
+    pthread_mutex_unlock(&MACROS_LOCK);
+
+    if (!prog) {
+        return -ENOENT;
+    }
+
+    struct ydotoold_frame * frame = ydotoold_queue_reserve(client);
+    frame->macro = prog;
+    frame->repeats = run->repeats ? run->repeats : 1;
+    ydotoold_queue_push(client);
+    return 0;
+}
+
+/// Write a queued macro run, repetitions of the prebuilt buffer batched into writevs
+/// @details Each repetition is tracked like a frame, see ydotoold_filter(). One that changes
+/// everything it says goes out as the prebuilt buffer; from the first event of one that
+/// changes nothing, like releasing a key another holder still has down, it is written filtered
+/// @param held What the run's client holds down
+/// @param frame The queued macro run
+/// @param [out] dropped Number of events not written because they changed nothing
+/// @return 0 on success, 1 if error(s)
+static int ydotoold_write_macro(struct ydotoold_held * held, const struct ydotoold_frame * frame, uint64_t * dropped) {
+    static struct input_event OUT[MACRO_FILTER_EVENTS];
+    struct iovec iov[MACRO_IOV_BATCH];
+    const struct program * prog = &frame->macro->prog;
+    int n = 0;
+    int useful = 0;
+
+    *dropped = 0;
+    for (uint32_t rep = 0; rep != frame->repeats; ++rep) {
+        size_t i = 0;
+        for (; i != prog->count && ydotoold_track(held, &prog->events[i]); ++i) {
+            useful = prog->events[i].type != EV_SYN;
+        }
+        if (i) {
+            iov[n].iov_base = prog->events;
+            iov[n++].iov_len = sizeof(*prog->events) * i;
+        }
+        if (i == prog->count) {
+            if (n == MACRO_IOV_BATCH) {
+                if (uinput_send_iov(iov, n)) {
+                    return 1;
+                }
+                n = 0;
+            }
+            continue;
+        }
+
+        // Something changes nothing: write what came before it, then the rest filtered
+        if (n && uinput_send_iov(iov, n)) {
+            return 1;
+        }
+        n = 0;
+        size_t count = 0;
+        (*dropped)++;
+        for (++i; i != prog->count; ++i) {
+            const struct input_event * ev = &prog->events[i];
+            // A frame left with nothing but its SYN_REPORT is dropped whole
+            if (!ydotoold_track(held, ev) || (ev->type == EV_SYN && !useful)) {
+                (*dropped)++;
+                continue;
+            }
+            useful = ev->type != EV_SYN;
+            OUT[count++] = *ev;
+            if (count == MACRO_FILTER_EVENTS) {
+                iov[0].iov_base = OUT;
+                iov[0].iov_len = sizeof(*OUT) * count;
+                if (uinput_send_iov(iov, 1)) {
+                    return 1;
+                }
+                count = 0;
+            }
+        }
+        iov[0].iov_base = OUT;
+        iov[0].iov_len = sizeof(*OUT) * count;
+        if (count && uinput_send_iov(iov, 1)) {
+            return 1;
+        }
+    }
+    return n && uinput_send_iov(iov, n);
+}
+
+/// Device writer thread: writes queued frames, sharing the device between clients by weight
+/// @details Only this thread writes to the device. When the device falls
+/// behind, queues fill up and the client handlers stop reading their sockets.
+/// Clients are served by start-time fair queueing: each frame written advances its
+/// client's virtual time by its events over the client's weight, and the waiting
+/// client with the lowest virtual time goes next. A client that has been idle
+/// starts at the virtual time of the frame being written, so a single click is
+/// written next even while another client has a long backlog
+/// @param arg Unused
+void * ydotoold_writer(void * arg) {
+    (void)arg;
+    uint32_t next = 0;
+    static struct input_event RELEASE[RELEASE_EVENTS];
+
+    static const struct input_event SYN = { { 0, 0 }, EV_SYN, SYN_REPORT, 0 };
+
+    pthread_mutex_lock(&QUEUE_LOCK);
+    for (;;) {
+        // Timed holds are released once due, between frames rather than inside STICKY's
+        size_t released = 0;
+        struct ydotoold_hold expired;
+        int64_t t_expire = recorder_now();
+        int64_t due = STICKY ? 0 : ydotoold_hold_expire(t_expire, RELEASE, &released, &expired);
+        if (due < 0) {
+            pthread_mutex_unlock(&QUEUE_LOCK);
+            if (released) {
+                int err = uinput_send_frames(RELEASE, released);
+                struct recorder_record record = {
+                    0,
+                    expired.client,
+                    (uint16_t)released,
+                    err ? RECORDER_FLAG_DROPPED : 0,
+                    expired.due,
+                    expired.due,
+                    t_expire,
+                    recorder_now()
+                };
+                recorder_add(&record);
+            }
+            pthread_mutex_lock(&QUEUE_LOCK);
+            STATS.released += released;
+            continue;
+        }
+
+        // A frame split over several slots is finished before anyone else's, unless its
+        // client stops short of the SYN_REPORT for longer than STICKY_MS
+        struct ydotoold_client * client = STICKY;
+        if (client && client->head == client->tail) {
+            if (recorder_now() < STICKY_DUE) {
+                ydotoold_writer_wait(due && due < STICKY_DUE ? due : STICKY_DUE);
+                continue;
+            }
+            STICKY = NULL;
+            log_warn("ydotoold: client %u left a frame unfinished for %d ms, ending it\n", client->id, STICKY_MS);
+            pthread_mutex_unlock(&QUEUE_LOCK);
+            uinput_send_frames(&SYN, 1);
+            pthread_mutex_lock(&QUEUE_LOCK);
+            continue;
+        }
+        if (!QUEUED) {
+            ydotoold_writer_wait(due);
+            continue;
+        }
+        if (!client) {
+            // Scanning from after the last client picked takes turns between equals
+            uint32_t pick = 0;
+            for (uint32_t i = 0; i != YDOTOOLD_MAX_CLIENTS; ++i) {
+                struct ydotoold_client * c = CLIENTS[(next + i) % YDOTOOLD_MAX_CLIENTS];
+                if (c && c->head != c->tail && (!client || c->vtime < client->vtime)) {
+                    client = c;
+                    pick = i;
+                }
+            }
+            next = (next + pick + 1) % YDOTOOLD_MAX_CLIENTS;
+        }
+        if (!client) {
+            // Only frames of clients already removed; shouldn't happen
+            QUEUED = 0;
+            continue;
+        }
+
+        // The slot stays put until head moves on, so write it unlocked
+        struct ydotoold_frame * frame = &client->frames[client->head % YDOTOOLD_QUEUE_FRAMES];
+        int continued = STICKY == client;
+        int discard = (int32_t)(client->discard - client->head) > 0;
+        VTIME = client->vtime;
+        pthread_mutex_unlock(&QUEUE_LOCK);
+
+        int64_t t_dequeue = recorder_now();
+        int complete = frame->macro || !frame->count
+            || frame->events[frame->count - 1].type == EV_SYN;
+
+        // Keep track of what the client holds down, dropping what changes nothing
+        const struct input_event * out = frame->events;
+        size_t count = 0;
+        uint64_t redundant = 0;
+        if (discard) {
+            // Cancelled
+        } else if (frame->op == FRAME_RELEASE) {
+            out = RELEASE;
+            count = ydotoold_release(&client->held, RELEASE);
+        } else if (frame->op == FRAME_KEEP) {
+            ydotoold_keep(&client->held);
+        } else if (frame->op == FRAME_HOLD) {
+            if (ydotoold_hold(client, frame->hold_ms)) {
+                log_warn("ydotoold: too many timed holds, releasing client %u's keys now\n", client->id);
+                out = RELEASE;
+                count = ydotoold_release(&client->held, RELEASE);
+            }
+        } else if (frame->macro) {
+            // Tracked as it is written, see ydotoold_write_macro()
+        } else {
+            redundant = ydotoold_filter(&client->held, frame, continued);
+            count = frame->count;
+        }
+        uint64_t events = frame->macro && !discard ? ydotoold_frame_events(frame) : count;
+
+        int err = 0;
+        if (frame->macro) {
+            err = discard ? 0 : ydotoold_write_macro(&client->held, frame, &redundant);
+            events -= redundant;
+            ydotoold_macro_unref(frame->macro);
+        } else if (count) {
+            err = uinput_send_frames(out, count);
+        }
+
+        struct recorder_record record = {
+            0,
+            client->id,
+            (uint16_t)count,
+            (frame->macro ? RECORDER_FLAG_MACRO : 0) | (frame->merged ? RECORDER_FLAG_COALESCED : 0)
+                | (err ? RECORDER_FLAG_DROPPED : 0),
+            frame->t_send,
+            frame->t_recv,
+            t_dequeue,
+            recorder_now()
+        };
+        recorder_add(&record);
+
+        int written = !err && !discard && frame->op == FRAME_WRITE;
+        int64_t wait = t_dequeue - frame->t_recv;
+        pthread_mutex_lock(&QUEUE_LOCK);
+        client->head++;
+        client->vtime += events * VTIME_PER_EVENT / client->policy->weight;
+        if (written) {
+            client->stats.frames++;
+            client->stats.events += events;
+        }
+        client->stats.wait_ns += (uint64_t)wait;
+        if ((uint64_t)wait > client->stats.max_wait_ns) {
+            client->stats.max_wait_ns = (uint64_t)wait;
+        }
+        QUEUED--;
+        STATS.frames += (uint64_t)written;
+        STATS.redundant += redundant;
+        STATS.released += frame->op != FRAME_WRITE ? count : 0;
+        STATS.cancelled += (uint64_t)discard;
+        if (complete || client->closing) {
+            STICKY = NULL;
+        } else if (STICKY != client) {
+            STICKY = client;
+            STICKY_DUE = recorder_now() + (int64_t)STICKY_MS * 1000000;
+        }
+        pthread_cond_signal(&client->space);
+    }
+
+    return NULL;
+}
+
+/// Read exactly len bytes from a client, buffering whatever else arrives
+/// @param client The client
+/// @param dst Buffer for the bytes
+/// @param len Number of bytes to read
+/// @return 0 on success, 1 if the client disconnected
+int ydotoold_client_read(struct ydotoold_client * client, void * dst, size_t len) {
+    char * out = dst;
+    while (len) {
+        if (client->buf_pos == client->buf_len) {
+            ssize_t rc = recv(client->fd, client->buf, sizeof(client->buf), 0);
+            if (rc <= 0) {
+                if (rc < 0 && errno == EINTR) {
+                    continue;
+                }
+                return 1;
+            }
+            client->buf_len = (size_t)rc;
+            client->buf_pos = 0;
+        }
+
+        size_t n = client->buf_len - client->buf_pos;
+        n = n < len ? n : len;
+        memcpy(out, client->buf + client->buf_pos, n);
+        client->buf_pos += n;
+        out += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/// Handle a control request from a client and send back the result
+/// @param client The client
+/// @param req The control request header
+/// @return 0 on success, 1 if the connection should be closed
+int ydotoold_control(struct ydotoold_client * client, struct input_event * req) {
+    char payload[YDOTOOLD_MAX_PAYLOAD];
+    const void * reply = NULL;
+    struct ydotoold_stats stats;
+    struct ydotoold_client_stats clients[YDOTOOLD_MAX_CLIENTS];
+
+    if (req->value < 0 || req->value > YDOTOOLD_MAX_PAYLOAD) {
+        return 1;
+    }
+    size_t len = (size_t)req->value;
+    if (len && ydotoold_client_read(client, payload, len)) {
+        return 1;
+    }
+
+    int32_t result = -EINVAL;
+    switch (req->code) {
+        case YDOTOOLD_CTL_MACRO_DEFINE:
+            result = ydotoold_macro_define(payload, len);
+            break;
+        case YDOTOOLD_CTL_MACRO_RUN:
+            if (len == sizeof(struct ydotoold_macro_run)) {
+                result = ydotoold_macro_run(client, (struct ydotoold_macro_run *)payload);
+            }
+            break;
+        case YDOTOOLD_CTL_RECORDER_DUMP:
+            result = recorder_dump(RECORDER_PATH);
+            if (result < 0) {
+                result = -errno;
+            }
+            break;
+        case YDOTOOLD_CTL_CANCEL:
+            pthread_mutex_lock(&QUEUE_LOCK);
+            client->discard = client->tail;
+            pthread_mutex_unlock(&QUEUE_LOCK);
+            ydotoold_queue_op(client, FRAME_RELEASE, 0);
+            // Answered like a sync, once the releases are written
+            // fall through
+        case YDOTOOLD_CTL_SYNC:
+            // Frames ending before this request have been queued already
+            pthread_mutex_lock(&QUEUE_LOCK);
+            while (client->head != client->tail) {
+                pthread_cond_wait(&client->space, &QUEUE_LOCK);
+            }
+            pthread_mutex_unlock(&QUEUE_LOCK);
+            result = 0;
+            break;
+        case YDOTOOLD_CTL_KEEP:
+            ydotoold_queue_op(client, FRAME_KEEP, 0);
+            result = 0;
+            break;
+        case YDOTOOLD_CTL_HOLD:
+            if (len == sizeof(uint32_t)) {
+                uint32_t hold_ms;
+                memcpy(&hold_ms, payload, sizeof(hold_ms));
+                ydotoold_queue_op(client, FRAME_HOLD, hold_ms);
+                result = 0;
+            }
+            break;
+        case YDOTOOLD_CTL_RAW:
+            client->raw = 1;
+            result = 0;
+            break;
+        case YDOTOOLD_CTL_STATS: {
+            struct uinput_stats device;
+            uinput_get_stats(&device);
+
+            pthread_mutex_lock(&QUEUE_LOCK);
+            stats = STATS;
+            stats.queued = QUEUED;
+            pthread_mutex_unlock(&QUEUE_LOCK);
+
+            stats.writes = device.frames;
+            stats.events = device.events;
+            stats.stalls = device.stalls;
+            stats.drops = device.drops;
+            reply = &stats;
+            result = sizeof(stats);
+            break;
+        }
+        case YDOTOOLD_CTL_CLIENTS: {
+            size_t count = 0;
+            pthread_mutex_lock(&QUEUE_LOCK);
+            for (uint32_t i = 0; i != YDOTOOLD_MAX_CLIENTS; ++i) {
+                if (CLIENTS[i]) {
+                    clients[count] = CLIENTS[i]->stats;
+                    clients[count].queued = CLIENTS[i]->tail - CLIENTS[i]->head;
+                    count++;
+                }
+            }
+            pthread_mutex_unlock(&QUEUE_LOCK);
+            reply = clients;
+            result = (int32_t)(count * sizeof(*clients));
+            break;
+        }
+    }
+
+    req->value = result;
+    struct iovec iov[2] = {
+        { req, sizeof(*req) },
+        { (void *)reply, reply ? (size_t)result : 0 }
+    };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    if (sendmsg(client->fd, &msg, MSG_NOSIGNAL) != (ssize_t)(iov[0].iov_len + iov[1].iov_len)) {
+        return 1;
+    }
+    return 0;
+}
+
+/// Parse a --policy option
+/// @param arg "<uid>:<weight>[:<rate>[:<burst>]]", where uid "*" stands for users without a policy of their own
+/// @return 0 on success, 1 if error(s)
+int ydotoold_add_policy(const char * arg) {
+    if (NUM_POLICIES == MAX_POLICIES) {
+        return 1;
+    }
+    struct ydotoold_policy * policy = &POLICIES[NUM_POLICIES];
+
+    char * end = (char *)arg + 1;
+    policy->uid = arg[0] == '*' ? -1 : strtoll(arg, &end, 10);
+    if (end == arg || policy->uid < -1) {
+        return 1;
+    }
+
+    // Weight, rate and burst
+    unsigned long values[3] = { 1, 0, 0 };
+    for (int i = 0; i != 3 && *end == ':'; ++i) {
+        const char * start = end + 1;
+        values[i] = strtoul(start, &end, 10);
+        if (end == start || values[i] > UINT32_MAX) {
+            return 1;
+        }
+    }
+    if (*end || !values[0] || values[0] > MAX_WEIGHT) {
+        return 1;
+    }
+    policy->weight = (uint32_t)values[0];
+    policy->rate = (uint32_t)values[1];
+    // A second's worth unless given
+    policy->burst = (uint32_t)(values[2] ? values[2] : values[1]);
+    NUM_POLICIES++;
+    return 0;
+}
+
+/// Find the policy of a user
+/// @param uid The user, -1 if unknown
+/// @return The policy given for the user, or else for all users, or else DEFAULT_POLICY
+static const struct ydotoold_policy * ydotoold_find_policy(int64_t uid) {
+    const struct ydotoold_policy * any = &DEFAULT_POLICY;
+    for (size_t i = 0; i != NUM_POLICIES; ++i) {
+        if (POLICIES[i].uid == uid) {
+            return &POLICIES[i];
+        }
+        if (POLICIES[i].uid == -1) {
+            any = &POLICIES[i];
+        }
+    }
+    return any;
+}
+
+/// Add a newly accepted client
+/// @param fd Socket of the client
+/// @return The client, or NULL if error(s)
+struct ydotoold_client * ydotoold_client_add(int fd) {
+    struct ydotoold_client * client = calloc(1, sizeof(*client));
+    if (!client) {
+        return NULL;
+    }
+    client->fd = fd;
+    pthread_cond_init(&client->space, NULL);
+
+    // The peer's credentials as of connect(), checked by the kernel
+    socklen_t len = sizeof(client->cred);
+    int64_t uid = -1;
+    if (!getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &client->cred, &len)) {
+        uid = client->cred.uid;
+    }
+    client->policy = ydotoold_find_policy(uid);
+    client->tokens = client->policy->burst;
+    client->t_tokens = recorder_now();
+    client->stats.pid = (uint32_t)client->cred.pid;
+    client->stats.uid = client->cred.uid;
+    client->stats.weight = client->policy->weight;
+    client->stats.rate = client->policy->rate;
+
+    pthread_mutex_lock(&QUEUE_LOCK);
+    for (uint32_t i = 0; i != YDOTOOLD_MAX_CLIENTS; ++i) {
+        if (!CLIENTS[i]) {
+            CLIENTS[i] = client;
+            client->id = (uint32_t)++STATS.clients;
+            client->stats.id = client->id;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&QUEUE_LOCK);
+
+    if (!client->id) {
+        log_warn("ydotoold: too many clients\n");
+        pthread_cond_destroy(&client->space);
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+/// Remove a disconnected client once the writer is done with its queue
+/// @param client The client
+void ydotoold_client_remove(struct ydotoold_client * client) {
+    pthread_mutex_lock(&QUEUE_LOCK);
+    client->closing = 1;
+    while (client->head != client->tail) {
+        pthread_cond_wait(&client->space, &QUEUE_LOCK);
+    }
+    if (STICKY == client) {
+        STICKY = NULL;
+        pthread_cond_signal(&QUEUE_WORK);
+    }
+    for (uint32_t i = 0; i != YDOTOOLD_MAX_CLIENTS; ++i) {
+        if (CLIENTS[i] == client) {
+            CLIENTS[i] = NULL;
+        }
+    }
+    LAST_ACTIVE = recorder_now();
+    pthread_mutex_unlock(&QUEUE_LOCK);
+
+    close(client->fd);
+    pthread_cond_destroy(&client->space);
+    free(client);
+}
+
+/// Prepare for real-time mode: lock all memory and make QUEUE_LOCK hand its waiters' priority to the holder
+/// @details MCL_FUTURE also populates everything mapped from here on (client queues, thread stacks),
+/// so neither the writer nor a client thread holding QUEUE_LOCK page faults once running
+/// @return 0 on success, 1 if error(s)
+int ydotoold_realtime() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        fprintf(stderr, "ydotoold: failed to lock memory: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // Client threads run at normal priority, and must not hold up the writer waiting on the lock
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    int err = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    if (!err) {
+        err = pthread_mutex_init(&QUEUE_LOCK, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+    if (err) {
+        fprintf(stderr, "ydotoold: failed to set up priority inheritance: %s\n", strerror(err));
+        return 1;
+    }
+    return 0;
+}
+
+/// Start the writer thread, under SCHED_FIFO at RT_PRIORITY and pinned to RT_CPU when set
+/// @return 0 on success, 1 if error(s)
+int ydotoold_start_writer() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    int err = 0;
+    if (RT_PRIORITY) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = RT_PRIORITY;
+        err = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        if (!err) {
+            err = pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        }
+        if (!err) {
+            err = pthread_attr_setschedparam(&attr, &param);
+        }
+    }
+    if (!err && RT_CPU >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET((size_t)RT_CPU, &cpus);
+        err = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    pthread_t writer;
+    if (!err) {
+        err = pthread_create(&writer, &attr, ydotoold_writer, NULL);
+    }
+    if (!err) {
+        err = pthread_detach(writer);
+    }
+    pthread_attr_destroy(&attr);
+    if (err) {
+        fprintf(stderr, "ydotoold: Error creating writer thread: %s\n", strerror(err));
+        return 1;
+    }
+    return 0;
+}
+
+/// Find how long the daemon has been without clients
+/// @return Nanoseconds since the last client left, -1 while any are connected
+int64_t ydotoold_idle_ns() {
+    int64_t idle = recorder_now();
+    pthread_mutex_lock(&QUEUE_LOCK);
+    idle -= LAST_ACTIVE;
+    for (uint32_t i = 0; i != YDOTOOLD_MAX_CLIENTS; ++i) {
+        if (CLIENTS[i]) {
+            idle = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&QUEUE_LOCK);
+    return idle;
+}
+
+/// Exit if there are still no clients, and none about to connect
+/// @details Holding YDOTOOLD_LOCK_PATH exclusively keeps clients from connecting
+/// (they hold it shared while they do) or spawning a new daemon while the socket goes away
+/// @return 0 if there is work after all, doesn't return otherwise
+int ydotoold_idle_exit() {
+    int lock = open(YDOTOOLD_LOCK_PATH, O_RDONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (lock == -1 || flock(lock, LOCK_EX | LOCK_NB)) {
+        if (lock != -1) {
+            close(lock);
+        }
+        return 0;
+    }
+
+    struct pollfd pfd = { FD_LIST, POLLIN, 0 };
+    if (poll(&pfd, 1, 0) || ydotoold_idle_ns() < (int64_t)IDLE_MS * 1000000) {
+        close(lock);
+        return 0;
+    }
+
+    log_info("ydotoold: idle for %ums, exiting\n", IDLE_MS);
+    if (OWN_SOCKET) {
+        unlink(YDOTOOLD_SOCKET_PATH);
+    }
+    close(FD_LIST);
+    uinput_destroy();
+    exit(0);
+}
+
+/// Function for dumping the flight recorder on SIGUSR1
+/// @param sig The signal received by the program
+void ydotoold_recorder_handler(int sig) {
+    (void)sig;
+    int saved = errno;
+    recorder_dump(RECORDER_PATH);
+    errno = saved;
+}
+
+/// Function for stepping through the log levels on SIGUSR2
+/// @details Logging only touches the lock-free ring, so it is safe here
+/// @param sig The signal received by the program
+void ydotoold_log_level_handler(int sig) {
+    (void)sig;
+    int saved = errno;
+    enum log_level level = (enum log_level)((log_get_level() + 1) % (LOG_LEVEL_DEBUG + 1));
+    log_set_level(level);
+    log_write(level, "ydotoold: log level %s\n", log_level_name(level));
+    errno = saved;
+}
+
 /// Function for handling user interruption (Ctrl-C)
 /// @param sig The signal received by the program
 void ydotoold_sig_handler(int sig) {
-    printf("\nReceived %s. Terminating...\n", sys_siglist[sig]);
+    printf("\nReceived %s. Terminating...\n", strsignal(sig));
     uinput_destroy();
     close(FD_LIST);
     exit(0);
 }
 
-/// Function for handling a uinput event sent from the main ydotool program via socket
-/// @param fdp File descriptor pointer for the open socket
-void * ydotoold_client_handler(void * fdp) {
-	struct uinput_raw_data buf;
-    int fd = *(int *)fdp;
+/// Function for handling uinput events sent from the main ydotool program via socket
+/// @details Events are gathered into frames and queued for the writer thread
+/// @param arg The client, as returned by ydotoold_client_add()
+void * ydotoold_client_handler(void * arg) {
+    struct ydotoold_client * client = arg;
+    struct ydotoold_frame * frame = NULL;
+	struct input_event buf;
 
-	for (;;) {
-		ssize_t rc = recv(fd, &buf, sizeof(buf), MSG_WAITALL);
+	while (!ydotoold_client_read(client, &buf, sizeof(buf))) {
+        // A raw stream out of step, or not input events at all: none of this frame is trusted
+        if (client->raw && buf.type > EV_MAX) {
+            log_warn("ydotoold: client %u sent an invalid event type %#x, disconnecting\n",
+                client->id, buf.type);
+            if (frame) {
+                frame->count = 0;
+            }
+            break;
+        }
 
-		if (rc != sizeof(buf)) {
-			break;
-		}
+        if (buf.type == YDOTOOLD_CTL) {
+            if (ydotoold_control(client, &buf)) {
+                break;
+            }
+            continue;
+        }
+
+        if (!frame) {
+            frame = ydotoold_queue_reserve(client);
+        }
+        frame->events[frame->count++] = buf;
 
-		uinput_emit(buf.type, buf.code, buf.value);
+        // Stamped by the client with its send time, see ydotoold.h
+        if (!client->raw && buf.type == EV_SYN && buf.code == SYN_REPORT && buf.input_event_sec
+                && buf.input_event_usec >= 0 && buf.input_event_usec < 1000000000) {
+            frame->t_send = (int64_t)buf.input_event_sec * 1000000000 + buf.input_event_usec;
+        }
+
+        // Queue each frame as soon as it's complete, or once its slot is full
+        if ((buf.type == EV_SYN && buf.code == SYN_REPORT) || frame->count == YDOTOOLD_FRAME_EVENTS) {
+            ydotoold_queue_push(client);
+            frame = NULL;
+        }
 	}
 
+    // Don't leave half a frame behind, nor anything held down
+    if (frame && frame->count) {
+        ydotoold_queue_push(client);
+    }
+    ydotoold_queue_op(client, FRAME_RELEASE, 0);
+
+    log_debug("ydotoold: client %u disconnected\n", client->id);
+    ydotoold_client_remove(client);
     pthread_exit(NULL);
 }
 
-/// Main entrypoint to the ydotool daemon program
-/// @return 0 on success, 1 if error(s)
-int main() {
-    // Setup SIGINT signal handling
-    struct sigaction act;
-    act.sa_handler = &ydotoold_sig_handler;
-    sigaction(SIGINT, &act, NULL);
+/// Usage string of the daemon
+static const char ydotoold_usage[] =
+    "Usage: ydotoold [--listen-fd <fd>] [--ready-fd <fd>] [--recorder <path>] [--null] [--idle-timeout <ms>] [--coalesce]\n"
+    "                [--realtime <priority>] [--cpu <n>] [--policy <uid>:<weight>[:<rate>[:<burst>]]]...\n"
+    "                [--log-level <level>]\n"
+    "    --help           Show this help\n"
+    "    --listen-fd fd   Use an inherited, already listening socket instead of creating " YDOTOOLD_SOCKET_PATH "\n"
+    "                     (also taken from LISTEN_FDS/LISTEN_PID when socket activated by systemd)\n"
+    "    --ready-fd fd    Write a newline to fd and close it once the device is ready for input\n"
+    "                     (NOTIFY_SOCKET is also notified when set)\n"
+    "    --recorder path  Dump the flight recorder to path on SIGUSR1 or request (default " YDOTOOLD_RECORDER_PATH ")\n"
+    "    --null           Discard all input instead of creating a device, for load testing\n"
+    "    --idle-timeout ms  Exit once no client has been connected for ms\n"
+    "    --coalesce       Merge pointer and touch motion frames queued behind each other into the\n"
+    "                     latest position while a client's frames wait for the device\n"
+    "    --realtime prio  Run the device writer under SCHED_FIFO at prio (1-99), with all memory\n"
+    "                     locked; client sockets are still handled at normal priority\n"
+    "    --cpu n          Pin the device writer to CPU n\n"
+    "    --policy uid:weight[:rate[:burst]]\n"
+    "                     Give each client of user uid (* for everyone else) weight shares of the\n"
+    "                     device while others wait too (default 1), and limit it to queueing rate\n"
+    "                     events per second, burst of them at once (default rate); may be repeated\n"
+    "    --log-level level  Log errors, warn(ings), info (default) or debug messages; also set by\n"
+    "                     $" LOG_LEVEL_ENV ", and stepped through at runtime by SIGUSR2\n";
 
-    // Initialise input device
-    if (uinput_init()) {
-        return 1;
+/// First file descriptor passed by socket activation
+#define LISTEN_FDS_START 3
+
+/// Find a listening socket inherited through systemd style socket activation
+/// @return The file descriptor, or -1 if none was passed to this process
+int ydotoold_activated_fd() {
+    const char * pid = getenv("LISTEN_PID");
+    const char * fds = getenv("LISTEN_FDS");
+
+    if (!pid || !fds || strtol(pid, NULL, 10) != getpid() || strtol(fds, NULL, 10) < 1) {
+        return -1;
     }
 
-    // Create socket
-	const char * path_socket = "/tmp/.ydotool_socket";
+    // Don't pass the sockets on to anything we might run
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    return LISTEN_FDS_START;
+}
+
+/// Create, bind and listen on the daemon socket
+/// @return The listening file descriptor, or -1 if error(s)
+int ydotoold_listen() {
+	const char * path_socket = YDOTOOLD_SOCKET_PATH;
 	unlink(path_socket);
-	FD_LIST = socket(AF_UNIX, SOCK_STREAM, 0);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
 
-	if (FD_LIST == -1) {
+	if (fd == -1) {
 		fprintf(stderr, "ydotoold: failed to create socket: %s\n", strerror(errno));
-		return 1;
+		return -1;
 	}
 
 	struct sockaddr_un addr;
@@ -87,33 +1592,256 @@ int main() {
 	addr.sun_family = AF_UNIX;
 	strncpy(addr.sun_path, path_socket, sizeof(addr.sun_path)-1);
 
-	if (bind(FD_LIST, (struct sockaddr *)&addr, sizeof(addr))) {
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
 		fprintf(stderr, "ydotoold: failed to bind to socket [%s]: %s\n", path_socket, strerror(errno));
-		return 1;
+		close(fd);
+		return -1;
 	}
 
-	if (listen(FD_LIST, 16)) {
+	if (listen(fd, 16)) {
 		fprintf(stderr, "ydotoold: failed to listen on socket [%s]: %s\n", path_socket, strerror(errno));
-		return 1;
+		close(fd);
+		return -1;
 	}
 
     mode_t open_access = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
 	chmod(path_socket, open_access);
 	printf("ydotoold: listening on socket %s\n", path_socket);
+	return fd;
+}
+
+/// Tell whoever started the daemon that it is ready for input
+/// @param ready_fd File descriptor to write a newline to, or -1
+void ydotoold_notify_ready(int ready_fd) {
+    if (ready_fd != -1) {
+        if (write(ready_fd, "\n", 1) != 1) {
+            fprintf(stderr, "ydotoold: failed to write to ready fd %d: %s\n", ready_fd, strerror(errno));
+        }
+        close(ready_fd);
+    }
+
+    // sd_notify protocol: a datagram to the socket in NOTIFY_SOCKET
+    const char * path = getenv("NOTIFY_SOCKET");
+    if (!path || (path[0] != '/' && path[0] != '@') || strlen(path) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+        return;
+    }
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path));
+    // A leading '@' means an abstract socket
+    if (addr.sun_path[0] == '@') {
+        addr.sun_path[0] = '\0';
+    }
+    socklen_t len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + strlen(path));
+
+    const char * msg = "READY=1";
+    if (sendto(fd, msg, strlen(msg), MSG_NOSIGNAL, (struct sockaddr *)&addr, len) < 0) {
+        fprintf(stderr, "ydotoold: failed to notify %s: %s\n", path, strerror(errno));
+    }
+    close(fd);
+    unsetenv("NOTIFY_SOCKET");
+}
+
+/// Main entrypoint to the ydotool daemon program
+/// @param argc Number of input arguments
+/// @param argv Array of input arguments
+/// @return 0 on success, 1 if error(s)
+int main(int argc, char ** argv) {
+    int ready_fd = -1;
+    int null_device = 0;
+    enum log_level log_level = LOG_LEVEL_INFO;
+    int log_level_set = 0;
+
+    enum optlist_t {
+        opt_help,
+        opt_listen_fd,
+        opt_ready_fd,
+        opt_recorder,
+        opt_null,
+        opt_idle_timeout,
+        opt_coalesce,
+        opt_realtime,
+        opt_cpu,
+        opt_policy,
+        opt_log_level,
+    };
+
+    static struct option long_options[] = {
+        {"help",      no_argument,       NULL, opt_help     },
+        {"listen-fd", required_argument, NULL, opt_listen_fd},
+        {"ready-fd",  required_argument, NULL, opt_ready_fd },
+        {"recorder",  required_argument, NULL, opt_recorder },
+        {"null",      no_argument,       NULL, opt_null     },
+        {"idle-timeout", required_argument, NULL, opt_idle_timeout},
+        {"coalesce",  no_argument,       NULL, opt_coalesce },
+        {"realtime",  required_argument, NULL, opt_realtime },
+        {"cpu",       required_argument, NULL, opt_cpu      },
+        {"policy",    required_argument, NULL, opt_policy   },
+        {"log-level", required_argument, NULL, opt_log_level},
+        {NULL,        0,                 NULL, 0            }
+    };
+
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case opt_listen_fd:
+                FD_LIST = (int)strtol(optarg, NULL, 10);
+                break;
+            case opt_ready_fd:
+                ready_fd = (int)strtol(optarg, NULL, 10);
+                break;
+            case opt_recorder:
+                RECORDER_PATH = optarg;
+                break;
+            case opt_null:
+                null_device = 1;
+                break;
+            case opt_idle_timeout:
+                IDLE_MS = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_coalesce:
+                COALESCE = 1;
+                break;
+            case opt_realtime:
+                RT_PRIORITY = (int)strtol(optarg, NULL, 10);
+                if (RT_PRIORITY < sched_get_priority_min(SCHED_FIFO) || RT_PRIORITY > sched_get_priority_max(SCHED_FIFO)) {
+                    fprintf(stderr, "ydotoold: invalid real-time priority %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case opt_cpu:
+                RT_CPU = (int)strtol(optarg, NULL, 10);
+                if (RT_CPU < 0 || RT_CPU >= CPU_SETSIZE) {
+                    fprintf(stderr, "ydotoold: invalid CPU %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case opt_policy:
+                if (ydotoold_add_policy(optarg)) {
+                    fprintf(stderr, "ydotoold: invalid policy %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case opt_log_level:
+                if (log_parse_level(optarg, &log_level)) {
+                    fprintf(stderr, "ydotoold: invalid log level %s\n", optarg);
+                    return 1;
+                }
+                log_level_set = 1;
+                break;
+            default:
+                fprintf(stderr, "%s", ydotoold_usage);
+                return 1;
+        }
+    }
+
+    // Messages are written by a thread of their own, so no client waits on the console
+    if (log_init(log_level, 1)) {
+        return 1;
+    }
+    // The option wins over the environment
+    if (log_level_set) {
+        log_set_level(log_level);
+    }
+
+    if (RT_PRIORITY && ydotoold_realtime()) {
+        return 1;
+    }
+
+    // Setup SIGINT signal handling
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = &ydotoold_sig_handler;
+    sigaction(SIGINT, &act, NULL);
+
+    // Dump the flight recorder on SIGUSR1, without disturbing blocked calls
+    act.sa_handler = &ydotoold_recorder_handler;
+    act.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &act, NULL);
+
+    // Step through the log levels on SIGUSR2
+    act.sa_handler = &ydotoold_log_level_handler;
+    sigaction(SIGUSR2, &act, NULL);
+
+    // Listen before the device exists, so clients starting meanwhile queue up
+    // on the socket instead of falling back to a device of their own
+    if (FD_LIST == -1) {
+        FD_LIST = ydotoold_activated_fd();
+    }
+    if (FD_LIST == -1) {
+        if ((FD_LIST = ydotoold_listen()) == -1) {
+            return 1;
+        }
+        OWN_SOCKET = 1;
+    }
+
+    // Initialise input device, and only report ready once it's usable
+    if (null_device ? uinput_create_null() : uinput_create_device()) {
+        return 1;
+    }
+    if (uinput_wait_device(1000)) {
+        fprintf(stderr, "ydotoold: device may not be ready yet\n");
+    }
+    // Only the writer thread writes to the device from here on
+    if (ydotoold_start_writer()) {
+        return 1;
+    }
+
+    // Client threads keep the default scheduling, with small stacks when they get locked in memory
+    pthread_attr_t client_attr;
+    pthread_attr_init(&client_attr);
+    if (RT_PRIORITY) {
+        pthread_attr_setstacksize(&client_attr, RT_CLIENT_STACK);
+    }
+
+    ydotoold_notify_ready(ready_fd);
+    LAST_ACTIVE = recorder_now();
 
     // Wait for tasks
-    int fd_client = 0;
-	while ((fd_client = accept(FD_LIST, NULL, NULL))) {
-		printf("ydotoold: accepted client\n");
+    for (;;) {
+        if (IDLE_MS) {
+            int64_t idle = ydotoold_idle_ns();
+            int timeout = (int)(idle < 0 ? IDLE_MS : idle < (int64_t)IDLE_MS * 1000000 ? IDLE_MS - idle / 1000000 : 0);
+            struct pollfd pfd = { FD_LIST, POLLIN, 0 };
+            int ready = poll(&pfd, 1, timeout);
+            if (ready <= 0) {
+                if (!ready) {
+                    ydotoold_idle_exit();
+                }
+                continue;
+            }
+        }
+
+        int fd_client = accept(FD_LIST, NULL, NULL);
+        if (fd_client == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            log_error("ydotoold: failed to accept client: %s\n", strerror(errno));
+            break;
+        }
+
+        struct ydotoold_client * client = ydotoold_client_add(fd_client);
+        if (!client) {
+            close(fd_client);
+            continue;
+        }
+        log_info("ydotoold: accepted client %u (pid %d, uid %u)\n", client->id, (int)client->cred.pid, (unsigned)client->cred.uid);
 
         pthread_t thd;
-        if (pthread_create(&thd, NULL, ydotoold_client_handler, (void *)&fd_client)) {
-            fprintf(stderr, "ydotoold: Error creating thread!\n");
+        if (pthread_create(&thd, &client_attr, ydotoold_client_handler, client)) {
+            log_error("ydotoold: Error creating thread!\n");
             return 1;
         }
 
         if (pthread_detach(thd)) {
-            fprintf(stderr, "ydotoold: Error detaching thread!\n");
+            log_error("ydotoold: Error detaching thread!\n");
             return 1;
         }
 	}
@@ -0,0 +1,197 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+/// Copyright (C) 2018-2019 ReimuNotMoe
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file ydotoold.h
+/// @author Harry Austen
+/// @brief Protocol spoken between ydotool clients and the ydotool daemon
+/// @details Clients write a stream of struct input_event records to the socket,
+/// which the daemon passes on to its device. A record with type YDOTOOLD_CTL is a
+/// control request instead: its code is the request (enum ydotoold_ctl) and its
+/// value the number of payload bytes following it. The daemon answers every
+/// control request with a YDOTOOLD_CTL record of the same code whose value is
+/// the result (negative errno on failure)
+///
+/// Clients may stamp the SYN_REPORT ending each frame with the CLOCK_MONOTONIC
+/// time they sent it, seconds in input_event_sec and nanoseconds in
+/// input_event_usec, for the daemon's flight recorder. The device ignores it
+///
+/// The daemon keeps track of the keys, buttons and touch contacts each client
+/// holds down. It doesn't write presses of what is already down or releases of
+/// what the client doesn't hold, and releases whatever a client still holds when
+/// it disconnects, unless the client asked to keep it (YDOTOOLD_CTL_KEEP)
+///
+/// After YDOTOOLD_CTL_RAW the rest of the stream is taken as raw input events,
+/// such as those read from an evdev node, and may be spliced in unchanged
+
+#ifndef __YDOTOOLD_H__
+#define __YDOTOOLD_H__
+
+// System includes
+#include <stddef.h>
+#include <stdint.h>
+
+/// Path of the socket the daemon listens on
+#define YDOTOOLD_SOCKET_PATH "/tmp/.ydotool_socket"
+
+/// Event type marking a control request (not a valid input event type)
+#define YDOTOOLD_CTL 0xffff
+
+/// Maximum number of payload bytes in a control request
+#define YDOTOOLD_MAX_PAYLOAD 4096
+
+/// Maximum length of a macro name, including the null terminator
+#define YDOTOOLD_MACRO_NAME_LEN 32
+
+/// Maximum number of macros the daemon holds at once
+#define YDOTOOLD_MAX_MACROS 64
+
+/// Maximum number of clients connected at once
+#define YDOTOOLD_MAX_CLIENTS 256
+
+/// Maximum number of events queued as one frame (longer frames take several slots)
+#define YDOTOOLD_FRAME_EVENTS 32
+
+/// Number of frames each client can have queued before the daemon stops reading its socket
+#define YDOTOOLD_QUEUE_FRAMES 64
+
+/// Number of bytes read from a client socket at once
+#define YDOTOOLD_READ_BUFFER 4096
+
+/// Lock file serialising clients spawning the daemon against the daemon exiting when idle
+#define YDOTOOLD_LOCK_PATH "/tmp/.ydotool_socket.lock"
+
+/// Environment variable that makes clients spawn the daemon if it isn't running, when set to 1
+#define YDOTOOLD_SPAWN_ENV "YDOTOOL_SPAWN"
+
+/// Milliseconds a daemon spawned by a client stays up without clients
+#define YDOTOOLD_SPAWN_IDLE_MS 60000
+
+/// File the daemon dumps its flight recorder to by default
+#define YDOTOOLD_RECORDER_PATH "/tmp/ydotoold.recorder"
+
+/// @brief Control requests
+enum ydotoold_ctl {
+    /// Compile and register a macro. Payload: null-terminated name followed by
+    /// the null-terminated words of the macro steps. Result: the macro id
+    YDOTOOLD_CTL_MACRO_DEFINE = 1,
+    /// Run a registered macro. Payload: struct ydotoold_macro_run. Result: 0
+    YDOTOOLD_CTL_MACRO_RUN,
+    /// Get the daemon counters. Payload: none. Result: size of the
+    /// struct ydotoold_stats sent after the answer
+    YDOTOOLD_CTL_STATS,
+    /// Dump the flight recorder to the daemon's recorder file. Payload: none.
+    /// Result: the number of records written
+    YDOTOOLD_CTL_RECORDER_DUMP,
+    /// Wait until every frame the client sent before this request has been
+    /// written. Payload: none. Result: 0
+    YDOTOOLD_CTL_SYNC,
+    /// Get the counters of every connected client. Payload: none. Result: size
+    /// of the array of struct ydotoold_client_stats sent after the answer
+    YDOTOOLD_CTL_CLIENTS,
+    /// Skip every frame the client has queued, then release whatever keys,
+    /// buttons and touch contacts it holds down. Payload: none. Result: 0 once done
+    YDOTOOLD_CTL_CANCEL,
+    /// Leave whatever the client holds down so far held after it disconnects,
+    /// until some client releases it. Payload: none. Result: 0
+    YDOTOOLD_CTL_KEEP,
+    /// Take everything the client sends from now on as input events: their times
+    /// are not send times, and a record with a type beyond EV_MAX (including
+    /// YDOTOOLD_CTL) drops what has not been queued of the frame it is in and
+    /// ends the connection. Payload: none. Result: 0
+    YDOTOOLD_CTL_RAW,
+    /// Release whatever the client holds down so far after a while, even if it
+    /// disconnects first. The time counts from when the frames before this request
+    /// have been written. Payload: uint32_t milliseconds. Result: 0
+    YDOTOOLD_CTL_HOLD,
+};
+
+/// @brief Payload of a YDOTOOLD_CTL_MACRO_RUN request
+struct ydotoold_macro_run {
+    /// Id of the macro to run, or -1 to look it up by name
+    int32_t id;
+    /// Number of times to run the macro back to back
+    uint32_t repeats;
+    /// Name of the macro to run, if id is -1
+    char name[YDOTOOLD_MACRO_NAME_LEN];
+};
+
+/// @brief Daemon counters, answer to YDOTOOLD_CTL_STATS
+/// @details New counters are only ever added at the end
+struct ydotoold_stats {
+    /// Number of clients accepted since the daemon started
+    uint64_t clients;
+    /// Number of queued frames (or macro runs) written
+    uint64_t frames;
+    /// Number of frames currently queued
+    uint64_t queued;
+    /// Number of times a client had to wait for space in its queue
+    uint64_t queue_full;
+    /// Number of writes to the device
+    uint64_t writes;
+    /// Number of events written to the device
+    uint64_t events;
+    /// Number of times the device queue was full and a write had to wait
+    uint64_t stalls;
+    /// Number of writes dropped after retrying
+    uint64_t drops;
+    /// Number of motion frames merged into a frame queued before them (ydotoold --coalesce)
+    uint64_t coalesced;
+    /// Number of events not written because they changed nothing, like releasing a key that isn't down
+    uint64_t redundant;
+    /// Number of events written to release what clients held down when they left or cancelled
+    uint64_t released;
+    /// Number of queued frames skipped because their client cancelled them
+    uint64_t cancelled;
+};
+
+/// @brief Counters of a connected client, answer to YDOTOOLD_CTL_CLIENTS
+/// @details New counters are only ever added at the end
+struct ydotoold_client_stats {
+    /// Number identifying the client, as in the flight recorder
+    uint32_t id;
+    /// Process id of the client, from SO_PEERCRED
+    uint32_t pid;
+    /// User id of the client, from SO_PEERCRED
+    uint32_t uid;
+    /// Share of the device the client gets while others are waiting too
+    uint32_t weight;
+    /// Events per second the client may queue, 0 if unlimited
+    uint32_t rate;
+    /// Number of frames (or macro runs) written
+    uint64_t frames;
+    /// Number of events written
+    uint64_t events;
+    /// Number of frames currently queued
+    uint64_t queued;
+    /// Number of times the client was held back by its rate limit
+    uint64_t throttled;
+    /// Nanoseconds the client was held back by its rate limit
+    uint64_t throttled_ns;
+    /// Nanoseconds the written frames spent queued, in total
+    uint64_t wait_ns;
+    /// Longest a written frame spent queued, in nanoseconds
+    uint64_t max_wait_ns;
+};
+
+/// @brief Compile a macro and register it with the daemon, replacing any macro of the same name
+/// @param payload Null-terminated name followed by the null-terminated, non-empty words of the macro
+/// @param len Number of bytes in payload
+/// @return The macro id, or negative errno on failure
+int32_t ydotoold_macro_define(char * payload, size_t len);
+
+/// @brief Entry point of ydotoold in the multi-call binary, main() of ydotoold.c built with -Dmain=ydotoold_main
+/// @param argc Number of input arguments
+/// @param argv Array of input arguments
+/// @return 0 on success, 1 if error(s)
+int ydotoold_main(int argc, char ** argv);
+
+#endif // __YDOTOOLD_H__